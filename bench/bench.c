@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "tokenizer.h"
+#include "parser.h"
+#include "binder.h"
+#include "token.h"
+#include "asm_code_gen.h"
+#include "arena.h"
+#include "error.h"
+
+
+// Times each phase of compiling one file and appends the results to a CSV file.
+//
+// Peak RSS of a phase is measured by resetting the kernel's high water mark
+// before it (/proc/self/clear_refs). Allocation counts are the malloc family
+// calls made by the compiler's own code, the bench is linked with
+// '-Wl,--wrap=malloc,...' so they go through the counters below.
+
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_LINE 1024
+
+#define BENCH_CSV_HEADER \
+    "label,case,phase,input_bytes,tokens,runs,median_s,min_s," \
+    "mb_per_s,mtokens_per_s,peak_rss_kb,allocs,alloc_bytes\n"
+
+
+enum bench_phase {
+    PHASE_TOKENIZE,
+    PHASE_PARSE,
+    PHASE_REMOVE_EMPTY,
+    PHASE_BIND,
+    PHASE_CODEGEN,
+    PHASE_TOTAL,
+
+    NUM_PHASES
+};
+
+static const char* phase_names[NUM_PHASES] = {
+    [PHASE_TOKENIZE]     = "tokenize",
+    [PHASE_PARSE]        = "parse_tokens",
+    [PHASE_REMOVE_EMPTY] = "remove_empty_tokens",
+    [PHASE_BIND]         = "bind_tokens",
+    [PHASE_CODEGEN]      = "asm_code_gen",
+    [PHASE_TOTAL]        = "total"
+};
+
+struct phase_result {
+    double* seconds; // For each run.
+    size_t  peak_rss_kb;
+    size_t  allocs;
+    size_t  alloc_bytes;
+};
+
+struct bench_options {
+    const char*        input_file;
+    const char*        output_file;
+    const char*        results_file;
+    const char*        case_name;
+    const char*        label;
+    enum output_format format;
+    int                num_threads;
+    size_t             runs;
+    bool               tokenize_only;
+};
+
+
+// --- Allocation counters ---
+
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, num * size, __ATOMIC_RELAXED);
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+
+// --- Measuring ---
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns 'false' if the peak cant be reset, then peaks are for the whole process.
+static bool reset_peak_rss() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if(fd < 0) {
+        return false;
+    }
+    const bool result = (write(fd, "5", 1) == 1);
+    close(fd);
+    return result;
+}
+
+static size_t read_peak_rss_kb() {
+    FILE* f = fopen("/proc/self/status", "r");
+    if(f) {
+        char line[256];
+        size_t kb = 0;
+        while(fgets(line, sizeof line, f)) {
+            if(sscanf(line, "VmHWM: %zu kB", &kb) == 1) {
+                fclose(f);
+                return kb;
+            }
+        }
+        fclose(f);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct phase_probe {
+    double start;
+    size_t allocs;
+    size_t bytes;
+};
+
+static void phase_begin(struct phase_probe* probe) {
+    reset_peak_rss();
+    probe->allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    probe->bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+    probe->start = now_seconds();
+}
+
+static void phase_end(struct phase_probe* probe, struct phase_result* result, size_t run) {
+    result->seconds[run] = now_seconds() - probe->start;
+
+    const size_t rss = read_peak_rss_kb();
+    if(rss > result->peak_rss_kb) {
+        result->peak_rss_kb = rss;
+    }
+
+    // Counts are from the first run, later runs reuse arena blocks.
+    if(run == 0) {
+        result->allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - probe->allocs;
+        result->alloc_bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - probe->bytes;
+    }
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double da = *(const double*)a;
+    const double db = *(const double*)b;
+    return (da < db) ? -1 : (da > db);
+}
+
+
+// One compile, timing each phase.
+static bool run_once(const struct bench_options* opt, struct phase_result* results,
+        size_t run, size_t* input_bytes, size_t* num_tokens) {
+    struct phase_probe probe;
+    struct phase_probe total;
+    struct token_array tokens;
+
+    phase_begin(&total);
+
+    phase_begin(&probe);
+    if(!tokenize(opt->input_file, &tokens, opt->num_threads)) {
+        return false;
+    }
+    phase_end(&probe, &results[PHASE_TOKENIZE], run);
+
+    *input_bytes = tokens.source_size;
+    *num_tokens = tokens.token_count;
+
+    bool result = false;
+
+    if(opt->tokenize_only) {
+        phase_end(&total, &results[PHASE_TOTAL], run);
+        result = true;
+        goto out;
+    }
+
+    phase_begin(&probe);
+    if(!parse_tokens(&tokens)) {
+        goto out;
+    }
+    phase_end(&probe, &results[PHASE_PARSE], run);
+
+    phase_begin(&probe);
+    remove_empty_tokens(&tokens);
+    phase_end(&probe, &results[PHASE_REMOVE_EMPTY], run);
+
+    phase_begin(&probe);
+    if(!bind_tokens(&tokens)) {
+        goto out;
+    }
+    arena_reset(get_phase_arena(ARENA_PARSE));
+    phase_end(&probe, &results[PHASE_BIND], run);
+
+    phase_begin(&probe);
+    if(!asm_code_gen(&tokens, opt->output_file, opt->format, opt->num_threads)) {
+        goto out;
+    }
+    phase_end(&probe, &results[PHASE_CODEGEN], run);
+
+    phase_end(&total, &results[PHASE_TOTAL], run);
+    result = true;
+
+out:
+    free_token_array(&tokens);
+    reset_phase_arenas();
+    return result;
+}
+
+static bool write_results(const struct bench_options* opt, struct phase_result* results,
+        size_t input_bytes, size_t num_tokens) {
+    const bool new_file = (access(opt->results_file, F_OK) != 0);
+
+    FILE* f = fopen(opt->results_file, "a");
+    if(!f) {
+        errprintf("%s: fopen(\"%s\") | %s\n", __func__, opt->results_file, strerror(errno));
+        return false;
+    }
+    if(new_file) {
+        fputs(BENCH_CSV_HEADER, f);
+    }
+
+    printf("%-20s %10s %10s %10s %10s %10s %10s\n",
+            opt->case_name, "median ms", "min ms", "MB/s", "Mtok/s", "peak KiB", "allocs");
+
+    for(size_t i = 0; i < NUM_PHASES; i++) {
+        if(opt->tokenize_only && i != PHASE_TOKENIZE) {
+            continue;
+        }
+        struct phase_result* r = &results[i];
+        qsort(r->seconds, opt->runs, sizeof *r->seconds, compare_doubles);
+
+        const double median = r->seconds[opt->runs / 2];
+        const double min = r->seconds[0];
+        const double mb_per_s = (median > 0) ? (input_bytes / 1e6) / median : 0;
+        const double mtok_per_s = (median > 0) ? (num_tokens / 1e6) / median : 0;
+
+        fprintf(f, "%s,%s,%s,%zu,%zu,%zu,%.6f,%.6f,%.2f,%.3f,%zu,%zu,%zu\n",
+                opt->label, opt->case_name, phase_names[i], input_bytes, num_tokens,
+                opt->runs, median, min, mb_per_s, mtok_per_s,
+                r->peak_rss_kb, r->allocs, r->alloc_bytes);
+
+        printf("  %-18s %10.3f %10.3f %10.1f %10.2f %10zu %10zu\n",
+                phase_names[i], median * 1e3, min * 1e3, mb_per_s, mtok_per_s,
+                r->peak_rss_kb, r->allocs);
+    }
+
+    if(fclose(f) != 0) {
+        errprintf("%s: fclose() | %s\n", __func__, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+
+// --- Comparing result files ---
+
+struct result_row {
+    char   case_name[128];
+    char   phase[64];
+    double median;
+    size_t peak_rss_kb;
+    size_t allocs;
+};
+
+// Reads the rows of a results file. Returns NULL on error.
+static struct result_row* read_results(const char* path, size_t* num_rows) {
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        errprintf("%s: fopen(\"%s\") | %s\n", __func__, path, strerror(errno));
+        return NULL;
+    }
+
+    struct result_row* rows = NULL;
+    size_t count = 0;
+    size_t num_alloc = 0;
+    char line[BENCH_MAX_LINE];
+
+    while(fgets(line, sizeof line, f)) {
+        struct result_row row;
+        size_t input_bytes, tokens, runs;
+        double min, mb_per_s, mtok_per_s;
+        size_t alloc_bytes;
+
+        // Label is skipped, the other text fields end at ','.
+        const char* fields = strchr(line, ',');
+        if(!fields || sscanf(fields + 1, "%127[^,],%63[^,],%zu,%zu,%zu,%lf,%lf,%lf,%lf,%zu,%zu,%zu",
+                    row.case_name, row.phase, &input_bytes, &tokens, &runs,
+                    &row.median, &min, &mb_per_s, &mtok_per_s,
+                    &row.peak_rss_kb, &row.allocs, &alloc_bytes) != 12) {
+            continue; // Header.
+        }
+
+        if(count >= num_alloc) {
+            num_alloc = num_alloc ? num_alloc * 2 : 64;
+            struct result_row* new_ptr = realloc(rows, num_alloc * sizeof *rows);
+            if(!new_ptr) {
+                PRINT_MEMERROR("realloc");
+                free(rows);
+                fclose(f);
+                return NULL;
+            }
+            rows = new_ptr;
+        }
+
+        // Later rows replace earlier ones for the same case and phase.
+        size_t i = 0;
+        for(; i < count; i++) {
+            if(strcmp(rows[i].case_name, row.case_name) == 0
+            && strcmp(rows[i].phase, row.phase) == 0) {
+                break;
+            }
+        }
+        rows[i] = row;
+        if(i == count) {
+            count++;
+        }
+    }
+
+    fclose(f);
+    *num_rows = count;
+    return rows;
+}
+
+static double percent_change(double old_value, double new_value) {
+    return (old_value > 0) ? (new_value - old_value) / old_value * 100.0 : 0;
+}
+
+static int compare_results(const char* old_file, const char* new_file) {
+    size_t num_old = 0;
+    size_t num_new = 0;
+    struct result_row* old_rows = read_results(old_file, &num_old);
+    struct result_row* new_rows = read_results(new_file, &num_new);
+    if(!old_rows || !new_rows) {
+        free(old_rows);
+        free(new_rows);
+        return 1;
+    }
+
+    printf("%-20s %-20s %10s %10s %8s %8s %8s\n",
+            "case", "phase", "old ms", "new ms", "time", "rss", "allocs");
+
+    for(size_t i = 0; i < num_new; i++) {
+        const struct result_row* n = &new_rows[i];
+        const struct result_row* o = NULL;
+        for(size_t j = 0; j < num_old; j++) {
+            if(strcmp(old_rows[j].case_name, n->case_name) == 0
+            && strcmp(old_rows[j].phase, n->phase) == 0) {
+                o = &old_rows[j];
+                break;
+            }
+        }
+        if(!o) {
+            continue;
+        }
+
+        printf("%-20s %-20s %10.3f %10.3f %+7.1f%% %+7.1f%% %+7.1f%%\n",
+                n->case_name, n->phase, o->median * 1e3, n->median * 1e3,
+                percent_change(o->median, n->median),
+                percent_change(o->peak_rss_kb, n->peak_rss_kb),
+                percent_change(o->allocs, n->allocs));
+    }
+
+    free(old_rows);
+    free(new_rows);
+    return 0;
+}
+
+
+static void print_help(char** argv) {
+    printf(
+            "%s [options] <input file>\n"
+            "%s --compare <old results> <new results>\n"
+            "\n"
+            "Options:\n"
+            "  -r <runs>     Number of compiles, the median is reported. (default %i)\n"
+            "  -f <format>   asm, obj or exe. (default asm)\n"
+            "  -j <threads>  Threads for tokenizing and generating code. (default 1)\n"
+            "  -c <name>     Name of the case in the results. (default input file)\n"
+            "  -l <label>    Label of the results, for example a commit. (default \"unknown\")\n"
+            "  -o <file>     Generated code is written here. (default /dev/null)\n"
+            "  --tokenize-only\n"
+            "                Only time the tokenizer, for keyword and -j benchmarks.\n"
+            "  --results <file>\n"
+            "                CSV file the results are appended to. (default bench_results.csv)\n"
+            ,argv[0], argv[0], BENCH_DEFAULT_RUNS);
+}
+
+static bool parse_format(const char* str, enum output_format* format) {
+    if(strcmp(str, "asm") == 0) {
+        *format = OUTPUT_ASM;
+    }
+    else
+    if(strcmp(str, "obj") == 0) {
+        *format = OUTPUT_ELF_OBJ;
+    }
+    else
+    if(strcmp(str, "exe") == 0) {
+        *format = OUTPUT_ELF_EXEC;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int exit_code = 1;
+
+    if(argc == 4 && strcmp(argv[1], "--compare") == 0) {
+        return compare_results(argv[2], argv[3]);
+    }
+
+    struct bench_options opt = {
+        .input_file = NULL,
+        .output_file = "/dev/null",
+        .results_file = "bench_results.csv",
+        .case_name = NULL,
+        .label = "unknown",
+        .format = OUTPUT_ASM,
+        .num_threads = 1,
+        .runs = BENCH_DEFAULT_RUNS,
+        .tokenize_only = false
+    };
+
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const bool has_value = (i+1 < argc);
+
+        if(strcmp(arg, "-r") == 0 && has_value) {
+            opt.runs = strtoull(argv[++i], NULL, 10);
+        }
+        else
+        if(strcmp(arg, "-f") == 0 && has_value) {
+            if(!parse_format(argv[++i], &opt.format)) {
+                print_help(argv);
+                return 1;
+            }
+        }
+        else
+        if(strcmp(arg, "-j") == 0 && has_value) {
+            opt.num_threads = atoi(argv[++i]);
+            if(opt.num_threads <= 0) {
+                opt.num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }
+        else
+        if(strcmp(arg, "-c") == 0 && has_value) {
+            opt.case_name = argv[++i];
+        }
+        else
+        if(strcmp(arg, "-l") == 0 && has_value) {
+            opt.label = argv[++i];
+        }
+        else
+        if(strcmp(arg, "-o") == 0 && has_value) {
+            opt.output_file = argv[++i];
+        }
+        else
+        if(strcmp(arg, "--results") == 0 && has_value) {
+            opt.results_file = argv[++i];
+        }
+        else
+        if(strcmp(arg, "--tokenize-only") == 0) {
+            opt.tokenize_only = true;
+        }
+        else
+        if(!opt.input_file && arg[0] != '-') {
+            opt.input_file = arg;
+        }
+        else {
+            print_help(argv);
+            return 1;
+        }
+    }
+
+    if(!opt.input_file || opt.runs == 0) {
+        print_help(argv);
+        return 1;
+    }
+    if(!opt.case_name) {
+        opt.case_name = opt.input_file;
+    }
+
+    struct phase_result results[NUM_PHASES];
+    memset(results, 0, sizeof results);
+    for(size_t i = 0; i < NUM_PHASES; i++) {
+        results[i].seconds = calloc(opt.runs, sizeof *results[i].seconds);
+        if(!results[i].seconds) {
+            PRINT_MEMERROR("calloc");
+            goto out;
+        }
+    }
+
+    size_t input_bytes = 0;
+    size_t num_tokens = 0;
+    for(size_t run = 0; run < opt.runs; run++) {
+        if(!run_once(&opt, results, run, &input_bytes, &num_tokens)) {
+            goto out;
+        }
+    }
+
+    if(write_results(&opt, results, input_bytes, num_tokens)) {
+        exit_code = 0;
+    }
+
+out:
+    for(size_t i = 0; i < NUM_PHASES; i++) {
+        free(results[i].seconds);
+    }
+    free_phase_arenas();
+    return exit_code;
+}
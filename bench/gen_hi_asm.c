@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Writes a synthetic program for benchmarking the compiler.
+// The same options and seed always give the same program.
+
+struct gen_options {
+    size_t      num_funcs;
+    size_t      num_vars;    // Per function.
+    size_t      num_movs;    // Per function.
+    size_t      add_percent; // Movs which are adds instead.
+    size_t      var_percent; // Movs which declare a new variable instead.
+    size_t      depth;       // Nested scopes in each function, 1 is only the function's own.
+    size_t      name_len;    // Minimum length of function and variable names.
+    size_t      entry;       // Index of the function named "entry", SIZE_MAX for an empty one.
+    uint64_t    seed;
+    const char* output_file;
+};
+
+
+static uint64_t rng_state;
+
+static uint64_t rng_next() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Names are the prefix and number padded with '_' to 'name_len'.
+static void write_name(FILE* out, char prefix, size_t index, size_t name_len) {
+    char buf[32];
+    int len = snprintf(buf, sizeof buf, "%c%zu", prefix, index);
+    fwrite(buf, 1, len, out);
+    for(size_t i = len; i < name_len; i++) {
+        fputc('_', out);
+    }
+}
+
+static void write_indent(FILE* out, size_t level) {
+    for(size_t i = 0; i < level; i++) {
+        fputs("    ", out);
+    }
+}
+
+// 'num_visible' is the function's variables and one for each open nested scope.
+// 'num_decls' counts the variables declared instead of movs in the function.
+static void write_mov(FILE* out, const struct gen_options* opt, size_t level, size_t num_visible,
+        size_t* num_decls) {
+    // Declarations are 4 keywords out of 5 lexemes, for benchmarking the tokenizer.
+    if(opt->var_percent && (rng_next() % 100 < opt->var_percent)) {
+        write_indent(out, level);
+        fputs("var @", out);
+        write_name(out, 'w', (*num_decls)++, opt->name_len);
+        fputs(", i32\n", out);
+        return;
+    }
+
+    // Adds have small literals so both the imm8 and imm32 forms are used.
+    const bool add = opt->add_percent && (rng_next() % 100 < opt->add_percent);
+
+    write_indent(out, level);
+    fputs(add ? "add @" : "mov @", out);
+
+    const size_t index = rng_next() % num_visible;
+    if(index < opt->num_vars) {
+        write_name(out, 'v', index, opt->name_len);
+    }
+    else {
+        write_name(out, 's', index - opt->num_vars + 2, opt->name_len);
+    }
+    fprintf(out, " <- %u\n", (uint32_t)(rng_next() % (add ? 1000 : INT32_MAX)));
+}
+
+static void write_func(FILE* out, const struct gen_options* opt, size_t index) {
+    fputs("func:void .", out);
+    if(index == opt->entry) {
+        fputs("entry", out);
+    }
+    else {
+        write_name(out, 'f', index, opt->name_len);
+    }
+    fputs(" {\n", out);
+
+    for(size_t i = 0; i < opt->num_vars; i++) {
+        write_indent(out, 1);
+        fputs("var @", out);
+        write_name(out, 'v', i, opt->name_len);
+        fputs(", i32\n", out);
+    }
+
+    // Movs are shared evenly by the scopes, each nested scope declares one variable.
+    size_t num_decls = 0;
+    for(size_t level = 1; level <= opt->depth; level++) {
+        if(level > 1) {
+            write_indent(out, level - 1);
+            fputs("{\n", out);
+            write_indent(out, level);
+            fputs("var @", out);
+            write_name(out, 's', level, opt->name_len);
+            fputs(", i32\n", out);
+        }
+
+        const size_t num_visible = opt->num_vars + (level - 1);
+        if(num_visible == 0) {
+            continue;
+        }
+
+        const size_t first = opt->num_movs * (level - 1) / opt->depth;
+        const size_t last = opt->num_movs * level / opt->depth;
+        for(size_t i = first; i < last; i++) {
+            write_mov(out, opt, level, num_visible, &num_decls);
+        }
+    }
+
+    for(size_t level = opt->depth; level > 1; level--) {
+        write_indent(out, level - 1);
+        fputs("}\n", out);
+    }
+    fputs("}\n\n", out);
+}
+
+static bool parse_size(const char* str, size_t* out) {
+    char* end = NULL;
+    *out = strtoull(str, &end, 10);
+    return (end != str && *end == '\0');
+}
+
+static void print_help(char** argv) {
+    printf(
+            "%s [options]\n"
+            "\n"
+            "Options:\n"
+            "  -n <count>    Number of functions. (default 1000)\n"
+            "  -m <count>    Variables per function. (default 4)\n"
+            "  -k <count>    Movs per function. (default 8)\n"
+            "  -a <percent>  Movs which are adds instead. (default 0)\n"
+            "  -w <percent>  Movs which declare a new variable instead. (default 0)\n"
+            "  -d <depth>    Nesting depth of scopes in each function. (default 1)\n"
+            "  -l <length>   Minimum length of names. (default 8)\n"
+            "  -s <seed>     Seed for the literals and mov targets. (default 1)\n"
+            "  -e <index>    Name this function \"entry\" instead of adding an empty one.\n"
+            "  -o <file>     Output file. (default stdout)\n"
+            ,argv[0]);
+}
+
+int main(int argc, char** argv) {
+    struct gen_options opt = {
+        .num_funcs = 1000,
+        .num_vars = 4,
+        .num_movs = 8,
+        .add_percent = 0,
+        .var_percent = 0,
+        .depth = 1,
+        .name_len = 8,
+        .seed = 1,
+        .entry = SIZE_MAX,
+        .output_file = NULL
+    };
+
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if(i+1 >= argc || arg[0] != '-' || strlen(arg) != 2) {
+            print_help(argv);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        size_t num = 0;
+        bool ok = true;
+        switch(arg[1]) {
+            case 'n': ok = parse_size(value, &opt.num_funcs); break;
+            case 'm': ok = parse_size(value, &opt.num_vars); break;
+            case 'k': ok = parse_size(value, &opt.num_movs); break;
+            case 'a': ok = parse_size(value, &opt.add_percent) && opt.add_percent <= 100; break;
+            case 'w': ok = parse_size(value, &opt.var_percent) && opt.var_percent <= 100; break;
+            case 'd': ok = parse_size(value, &opt.depth) && opt.depth > 0; break;
+            case 'l': ok = parse_size(value, &opt.name_len); break;
+            case 's': ok = parse_size(value, &num); opt.seed = num; break;
+            case 'e': ok = parse_size(value, &opt.entry); break;
+            case 'o': opt.output_file = value; break;
+            default:  ok = false; break;
+        }
+        if(!ok) {
+            print_help(argv);
+            return 1;
+        }
+    }
+
+    FILE* out = stdout;
+    if(opt.output_file) {
+        out = fopen(opt.output_file, "w");
+        if(!out) {
+            perror(opt.output_file);
+            return 1;
+        }
+    }
+
+    rng_state = opt.seed ? opt.seed : 1;
+
+    for(size_t i = 0; i < opt.num_funcs; i++) {
+        write_func(out, &opt, i);
+    }
+
+    // Executables need an entry point.
+    if(opt.entry >= opt.num_funcs) {
+        fputs("func:void .entry {\n}\n", out);
+    }
+
+    if(fclose(out) != 0) {
+        perror("fclose");
+        return 1;
+    }
+    return 0;
+}
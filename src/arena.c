@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "error.h"
+
+
+// Placed before memory returned by the hooks.
+struct arena_alloc_header {
+    struct arena* owner; // NULL for malloc.
+    uint64_t      size : 56;
+    uint64_t      tag  : 8;  // enum mem_tag
+};
+
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1))
+
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(struct arena_block))
+#define ALLOC_HEADER_SIZE ALIGN_UP(sizeof(struct arena_alloc_header))
+
+#define BLOCK_DATA(block) ((char*)(block) + BLOCK_HEADER_SIZE)
+
+
+// Each thread has its own, compile jobs on different threads dont share them.
+static _Thread_local struct {
+    bool         ready;
+    struct arena arenas[ARENA_NUM_PHASES];
+}
+phase_arenas;
+
+static const char* PHASE_ARENA_NAMES[ARENA_NUM_PHASES] = {
+    [ARENA_LEX]     = "lex",
+    [ARENA_PARSE]   = "parse",
+    [ARENA_CODEGEN] = "codegen",
+};
+
+static _Thread_local struct arena* current_arena = NULL;
+
+
+
+void create_arena(struct arena* arena, const char* name) {
+    arena->name = name;
+    arena->blocks = NULL;
+    arena->num_blocks = 0;
+    arena->bytes_used = 0;
+    arena->bytes_reserved = 0;
+    memset(arena->tag_bytes, 0, sizeof arena->tag_bytes);
+    memset(arena->free_bins, 0, sizeof arena->free_bins);
+}
+
+// Everything allocated from the arena goes at once.
+static void release_tag_bytes(struct arena* arena) {
+    for(size_t i = 0; i < MEM_NUM_TAGS; i++) {
+        if(arena->tag_bytes[i] > 0) {
+            mem_track_release(i, arena->tag_bytes[i]);
+            arena->tag_bytes[i] = 0;
+        }
+    }
+    memset(arena->free_bins, 0, sizeof arena->free_bins);
+}
+
+void free_arena(struct arena* arena) {
+    release_tag_bytes(arena);
+
+    struct arena_block* block = arena->blocks;
+    while(block) {
+        struct arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->num_blocks = 0;
+    arena->bytes_used = 0;
+    arena->bytes_reserved = 0;
+}
+
+void arena_reset(struct arena* arena) {
+    release_tag_bytes(arena);
+
+    struct arena_block* keep = arena->blocks;
+    if(!keep) {
+        return;
+    }
+
+    struct arena_block* block = keep->next;
+    while(block) {
+        struct arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    keep->next = NULL;
+    keep->used = 0;
+    arena->num_blocks = 1;
+    arena->bytes_used = 0;
+    arena->bytes_reserved = keep->size;
+}
+
+static struct arena_block* arena_new_block(struct arena* arena, size_t min_size) {
+    size_t size = ARENA_MIN_BLOCK_SIZE;
+    if(arena->blocks) {
+        size = arena->blocks->size * 2;
+        if(size > ARENA_MAX_BLOCK_SIZE) {
+            size = ARENA_MAX_BLOCK_SIZE;
+        }
+    }
+    if(size < min_size) {
+        size = ALIGN_UP(min_size);
+    }
+
+    struct arena_block* block = malloc(BLOCK_HEADER_SIZE + size);
+    if(!block) {
+        PRINT_MEMERROR("malloc");
+        return NULL;
+    }
+
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+
+    arena->blocks = block;
+    arena->num_blocks++;
+    arena->bytes_reserved += size;
+    return block;
+}
+
+void* arena_alloc(struct arena* arena, size_t size) {
+    size = ALIGN_UP(size);
+
+    struct arena_block* block = arena->blocks;
+    if(!block || block->size - block->used < size) {
+        block = arena_new_block(arena, size);
+        if(!block) {
+            return NULL;
+        }
+    }
+
+    void* ptr = BLOCK_DATA(block) + block->used;
+    block->used += size;
+    arena->bytes_used += size;
+    return ptr;
+}
+
+
+struct arena* get_phase_arena(enum arena_phase phase) {
+    if(!phase_arenas.ready) {
+        for(size_t i = 0; i < ARENA_NUM_PHASES; i++) {
+            create_arena(&phase_arenas.arenas[i], PHASE_ARENA_NAMES[i]);
+        }
+        phase_arenas.ready = true;
+    }
+    return &phase_arenas.arenas[phase];
+}
+
+void reset_phase_arenas() {
+    for(size_t i = 0; i < ARENA_NUM_PHASES; i++) {
+        arena_reset(get_phase_arena(i));
+    }
+}
+
+void free_phase_arenas() {
+    for(size_t i = 0; i < ARENA_NUM_PHASES; i++) {
+        free_arena(get_phase_arena(i));
+    }
+}
+
+
+struct arena* arena_use(struct arena* arena) {
+    struct arena* prev = current_arena;
+    current_arena = arena;
+    return prev;
+}
+
+struct arena* arena_use_phase(enum arena_phase phase) {
+    return arena_use(get_phase_arena(phase));
+}
+
+static inline struct arena_alloc_header* get_alloc_header(void* ptr) {
+    return (struct arena_alloc_header*)((char*)ptr - ALLOC_HEADER_SIZE);
+}
+
+// True if 'header' is the newest allocation of its arena.
+static bool is_last_alloc(struct arena_alloc_header* header) {
+    const struct arena_block* block = header->owner->blocks;
+    const char* end = (char*)header + ALLOC_HEADER_SIZE + ALIGN_UP(header->size);
+    return end == BLOCK_DATA(block) + block->used;
+}
+
+// Index of the highest set bit.
+static inline size_t floor_log2(size_t n) {
+    return 63 - __builtin_clzll(n);
+}
+
+// Free list node is kept in the freed memory. Its room is taken
+// as the aligned size, what was left over of a reused one is lost.
+struct arena_free_node {
+    struct arena_free_node* next;
+};
+
+static void put_free_list(struct arena* owner, struct arena_alloc_header* header) {
+    const size_t room = ALIGN_UP(header->size);
+    if(room < sizeof(struct arena_free_node)) {
+        return;
+    }
+
+    mem_track_free(header->tag, header->size);
+    owner->tag_bytes[header->tag] -= header->size;
+
+    struct arena_free_node* node = (void*)((char*)header + ALLOC_HEADER_SIZE);
+    const size_t bin = floor_log2(room);
+    node->next = owner->free_bins[bin];
+    owner->free_bins[bin] = node;
+}
+
+// Anything in the bin of the next power of 2 is large enough.
+static struct arena_alloc_header* get_free_list(struct arena* arena, size_t size) {
+    const size_t room = ALIGN_UP(size);
+    if(room == 0) {
+        return NULL;
+    }
+    const size_t bin = (room & (room-1)) ? floor_log2(room) + 1 : floor_log2(room);
+    if(bin >= ARENA_NUM_FREE_BINS || !arena->free_bins[bin]) {
+        return NULL;
+    }
+
+    struct arena_free_node* node = arena->free_bins[bin];
+    arena->free_bins[bin] = node->next;
+    return (struct arena_alloc_header*)((char*)node - ALLOC_HEADER_SIZE);
+}
+
+void* arena_memalloc(size_t size, enum mem_tag tag) {
+    struct arena_alloc_header* header = NULL;
+
+    if(current_arena) {
+        header = get_free_list(current_arena, size);
+        if(!header) {
+            header = arena_alloc(current_arena, ALLOC_HEADER_SIZE + size);
+        }
+    }
+    else {
+        header = malloc(ALLOC_HEADER_SIZE + size);
+    }
+    if(!header) {
+        return NULL;
+    }
+
+    header->owner = current_arena;
+    header->size = size;
+    header->tag = tag;
+
+    mem_track_alloc(tag, size);
+    if(current_arena) {
+        current_arena->tag_bytes[tag] += size;
+    }
+    return (char*)header + ALLOC_HEADER_SIZE;
+}
+
+void arena_memfree(void* ptr) {
+    if(!ptr) {
+        return;
+    }
+
+    struct arena_alloc_header* header = get_alloc_header(ptr);
+    struct arena* owner = header->owner;
+    if(!owner) {
+        mem_track_free(header->tag, header->size);
+        free(header);
+        return;
+    }
+
+    if(is_last_alloc(header)) {
+        const size_t size = ALLOC_HEADER_SIZE + ALIGN_UP(header->size);
+        owner->blocks->used -= size;
+        owner->bytes_used -= size;
+
+        mem_track_free(header->tag, header->size);
+        owner->tag_bytes[header->tag] -= header->size;
+        return;
+    }
+    put_free_list(owner, header);
+}
+
+void* arena_memrealloc(void* ptr, size_t size, enum mem_tag tag) {
+    if(!ptr) {
+        return arena_memalloc(size, tag);
+    }
+
+    struct arena_alloc_header* header = get_alloc_header(ptr);
+    struct arena* owner = header->owner;
+    tag = header->tag;
+
+    const size_t old_size = header->size;
+    const size_t copy_size = (old_size < size) ? old_size : size;
+
+    if(!owner) {
+        struct arena_alloc_header* new_header = realloc(header, ALLOC_HEADER_SIZE + size);
+        if(!new_header) {
+            return NULL;
+        }
+        new_header->size = size;
+        mem_track_realloc(tag, old_size, size, (new_header == header) ? 0 : copy_size);
+        return (char*)new_header + ALLOC_HEADER_SIZE;
+    }
+
+    const size_t old_aligned = ALIGN_UP(old_size);
+    const size_t new_aligned = ALIGN_UP(size);
+
+    if(is_last_alloc(header)) {
+        struct arena_block* block = owner->blocks;
+
+        if(new_aligned <= old_aligned || new_aligned - old_aligned <= block->size - block->used) {
+            block->used = block->used - old_aligned + new_aligned;
+            owner->bytes_used = owner->bytes_used - old_aligned + new_aligned;
+            header->size = size;
+
+            mem_track_realloc(tag, old_size, size, 0);
+            owner->tag_bytes[tag] = owner->tag_bytes[tag] - old_size + size;
+            return ptr;
+        }
+    }
+    else
+    if(new_aligned <= old_aligned) {
+        header->size = size;
+        mem_track_realloc(tag, old_size, size, 0);
+        owner->tag_bytes[tag] = owner->tag_bytes[tag] - old_size + size;
+        return ptr;
+    }
+
+    // Allocate from the same arena it came from, the old memory goes to its free list.
+    struct arena_alloc_header* new_header = get_free_list(owner, size);
+    if(!new_header) {
+        new_header = arena_alloc(owner, ALLOC_HEADER_SIZE + size);
+    }
+    if(!new_header) {
+        return NULL;
+    }
+    new_header->owner = owner;
+    new_header->size = size;
+    new_header->tag = tag;
+
+    void* new_ptr = (char*)new_header + ALLOC_HEADER_SIZE;
+    memcpy(new_ptr, ptr, copy_size);
+
+    mem_track_realloc(tag, 0, size, copy_size);
+    owner->tag_bytes[tag] += size;
+    put_free_list(owner, header);
+    return new_ptr;
+}
@@ -0,0 +1,104 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "memprof.h"
+
+
+// Bump allocator. Memory is released all at once with 'arena_reset()'.
+//
+// Blocks grow geometrically from ARENA_MIN_BLOCK_SIZE to ARENA_MAX_BLOCK_SIZE,
+// larger allocations get a block of their own.
+
+#define ARENA_MIN_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+// All allocations are aligned to this.
+#define ARENA_ALIGN 16
+
+// Free lists of the hooks' allocations, one for each power of 2 size.
+#define ARENA_NUM_FREE_BINS 64
+
+
+struct arena_block {
+    struct arena_block* next; // Older block.
+    size_t              size; // Usable bytes after the header.
+    size_t              used;
+};
+
+struct arena {
+    const char*         name;
+    struct arena_block* blocks; // Newest first, allocations come from this.
+
+    size_t num_blocks;
+    size_t bytes_used;    // Sum of allocation sizes since last reset.
+    size_t bytes_reserved; // Sum of block sizes.
+
+    // Bytes of the hooks' allocations by tag, released from the
+    // memory accounting when the arena is reset.
+    size_t tag_bytes[MEM_NUM_TAGS];
+
+    // Freed allocations of the hooks which were not the last one.
+    // Bin N has those with room for 2^N to 2^(N+1)-1 bytes.
+    void* free_bins[ARENA_NUM_FREE_BINS];
+};
+
+
+// Compiler phases which have their own arena.
+// Everything a phase allocates is released when it's arena is reset.
+enum arena_phase {
+    ARENA_LEX,     // Token array, file path.
+    ARENA_PARSE,   // Parser's symbol table.
+    ARENA_CODEGEN, // Codegen's symbol table and machine code.
+
+    ARENA_NUM_PHASES
+};
+
+
+void  create_arena(struct arena* arena, const char* name);
+void  free_arena(struct arena* arena);
+
+// Releases all allocations. The newest block is kept for reuse.
+void  arena_reset(struct arena* arena);
+
+// Returns NULL if out of memory.
+void* arena_alloc(struct arena* arena, size_t size);
+
+// Phase arenas are per thread.
+struct arena* get_phase_arena(enum arena_phase phase);
+void          reset_phase_arenas();
+void          free_phase_arenas();
+
+
+// Allocation hooks for the rest of the compiler.
+//
+// Memory comes from the arena selected with 'arena_use()' on this thread,
+// or from malloc if no arena is selected. Each allocation remembers
+// where it came from and its tag, so 'arena_memfree()' and 'arena_memrealloc()'
+// work for both. They change the arena the memory came from without a lock,
+// so they must be called on the thread which uses that arena, or after it
+// has stopped using it (like a finished codegen part being joined).
+//
+// Freeing the last allocation gives the memory back to the arena, others go
+// to a free list and are reused by later allocations of about the same size.
+// Growing the last allocation is done in place when there is room, others
+// are copied and the old memory goes to the free list. An array which
+// grows geometrically while other allocations are made still needs about
+// twice its size at peak, very large ones are better kept off the arena.
+
+// Returns the previous arena.
+struct arena* arena_use(struct arena* arena);
+
+// Same as 'arena_use(get_phase_arena(phase))'
+struct arena* arena_use_phase(enum arena_phase phase);
+
+void* arena_memalloc(size_t size, enum mem_tag tag);
+
+// Keeps the tag of 'ptr', 'tag' is used if it's NULL.
+void* arena_memrealloc(void* ptr, size_t size, enum mem_tag tag);
+void  arena_memfree(void* ptr);
+
+
+#endif
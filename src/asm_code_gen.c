@@ -5,217 +5,819 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdarg.h>
-#include <limits.h>
+#include <pthread.h>
 
 #include "asm_code_gen.h"
-#include "hashmap.h"
+#include "elf_code_gen.h"
+#include "outbuf.h"
+#include "arena.h"
+#include "error.h"
+#include "trace.h"
+#include "memprof.h"
 
 
-static struct {
+struct code_gen_options code_gen_options = CODE_GEN_DEFAULT_OPTIONS;
 
-    int out_fd;
+void cdprintf(struct code_gen* cg, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    outbuf_vprintf(&cg->out, fmt, args);
 
-    bool to_stdout;
+    va_end(args);
 }
-gst; // Global state.
 
+// For string literals, skips formatting.
+#define cdputs(cg, str_lit)\
+    outbuf_puts(&(cg)->out, str_lit)
 
 
 
-void cdprintf(const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
 
-    char buffer[1024] = { 0 };
-    ssize_t len = vsnprintf(buffer, sizeof(buffer)-1,
-            fmt, args);
+bool gen_base(struct code_gen* cg) { 
+    cdputs(cg, "section .text\n"
+            "   global _start\n");
+
+    return true;
+}
+
+void gen_func_label(struct code_gen* cg, const char* label, size_t len) {
+    cdprintf(cg, "\n%.*s:\n", (int)len, label);
+}
+
+static const char* REG64_NAMES[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"
+};
 
-    if(len < 0) {
-        fprintf(stderr, "%s: vsnprintf: %s\n",
-                __func__, strerror(errno));
-        goto error;
+static const char* REG32_NAMES[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+
+void gen_func_enter(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size) {
+    for(int reg = REG_RAX; reg <= REG_R15; reg++) {
+        if(saved_regs & (1u << reg)) {
+            cdprintf(cg, "   push %s\n", REG64_NAMES[reg]);
+        }
+    }
+    if(frame) {
+        cdputs(cg,
+                "   push rbp\n"
+                "   mov rbp, rsp\n");
+        if(stack_size > 0) {
+            cdprintf(cg, "   sub rsp, %u\n", stack_size);
+        }
     }
+}
 
-    write(gst.to_stdout
-            ? STDOUT_FILENO : gst.out_fd, buffer, len);
+void gen_func_leave(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size) {
+    if(frame) {
+        if(stack_size > 0) {
+            cdputs(cg, "   mov rsp, rbp\n");
+        }
+        cdputs(cg, "   pop rbp\n");
+    }
+    for(int reg = REG_R15; reg >= REG_RAX; reg--) {
+        if(saved_regs & (1u << reg)) {
+            cdprintf(cg, "   pop %s\n", REG64_NAMES[reg]);
+        }
+    }
+    cdputs(cg, "   ret\n\n");
+}
 
-error:
-    va_end(args);
+// One format for each pair of operand kinds. The mnemonic is part of
+// the format, printing it with "%s" is noticeably slower.
+struct two_operand_formats {
+    const char* stack_imm;
+    const char* stack_reg;
+    const char* reg_imm;
+    const char* reg_reg;
+    const char* reg_stack;
+};
+
+#define TWO_OPERAND_FORMATS(name) {\
+    .stack_imm = "   " name " DWORD PTR [rbp-%i], %i\n",\
+    .stack_reg = "   " name " DWORD PTR [rbp-%i], %s\n",\
+    .reg_imm   = "   " name " %s, %i\n",\
+    .reg_reg   = "   " name " %s, %s\n",\
+    .reg_stack = "   " name " %s, DWORD PTR [rbp-%i]\n"\
+}
+
+static const struct two_operand_formats MOV_FORMATS = TWO_OPERAND_FORMATS("mov");
+static const struct two_operand_formats ADD_FORMATS = TWO_OPERAND_FORMATS("add");
+
+static void gen_two_operands(struct code_gen* cg, const struct two_operand_formats* formats,
+        const struct operand* dst, const struct operand* src) {
+    if(dst->kind == OPERAND_STACK) {
+        if(src->kind == OPERAND_IMM) {
+            cdprintf(cg, formats->stack_imm, dst->value, src->value);
+        }
+        else {
+            cdprintf(cg, formats->stack_reg, dst->value, REG32_NAMES[src->value]);
+        }
+        return;
+    }
+
+    switch(src->kind) {
+        case OPERAND_IMM:
+            cdprintf(cg, formats->reg_imm, REG32_NAMES[dst->value], src->value);
+            break;
+
+        case OPERAND_REG:
+            cdprintf(cg, formats->reg_reg, REG32_NAMES[dst->value], REG32_NAMES[src->value]);
+            break;
+
+        case OPERAND_STACK:
+            cdprintf(cg, formats->reg_stack, REG32_NAMES[dst->value], src->value);
+            break;
+    }
 }
 
+void gen_mov_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    gen_two_operands(cg, &MOV_FORMATS, dst, src);
+}
+
+void gen_add_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    gen_two_operands(cg, &ADD_FORMATS, dst, src);
+}
 
+void gen_xor_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    cdprintf(cg, "   xor %s, %s\n", REG32_NAMES[dst->value], REG32_NAMES[src->value]);
+}
 
+void gen_write_frame(struct code_gen* cg, int size) {
+    cdprintf(cg,
+            "   mov rax, 1\n"
+            "   mov rdi, 1\n"
+            "   lea rsi, [rbp-%i]\n"
+            "   mov rdx, %i\n"
+            "   syscall\n", size, size);
+}
 
-void gen_base() { 
-    cdprintf("section .text\n"
-            "   global _start\n");
+void gen_entry_point(struct code_gen* cg, const char* label, size_t len) {
+    cdprintf(cg,
+            "_start:\n"
+            "   call %.*s\n"
+            "   mov rax, 60\n"
+            "   mov rdi, 0\n"
+            "   syscall\n\n", (int)len, label);
+}
 
+bool gen_end(struct code_gen* cg) {
+    return !cg->out.failed; // Already written to it.
 }
 
+bool gen_part_begin(struct code_gen* part) {
+    (void)part; // Text needs no state.
+    return true;
+}
 
-#define RBPOFF_NOTFOUND INT_MAX
+bool gen_part_join(struct code_gen* cg, struct code_gen* part) {
+    return outbuf_append(&cg->out, &part->out);
+}
 
-int get_var_rbp_off(struct hashmap_t* map, const char* str_key) {
-    struct hashmap_pair_t* pair = hashmap_get(map, strtokey(str_key));
-    if(!pair) {
-        return RBPOFF_NOTFOUND;
+bool gen_part_write(struct code_gen* part, struct outbuf* out) {
+    for(size_t i = 0; i <= part->out.curr_chunk; i++) {
+        const struct outbuf_chunk* chunk = &part->out.chunks[i];
+        if(chunk->len > 0 && !outbuf_write(out, chunk->data, chunk->len)) {
+            return false;
+        }
     }
+    return !part->out.failed;
+}
+
+bool gen_part_read(struct code_gen* cg, const char* data, size_t size) {
+    return outbuf_write(&cg->out, data, size);
+}
 
-    return *(int*)pair->ptr;
+static const struct code_emitter ASM_EMITTER = {
+    .begin         = gen_base,
+    .func_label    = gen_func_label,
+    .func_enter    = gen_func_enter,
+    .func_leave    = gen_func_leave,
+    .mov_i32       = gen_mov_i32,
+    .add_i32       = gen_add_i32,
+    .xor_i32       = gen_xor_i32,
+    .write_frame   = gen_write_frame,
+    .entry_point   = gen_entry_point,
+    .end           = gen_end,
+    .part_begin    = gen_part_begin,
+    .part_join     = gen_part_join,
+    .part_write    = gen_part_write,
+    .part_read     = gen_part_read
+};
+
+
+// Parallel code generation. Parts are smaller than the work per thread
+// so a part with large functions doesnt leave the other threads idle.
+#define CODE_GEN_MIN_PART_TOKENS  (64 * 1024)
+#define CODE_GEN_PARTS_PER_THREAD 4
+
+// Partly written code is not left behind, text appended to an existing file is cut off.
+static void discard_output(struct code_gen* cg) {
+    if(cg->out_created) {
+        if(unlink(cg->out_file) < 0) {
+            errprintf("%s: unlink(\"%s\") | %s\n", __func__, cg->out_file, strerror(errno));
+        }
+        return;
+    }
+    if(ftruncate(cg->out_fd, cg->out_start) < 0) {
+        errprintf("%s: ftruncate() | %s\n", __func__, strerror(errno));
+    }
 }
 
-void asm_code_gen(struct token_array* tokens, const char* out_file) {
-    gst.to_stdout = (strcmp(out_file, "-") == 0);
+bool asm_code_gen_begin(struct code_gen* cg, const char* out_file, enum output_format format) {
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+    bool result = false;
+
+    cg->to_stdout = (strcmp(out_file, "-") == 0);
+
+    switch(format) {
+        case OUTPUT_ASM:
+            cg->emit = &ASM_EMITTER;
+            break;
+
+        case OUTPUT_ELF_OBJ:
+            cg->emit = get_elf_emitter(false);
+            break;
+
+        case OUTPUT_ELF_EXEC:
+            cg->emit = get_elf_emitter(true);
+            break;
+    }
+
+    // Text is appended to the output file,
+    // binary formats need to replace it.
+    int open_flags = O_WRONLY | O_APPEND | O_CREAT;
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+    if(format != OUTPUT_ASM) {
+        open_flags = O_WRONLY | O_TRUNC | O_CREAT;
+    }
+    if(format == OUTPUT_ELF_EXEC) {
+        mode |= S_IXUSR | S_IXGRP | S_IXOTH;
+    }
     
-    gst.out_fd = -1;
-    if(!gst.to_stdout) {
-        gst.out_fd = open(out_file, 
-                O_WRONLY | O_APPEND | O_CREAT, 
-                S_IRUSR | S_IWUSR |
-                S_IRGRP |
-                S_IROTH);
+    cg->out_fd = -1;
+    cg->out_file = out_file;
+    cg->out_start = 0;
+    cg->out_created = false;
+    if(!cg->to_stdout) {
+        cg->out_created = (access(out_file, F_OK) != 0);
+        cg->out_fd = open(out_file, open_flags, mode);
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
     
-        if(gst.out_fd < 0) {
-            fprintf(stderr, "%s\n", strerror(errno));
-            return;
+        if(cg->out_fd < 0) {
+            errprintf("%s\n", strerror(errno));
+            goto out;
+        }
+
+        cg->out_start = lseek(cg->out_fd, 0, SEEK_END);
+        if(cg->out_start < 0) {
+            cg->out_start = 0;
+        }
+    }
+
+    create_outbuf(&cg->out, cg->to_stdout ? STDOUT_FILENO : cg->out_fd);
+
+    create_ir_func(&cg->ir);
+    create_reg_alloc(&cg->ra);
+    create_asm_func(&cg->code);
+    cg->regs = NULL;
+    cg->emit_state = NULL;
+    if(!cg->emit->begin(cg)) {
+        free_outbuf(&cg->out);
+        if(cg->out_fd > -1) {
+            discard_output(cg);
+            close(cg->out_fd);
         }
+        goto out;
+    }
+    result = true;
+
+out:
+    arena_use(prev_arena);
+    return result;
+}
+
+static inline struct operand var_operand(const struct code_gen* cg, uint32_t slot) {
+    if(cg->regs && cg->regs[slot] >= 0) {
+        return (struct operand){ OPERAND_REG, cg->regs[slot] };
+    }
+    return (struct operand){ OPERAND_STACK, cg->ir.slots[slot].rbp_off };
+}
+
+static inline struct operand ir_operand(const struct code_gen* cg, const struct ir_operand* op) {
+    if(op->kind == IR_CONST) {
+        return (struct operand){ OPERAND_IMM, op->value };
     }
+    return var_operand(cg, op->slot);
+}
 
-    gen_base();
+static inline bool same_operand(const struct operand* a, const struct operand* b) {
+    return a->kind == b->kind && a->value == b->value;
+}
 
+#define RED_ZONE_SIZE 128
 
-    struct curr_scope {
-        int rbp_off;
+static const struct operand SCRATCH_OPERAND = { OPERAND_REG, REGALLOC_SCRATCH_REG };
 
-        struct hashmap_t offset_map; // Variable offsets.
+static void add_code(struct code_gen* cg, enum asm_op op, const struct operand* dst, const struct operand* src) {
+    if(!asm_func_add(&cg->code, op, dst, src)) {
+        cg->out.failed = true;
     }
-    scope = {
-        .rbp_off = 0,
-        .offset_map = create_hashmap(32) // <- Initial size.
-    };
+}
 
+// x86 has no memory to memory forms, those go through the scratch register.
+static void gen_mov(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    if(same_operand(dst, src)) {
+        return;
+    }
+    if(dst->kind == OPERAND_STACK && src->kind == OPERAND_STACK) {
+        add_code(cg, ASM_MOV, &SCRATCH_OPERAND, src);
+        src = &SCRATCH_OPERAND;
+    }
+    add_code(cg, ASM_MOV, dst, src);
+}
 
-    /*
-    int A = 6200;
-    int B = 1200;
-    int C = 80;
-    int D = 2;
+static void gen_add(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    if(dst->kind == OPERAND_STACK && src->kind == OPERAND_STACK) {
+        add_code(cg, ASM_MOV, &SCRATCH_OPERAND, src);
+        src = &SCRATCH_OPERAND;
+    }
+    add_code(cg, ASM_ADD, dst, src);
+}
 
-    hashmap_add(&scope.offset_map, strtokey("Hello"), &A);
-    hashmap_add(&scope.offset_map, strtokey("Hello2"), &D);
-    hashmap_add(&scope.offset_map, strtokey("Hello5"), &C);
+static void gen_instr(struct code_gen* cg, const struct ir_instr* instr) {
+    const struct operand dst = var_operand(cg, instr->dst);
+    const struct operand a = ir_operand(cg, &instr->a);
 
-    struct hashmap_pair_t* pair = hashmap_get(&scope.offset_map, strtokey("Hello"));
-    printf("pair = %p\n", pair);
+    switch(instr->op) {
+        case IR_MOV:
+            gen_mov(cg, &dst, &a);
+            break;
 
+        case IR_ADD:
+            {
+                const struct operand b = ir_operand(cg, &instr->b);
+                if(same_operand(&dst, &a)) {
+                    gen_add(cg, &dst, &b);
+                }
+                else
+                if(same_operand(&dst, &b)) {
+                    gen_add(cg, &dst, &a);
+                }
+                else
+                if(dst.kind == OPERAND_REG) {
+                    gen_mov(cg, &dst, &a);
+                    gen_add(cg, &dst, &b);
+                }
+                else {
+                    gen_mov(cg, &SCRATCH_OPERAND, &a);
+                    gen_add(cg, &SCRATCH_OPERAND, &b);
+                    gen_mov(cg, &dst, &SCRATCH_OPERAND);
+                }
+            }
+            break;
+    }
+}
 
-    free_hashmap(&scope.offset_map);
-    return;
-    */
+// With --dump-vars the variables in registers are stored to their slots
+// and the frame is written to stdout before returning.
+static void gen_dump_vars(struct code_gen* cg) {
+    const struct ir_func* func = &cg->ir;
+
+    if(cg->regs) {
+        for(uint32_t i = 0; i < func->num_slots; i++) {
+            if(cg->regs[i] >= 0) {
+                const struct operand dst = { OPERAND_STACK, func->slots[i].rbp_off };
+                const struct operand src = { OPERAND_REG, cg->regs[i] };
+                add_code(cg, ASM_MOV, &dst, &src);
+            }
+        }
+    }
+    if(func->frame_size > 0) {
+        const struct operand size = { OPERAND_IMM, func->frame_size };
+        add_code(cg, ASM_WRITE_FRAME, &size, &size);
+    }
+}
 
+static void emit_code(struct code_gen* cg) {
+    const struct asm_func* code = &cg->code;
 
-    struct token* tok = &tokens->array[0];
-    while(tok->type != TOK_EOF) {
+    for(size_t i = 0; i < code->instr_count; i++) {
+        const struct asm_instr* instr = &code->instrs[i];
 
-        switch(tok->type) {
+        switch(instr->op) {
+            case ASM_MOV:
+                cg->emit->mov_i32(cg, &instr->dst, &instr->src);
+                break;
 
-            case PTOK_FUNC:
-                cdprintf("\n%s:\n", tok->data.func.label);
+            case ASM_ADD:
+                cg->emit->add_i32(cg, &instr->dst, &instr->src);
                 break;
 
-            case TOK_OPEN_SCOPE:
-                cdprintf(
-                        "   push rbp\n"
-                        "   mov rbp, rsp\n");
+            case ASM_XOR:
+                cg->emit->xor_i32(cg, &instr->dst, &instr->src);
                 break;
 
-            case TOK_CLOSE_SCOPE:
-                cdprintf(
-                        "   pop rbp\n"
-                        "   ret\n\n");
-                hashmap_clear(&scope.offset_map);
-                scope.rbp_off = 0;
+            case ASM_WRITE_FRAME:
+                cg->emit->write_frame(cg, instr->src.value);
                 break;
+        }
+    }
+}
+
+// Generates the function whose "{" is at 'start'.
+// Returns the index of its "}", or of where the tokens ended if it isnt closed.
+static size_t gen_func(struct code_gen* cg, struct token_array* tokens, size_t start, size_t end) {
+    struct ir_func* func = &cg->ir;
+    size_t close = end;
+
+    if(!ir_build_func(func, tokens, start, end, code_gen_options.dump_vars, &close)) {
+        cg->out.failed = true;
+        return close;
+    }
+    ir_optimize(func, code_gen_options.passes);
+
+    // Without allocation the variables stay in their stack slots.
+    cg->regs = NULL;
+    uint32_t saved_regs = 0;
+    if(code_gen_options.regalloc && regalloc_func(&cg->ra, func)) {
+        cg->regs = cg->ra.regs;
+        saved_regs = cg->ra.saved_regs;
+        TRACE_COUNT(TRACE_SPILLS, cg->ra.num_spilled);
+    }
+
+    asm_func_reset(&cg->code);
+    for(size_t i = 0; i < func->instr_count; i++) {
+        gen_instr(cg, &func->instrs[i]);
+    }
+
+    const bool closed = (close < end && tokens->array[close].type == TOK_CLOSE_SCOPE);
+    if(closed && code_gen_options.dump_vars) {
+        gen_dump_vars(cg);
+    }
+    if(code_gen_options.peephole) {
+        peephole_func(&cg->code);
+    }
 
-            case PTOK_NEW_VAR:
-                {
-                    // Save variable's rbp offset.
+    // Slots in the red zone are safe without moving rsp since
+    // the function calls nothing, signal handlers skip it.
+    uint32_t stack_size = 0;
+    if(func->frame_size > RED_ZONE_SIZE) {
+        stack_size = (func->frame_size + 15) & ~15u;
+    }
 
-                    // TODO: Cleanup later.
+    cg->emit->func_enter(cg, saved_regs, cg->code.frame, stack_size);
+    emit_code(cg);
+    if(closed) {
+        cg->emit->func_leave(cg, saved_regs, cg->code.frame, stack_size);
+    }
+    return close;
+}
 
-                    if(scope.rbp_off == 0) {
-                        switch(tok->data.var.type) {
-                            case TYPE_I32:
-                                scope.rbp_off += 4;
-                                break;
+static void gen_tokens(struct code_gen* cg, struct token_array* tokens, size_t start, size_t end) {
+    const struct token* func_tok = NULL; // For tracing.
 
-                            // ... more types will be added in the future.
-                        }
-                    }
+    for(size_t i = start; i < end; i++) {
+        const struct token* tok = &tokens->array[i];
 
-                    hashmap_add_new(&scope.offset_map,
-                            strtokey(tok->data.var.name), &scope.rbp_off, sizeof(scope.rbp_off));
+        switch(tok->type) {
 
-                    switch(tok->data.var.type) {
-                        case TYPE_I32:
-                            scope.rbp_off += 4;
-                            break;
+            case PTOK_FUNC:
+                TRACE_BEGIN("function");
+                func_tok = tok;
+                cg->emit->func_label(cg, TOKEN_TEXT(tokens, tok), tok->len);
+                break;
 
-                        // ... more types will be added in the future.
-                    }
+            case TOK_OPEN_SCOPE:
+                i = gen_func(cg, tokens, i, end);
+                if(func_tok) {
+                    TRACE_END_DETAIL("function", TOKEN_TEXT(tokens, func_tok), func_tok->len);
+                    func_tok = NULL;
+                }
+                if(i >= end || tokens->array[i].type != TOK_CLOSE_SCOPE) {
+                    return;
                 }
                 break;
 
-            case TOK_MOV:
-                {
-                    struct token* lhs_tok = tok + 1;
-                    struct token* rhs_tok = tok + 2;
+            case TOK_EOF:
+                return;
+        }
+    }
+}
+
+void asm_code_gen_tokens(struct code_gen* cg, struct token_array* tokens, size_t start, size_t end) {
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+    gen_tokens(cg, tokens, start, end);
+    arena_use(prev_arena);
+}
+
+static bool asm_code_gen_close(struct code_gen* cg, bool write_results) {
+    bool result = false;
+    if(write_results) {
+        result = cg->emit->end(cg);
+    }
+
+    if(cg->to_stdout) {
+        fflush(stdout); // Dont mix with anything still in stdio buffer.
+    }
+    if(!outbuf_flush(&cg->out) || cg->out.failed) {
+        result = false;
+    }
+    free_outbuf(&cg->out);
+    free_asm_func(&cg->code);
+    free_reg_alloc(&cg->ra);
+    free_ir_func(&cg->ir);
+
+    if(cg->out_fd > -1) {
+        if(!result) {
+            discard_output(cg);
+        }
+        close(cg->out_fd);
+    }
+    return result;
+}
+
+bool asm_code_gen_end(struct code_gen* cg) {
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+    TRACE_BEGIN("codegen end");
+    cg->emit->entry_point(cg, "entry", 5);
+    const bool result = asm_code_gen_close(cg, true);
+    TRACE_END("codegen end");
+    arena_use(prev_arena);
+    return result;
+}
+
+void asm_code_gen_abort(struct code_gen* cg) {
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+    asm_code_gen_close(cg, false);
+    arena_use(prev_arena);
+}
+
+
+
+bool asm_code_gen_part_begin(struct code_gen* part, const struct code_gen* cg) {
+    part->out_fd = -1;
+    part->to_stdout = false;
+    create_outbuf(&part->out, -1);
+    part->emit = cg->emit;
+    part->emit_state = NULL;
+    create_ir_func(&part->ir);
+    create_reg_alloc(&part->ra);
+    create_asm_func(&part->code);
+    part->regs = NULL;
+
+    if(!part->emit->part_begin(part)) {
+        free_outbuf(&part->out);
+        return false;
+    }
+    return true;
+}
 
-                    int rbp_off = get_var_rbp_off
-                        (&scope.offset_map, lhs_tok->data.var.name);
+void asm_code_gen_part_tokens(struct code_gen* part, struct token_array* tokens, size_t start, size_t end) {
+    gen_tokens(part, tokens, start, end);
+}
 
-                    if(rbp_off == RBPOFF_NOTFOUND) {
-                        break;
-                    }
+// Emitter state is in the arena, it goes when the arena is reset.
+void asm_code_gen_part_end(struct code_gen* part) {
+    free_outbuf(&part->out);
+    free_asm_func(&part->code);
+    free_reg_alloc(&part->ra);
+    free_ir_func(&part->ir);
+    part->emit_state = NULL;
+}
 
-                    char rhs[32] = { 0 };
 
-                    if(rhs_tok->type == PTOK_LIT_I32) {
-                        snprintf(rhs, sizeof(rhs)-1,
-                                "%i", rhs_tok->data.lit_i32.value);
-                    }
+// One part of the tokens generated on a worker thread.
+// Everything it allocates is in it's own arena, so the part can be
+// joined and freed on another thread.
+struct code_gen_part {
+    struct code_gen cg;
+    struct arena    arena;
+    size_t          start;
+    size_t          end;
+    bool            result;
+    bool            done;
+};
+
+struct code_gen_parallel {
+    struct code_gen*      cg;
+    struct token_array*   tokens;
+    struct code_gen_part* parts;
+    size_t                num_parts;
+    size_t                next_part; // Parts are claimed in order.
+
+    pthread_mutex_t lock;
+    pthread_cond_t  done_cond;
+};
+
+// Splits the tokens at function boundaries into at most 'max_parts' parts
+// of about 'part_size' tokens. Returns the number of parts.
+// Functions dont share variables, so any function boundary will do.
+static size_t split_parts(struct token_array* tokens, struct code_gen_part* parts,
+        size_t max_parts, size_t part_size) {
+    size_t num_parts = 0;
+    size_t part_start = 0;
+    size_t depth = 0;
+
+    for(size_t i = 0; i < tokens->token_count; i++) {
+        switch(tokens->array[i].type) {
+            case TOK_OPEN_SCOPE:
+                depth++;
+                break;
 
-                    cdprintf(
-                            "   mov DWORD PTR [rbp-%i], %s\n",
-                            rbp_off, rhs);
+            case TOK_CLOSE_SCOPE:
+                depth--;
+                if(depth == 0 && (i+1 - part_start >= part_size) && (num_parts+1 < max_parts)) {
+                    parts[num_parts].start = part_start;
+                    parts[num_parts].end = i+1;
+                    num_parts++;
+                    part_start = i+1;
                 }
                 break;
+        }
+    }
+
+    parts[num_parts].start = part_start;
+    parts[num_parts].end = tokens->token_count;
+    return num_parts+1;
+}
+
+static bool gen_part(struct code_gen_parallel* par, struct code_gen_part* part) {
+    struct arena* prev_arena = arena_use(&part->arena);
+    bool result = false;
+    TRACE_BEGIN("codegen part");
+
+    if(asm_code_gen_part_begin(&part->cg, par->cg)) {
+        gen_tokens(&part->cg, par->tokens, part->start, part->end);
+        result = !part->cg.out.failed;
+    }
+
+    TRACE_END("codegen part");
+    arena_use(prev_arena);
+    return result;
+}
+
+static void run_part(struct code_gen_parallel* par, struct code_gen_part* part) {
+    const bool result = gen_part(par, part);
+
+    pthread_mutex_lock(&par->lock);
+    part->result = result;
+    part->done = true;
+    pthread_cond_broadcast(&par->done_cond);
+    pthread_mutex_unlock(&par->lock);
+}
 
+static void* code_gen_thread(void* arg) {
+    struct code_gen_parallel* par = arg;
 
+    while(true) {
+        pthread_mutex_lock(&par->lock);
+        struct code_gen_part* part = NULL;
+        if(par->next_part < par->num_parts) {
+            part = &par->parts[par->next_part++];
+        }
+        pthread_mutex_unlock(&par->lock);
 
+        if(!part) {
+            break;
         }
+        run_part(par, part);
+    }
 
+    return NULL;
+}
 
+// The calling thread joins the parts in order as they finish,
+// and generates the next part itself if no worker has taken it yet.
+static bool gen_parallel(struct code_gen_parallel* par, size_t num_workers) {
+    bool result = true;
 
-        tok++;
+    pthread_t* threads = mem_calloc(MEM_JOBS, num_workers, sizeof *threads);
+    if(!threads) {
+        PRINT_MEMERROR("mem_calloc");
+        num_workers = 0;
     }
 
-    cdprintf(
-            "_start:\n"
-            "   call entry\n"
-            "   mov rax, 60\n"
-            "   mov rdi, 0\n"
-            "   syscall\n\n");
+    size_t num_started = 0;
+    for(size_t i = 0; i < num_workers; i++) {
+        if(pthread_create(&threads[i], NULL, code_gen_thread, par) != 0) {
+            errprintf("%s: pthread_create() | %s\n", __func__, strerror(errno));
+            break;
+        }
+        num_started++;
+    }
+
+    for(size_t i = 0; i < par->num_parts; i++) {
+        struct code_gen_part* part = &par->parts[i];
+
+        pthread_mutex_lock(&par->lock);
+        const bool claim = (par->next_part == i);
+        if(claim) {
+            par->next_part++;
+        }
+        pthread_mutex_unlock(&par->lock);
+
+        if(claim) {
+            run_part(par, part);
+        }
+
+        pthread_mutex_lock(&par->lock);
+        while(!part->done) {
+            pthread_cond_wait(&par->done_cond, &par->lock);
+        }
+        pthread_mutex_unlock(&par->lock);
+
+        if(result && part->result) {
+            result = par->cg->emit->part_join(par->cg, &part->cg);
+        }
+        else {
+            result = false;
+        }
+
+        free_outbuf(&part->cg.out);
+        free_arena(&part->arena); // Rest of the part's memory.
+    }
+
+    for(size_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    mem_free(threads);
+    return result;
+}
+
+// Returns 'false' if parallel code generation is not possible or failed,
+// '*used' tells which.
+static bool asm_code_gen_parallel(struct code_gen* cg, struct token_array* tokens, int num_threads, bool* used) {
+    *used = false;
 
+    // Small inputs are not worth starting threads for.
+    size_t max_parts = (size_t)num_threads * CODE_GEN_PARTS_PER_THREAD;
+    if(max_parts > tokens->token_count / CODE_GEN_MIN_PART_TOKENS) {
+        max_parts = tokens->token_count / CODE_GEN_MIN_PART_TOKENS;
+    }
+    if(num_threads <= 1 || max_parts <= 1) {
+        return false;
+    }
 
+    struct code_gen_parallel par;
+    par.parts = mem_calloc(MEM_JOBS, max_parts, sizeof *par.parts);
+    if(!par.parts) {
+        PRINT_MEMERROR("mem_calloc");
+        return false;
+    }
 
+    par.num_parts = split_parts(tokens, par.parts, max_parts, tokens->token_count / max_parts);
+    if(par.num_parts <= 1) {
+        mem_free(par.parts);
+        return false;
+    }
 
-    free_hashmap(&scope.offset_map);
+    *used = true;
+    par.cg = cg;
+    par.tokens = tokens;
+    par.next_part = 0;
+    pthread_mutex_init(&par.lock, NULL);
+    pthread_cond_init(&par.done_cond, NULL);
 
-    if(gst.out_fd > -1) {
-        close(gst.out_fd);
+    for(size_t i = 0; i < par.num_parts; i++) {
+        create_arena(&par.parts[i].arena, "codegen part");
     }
+
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+    const bool result = gen_parallel(&par, num_threads-1);
+    arena_use(prev_arena);
+
+    pthread_cond_destroy(&par.done_cond);
+    pthread_mutex_destroy(&par.lock);
+    mem_free(par.parts);
+    return result;
 }
 
+bool asm_code_gen(struct token_array* tokens, const char* out_file, enum output_format format, int num_threads) {
+    bool result = false;
+    TRACE_BEGIN("codegen");
 
+    struct code_gen cg;
+    if(!asm_code_gen_begin(&cg, out_file, format)) {
+        goto out;
+    }
+
+    bool parallel = false;
+    if(!asm_code_gen_parallel(&cg, tokens, num_threads, &parallel)) {
+        if(parallel) {
+            asm_code_gen_abort(&cg);
+            goto out;
+        }
+        asm_code_gen_tokens(&cg, tokens, 0, tokens->token_count);
+    }
+
+    result = asm_code_gen_end(&cg);
 
+out:
+    TRACE_END("codegen");
+    return result;
+}
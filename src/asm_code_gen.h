@@ -2,12 +2,118 @@
 #define ASM_CODE_GEN_H
 
 
+#include <sys/types.h>
+
 #include "token.h"
+#include "outbuf.h"
+#include "ir.h"
+#include "ir_opt.h"
+#include "regalloc.h"
+#include "peephole.h"
+
+
+// Set before code generation starts.
+struct code_gen_options {
+    bool     regalloc;  // Variables are kept in registers when possible.
+    bool     dump_vars; // Functions write their variables to stdout before returning.
+    uint32_t passes;    // IR_PASS_BIT() of each optimization pass to run.
+    bool     peephole;  // Peephole rules rewrite the instructions before they are emitted.
+};
+
+#define CODE_GEN_DEFAULT_OPTIONS\
+    (struct code_gen_options){ .regalloc = true, .dump_vars = false, .passes = IR_PASSES_O1, .peephole = true }
+
+extern struct code_gen_options code_gen_options;
+
+
+enum output_format {
+    OUTPUT_ASM,      // Nasm source text.
+    OUTPUT_ELF_OBJ,  // ELF64 relocatable object.
+    OUTPUT_ELF_EXEC  // ELF64 static executable.
+};
+
+
+struct code_gen;
+
+// Code generation builds the IR of each function from the tokens, optimizes it,
+// selects the instructions ('struct asm_func') and after the peephole rules
+// calls these to produce the output in some format.
+struct code_emitter {
+    bool (*begin)(struct code_gen* cg);
+    void (*func_label)(struct code_gen* cg, const char* label, size_t len);
+    // 'saved_regs' are the callee saved registers the function uses, bit for each enum x86_reg.
+    // Without 'frame' rbp is not pushed and set. 'stack_size' bytes are reserved
+    // below rbp if it's not 0, only with 'frame'.
+    void (*func_enter)(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size); // push saved_regs, push rbp, mov rbp, rsp, sub rsp, stack_size
+    void (*func_leave)(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size); // mov rsp, rbp, pop rbp, pop saved_regs, ret
+    // 'dst' is not OPERAND_IMM, 'dst' and 'src' are not both OPERAND_STACK.
+    void (*mov_i32)(struct code_gen* cg, const struct operand* dst, const struct operand* src);
+    void (*add_i32)(struct code_gen* cg, const struct operand* dst, const struct operand* src);
+    void (*xor_i32)(struct code_gen* cg, const struct operand* dst, const struct operand* src); // Only reg, reg
+    void (*write_frame)(struct code_gen* cg, int size); // Writes 'size' bytes below rbp to stdout.
+    void (*entry_point)(struct code_gen* cg, const char* label, size_t len); // _start which calls 'label' and exits.
+
+    // Write the results to 'cg->out'. Returns 'false' on error.
+    bool (*end)(struct code_gen* cg);
+
+    // Parallel code generation gives each part of the tokens its own 'code_gen'.
+    // 'part_begin' sets up the part's 'emit_state', 'part_join' appends
+    // the part's output to 'cg'. Parts are joined in source order.
+    bool (*part_begin)(struct code_gen* part);
+    bool (*part_join)(struct code_gen* cg, struct code_gen* part);
+
+    // Compile cache: 'part_write' appends the part's output to 'out' in a form
+    // 'part_read' can later append to 'cg' in place of the part. The part is not changed.
+    bool (*part_write)(struct code_gen* part, struct outbuf* out);
+    bool (*part_read)(struct code_gen* cg, const char* data, size_t size);
+};
+
+
+// State of one output file.
+// Nothing is shared between these so each can be used from its own thread.
+struct code_gen {
+    int  out_fd;
+    bool to_stdout;
+
+    // A failed compile puts the output file back as it was,
+    // it is removed if it was created or cut back to 'out_start' bytes.
+    const char* out_file;
+    off_t       out_start;
+    bool        out_created;
+
+    struct outbuf out; // Generated code is buffered here.
+
+    const struct code_emitter* emit;
+    void*                      emit_state; // Owned by the emitter.
+
+    // Current function, reused by each one.
+    struct ir_func   ir;
+    struct reg_alloc ra;
+    const int8_t*    regs; // Register of each slot, NULL if they are all in the stack.
+    struct asm_func  code;
+};
+
 
+// Tokens must be bound with 'bind_tokens()'
+// Large inputs are split at function boundaries and the functions
+// are generated on 'num_threads' threads. The output is the same as with one thread.
+bool asm_code_gen(struct token_array* tokens, const char* out_file, enum output_format format, int num_threads);
 
+// Same as 'asm_code_gen()' but the tokens can be given in parts.
+// Parts must not split a function.
+bool asm_code_gen_begin(struct code_gen* cg, const char* out_file, enum output_format format);
+void asm_code_gen_tokens(struct code_gen* cg, struct token_array* tokens, size_t start, size_t end);
+bool asm_code_gen_end(struct code_gen* cg);
 
+// A part is generated separately from 'cg' and appended to it with 'cg->emit->part_join()'.
+// Part's memory comes from the current arena, not the codegen arena.
+bool asm_code_gen_part_begin(struct code_gen* part, const struct code_gen* cg);
+void asm_code_gen_part_tokens(struct code_gen* part, struct token_array* tokens, size_t start, size_t end);
+void asm_code_gen_part_end(struct code_gen* part);
 
-void asm_code_gen(struct token_array* tokens, const char* out_file);
+// Stop without finishing the output.
+// Text which was already flushed stays in the output file.
+void asm_code_gen_abort(struct code_gen* cg);
 
 
 
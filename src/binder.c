@@ -0,0 +1,220 @@
+#include <stdlib.h>
+
+#include "binder.h"
+#include "symtab.h"
+#include "arena.h"
+#include "error.h"
+#include "trace.h"
+
+
+#define binder_errmsg(tokens, tok, fmt, ...)\
+    do {\
+        size_t err_line = 0;\
+        int err_column = 0;\
+        token_position(tokens, tok, &err_line, &err_column);\
+        errmsg((tokens)->file_path, err_line, err_column, fmt, ##__VA_ARGS__);\
+    } while(0)
+
+
+uint32_t var_type_size(enum var_type type) {
+    switch(type) {
+        case TYPE_I32:
+            return 4;
+
+        case TYPE_VOID:
+            break;
+    }
+    return 0;
+}
+
+// Table memory is from the lex arena, it lives as long as the tokens.
+static struct frame* add_frame(struct frame_table* frames) {
+    if(frames->frame_count >= frames->frames_num_alloc) {
+        const size_t num_alloc = frames->frames_num_alloc ? frames->frames_num_alloc * 2 : 64;
+
+        struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+        struct frame* tmp_ptr = arena_memrealloc(frames->frames, num_alloc * sizeof *tmp_ptr, MEM_FRAMES);
+        arena_use(prev_arena);
+
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return NULL;
+        }
+        frames->frames = tmp_ptr;
+        frames->frames_num_alloc = num_alloc;
+    }
+
+    struct frame* frame = &frames->frames[frames->frame_count++];
+    frame->first_slot = frames->slot_count;
+    frame->num_slots = 0;
+    frame->size = 0;
+    return frame;
+}
+
+static struct slot* add_slot(struct frame_table* frames) {
+    if(frames->slot_count >= frames->slots_num_alloc) {
+        const size_t num_alloc = frames->slots_num_alloc ? frames->slots_num_alloc * 2 : 256;
+
+        struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+        struct slot* tmp_ptr = arena_memrealloc(frames->slots, num_alloc * sizeof *tmp_ptr, MEM_FRAMES);
+        arena_use(prev_arena);
+
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return NULL;
+        }
+        frames->slots = tmp_ptr;
+        frames->slots_num_alloc = num_alloc;
+    }
+
+    struct slot* slot = &frames->slots[frames->slot_count++];
+    slot->rbp_off = 0;
+    slot->type = TYPE_VOID;
+    return slot;
+}
+
+// Variables are placed below rbp in the order they were declared,
+// including those of nested scopes.
+static void layout_frame(struct frame_table* frames, struct frame* frame) {
+    struct slot* slots = &frames->slots[frame->first_slot];
+    uint32_t size = 0;
+
+    for(uint32_t i = 0; i < frame->num_slots; i++) {
+        size += var_type_size(slots[i].type);
+        slots[i].rbp_off = size;
+    }
+    frame->size = size;
+}
+
+static bool bind_new_var(struct token_array* tokens, struct token* tok,
+        struct symtab* symbols, struct frame* frame) {
+    const char* name = TOKEN_TEXT(tokens, tok);
+
+    if(!frame) {
+        binder_errmsg(tokens, tok,
+                "Variable \"%.*s\" is declared outside of a function",
+                tok->len, name);
+        return false;
+    }
+
+    if(var_type_size(tok->data.var.type) == 0) {
+        binder_errmsg(tokens, tok,
+                "Variable \"%.*s\" cant be void",
+                tok->len, name);
+        return false;
+    }
+
+    if(symtab_declared_in_scope(symbols, name, tok->len)) {
+        binder_errmsg(tokens, tok,
+                "Variable \"%.*s\" is already declared in this scope",
+                tok->len, name);
+        return false;
+    }
+
+    if(frame->num_slots >= FRAME_MAX_SLOTS) {
+        binder_errmsg(tokens, tok, "Too many variables in one function");
+        return false;
+    }
+
+    struct symbol* sym = symtab_declare(symbols, name, tok->len);
+    struct slot* slot = add_slot(&tokens->frames);
+    if(!sym || !slot) {
+        return false;
+    }
+
+    sym->type = tok->data.var.type;
+    sym->slot = frame->num_slots++;
+    slot->type = tok->data.var.type;
+    tok->data.var.slot = sym->slot;
+    return true;
+}
+
+static bool bind_var(struct token_array* tokens, struct token* tok, struct symtab* symbols) {
+    const struct symbol* sym = symtab_lookup(symbols, TOKEN_TEXT(tokens, tok), tok->len);
+    if(!sym) {
+        binder_errmsg(tokens, tok,
+                "Variable \"%.*s\" is not declared",
+                tok->len, TOKEN_TEXT(tokens, tok));
+        return false;
+    }
+
+    tok->data.var.type = sym->type;
+    tok->data.var.slot = sym->slot;
+    return true;
+}
+
+static bool bind_range(struct token_array* tokens, size_t start, size_t end, struct symtab* symbols) {
+    struct frame_table* frames = &tokens->frames;
+    struct frame* frame = NULL; // Function being bound.
+
+    for(size_t i = start; i < end; i++) {
+        struct token* tok = &tokens->array[i];
+
+        switch(tok->type) {
+            case TOK_OPEN_SCOPE:
+                if(symbols->depth == 0) {
+                    frame = add_frame(frames);
+                    if(!frame) {
+                        return false;
+                    }
+                    tok->data.scope.frame = frames->frame_count - 1;
+                }
+                if(!symtab_push_scope(symbols)) {
+                    return false;
+                }
+                break;
+
+            case TOK_CLOSE_SCOPE:
+                symtab_pop_scope(symbols);
+                if(symbols->depth == 0 && frame) {
+                    layout_frame(frames, frame);
+                    frame = NULL;
+                }
+                break;
+
+            case PTOK_NEW_VAR:
+                if(!bind_new_var(tokens, tok, symbols, frame)) {
+                    return false;
+                }
+                break;
+
+            case PTOK_VAR:
+                if(!bind_var(tokens, tok, symbols)) {
+                    return false;
+                }
+                break;
+        }
+    }
+
+    // Last function wasn't closed.
+    if(frame) {
+        layout_frame(frames, frame);
+    }
+    return true;
+}
+
+bool bind_tokens(struct token_array* tokens) {
+    return bind_tokens_range(tokens, 0, tokens->token_count);
+}
+
+bool bind_tokens_range(struct token_array* tokens, size_t start, size_t end) {
+    bool result = false;
+    struct arena* prev_arena = arena_use_phase(ARENA_PARSE);
+    TRACE_BEGIN("bind");
+
+    tokens->frames.frame_count = 0;
+    tokens->frames.slot_count = 0;
+
+    struct symtab symbols;
+    if(!create_symtab(&symbols)) {
+        goto out;
+    }
+
+    result = bind_range(tokens, start, end, &symbols);
+    free_symtab(&symbols);
+
+out:
+    TRACE_END("bind");
+    arena_use(prev_arena);
+    return result;
+}
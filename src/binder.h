@@ -0,0 +1,30 @@
+#ifndef BINDER_H
+#define BINDER_H
+
+
+#include "token.h"
+
+
+// Binding runs after parsing. Each PTOK_NEW_VAR and PTOK_VAR gets
+// the index of the variable's slot in its function ('data.var.slot')
+// and the "{" of each function the index of its frame ('data.scope.frame').
+// Frame offsets are assigned when the function ends.
+//
+// Variables must be declared in a function before they are used,
+// using an undeclared variable is an error.
+// Code generation only reads the tables, it doesnt look up names.
+
+
+// Bytes of a variable in the stack, 0 for void.
+uint32_t var_type_size(enum var_type type);
+
+// Same as 'bind_tokens_range(tokens, 0, tokens->token_count)'
+bool bind_tokens(struct token_array* tokens);
+
+// Tokens from 'start' to 'end' must be whole functions.
+// Frames of earlier calls are dropped.
+bool bind_tokens_range(struct token_array* tokens, size_t start, size_t end);
+
+
+
+#endif
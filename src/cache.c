@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "cache.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "error.h"
+#include "memprof.h"
+
+
+#define CACHE_MAGIC 0x48434948 // "HICH"
+
+// Change when the index layout or the code emitters' part format changes.
+#define CACHE_FORMAT_VERSION 1
+
+#define CACHE_DIR_MODE (S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)
+#define CACHE_FILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+
+
+struct cache_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t run;
+    uint64_t data_gen;
+    uint64_t num_entries;
+};
+
+
+static void cache_path(const struct cache* cache, const char* name, char* path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s", cache->dir, name);
+}
+
+static void data_file_path(const struct cache* cache, uint64_t gen, char* path, size_t path_size) {
+    snprintf(path, path_size, "%s/data.%" PRIu64, cache->dir, gen);
+}
+
+static bool read_all(int fd, void* buffer, size_t size) {
+    char* ptr = buffer;
+    while(size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Hash of the running executable, any change to the compiler changes it.
+// The executable doesnt change while it runs, so a resident server hashes it once.
+static bool hash_compiler(uint64_t* hash) {
+    static bool     hashed = false;
+    static uint64_t compiler_hash = 0;
+
+    if(!hashed) {
+        char* data = NULL;
+        size_t size = 0;
+        if(!map_file("/proc/self/exe", PROT_READ, &data, &size)) {
+            return false;
+        }
+        compiler_hash = strtokey(data, size) ^ CACHE_FORMAT_VERSION;
+        munmap(data, size);
+        hashed = true;
+    }
+
+    *hash = compiler_hash;
+    return true;
+}
+
+static int compare_entry_keys(const void* a, const void* b) {
+    const uint64_t ka = ((const struct cache_entry*)a)->key;
+    const uint64_t kb = ((const struct cache_entry*)b)->key;
+    return (ka < kb) ? -1 : (ka > kb);
+}
+
+// Most recently used first.
+static int compare_entry_runs(const void* a, const void* b) {
+    const uint64_t ra = ((const struct cache_entry*)a)->last_used;
+    const uint64_t rb = ((const struct cache_entry*)b)->last_used;
+    return (ra > rb) ? -1 : (ra < rb);
+}
+
+
+// A missing or broken index is an empty cache.
+static void read_index(struct cache* cache) {
+    char path[PATH_MAX];
+    cache_path(cache, "index", path, sizeof(path));
+
+    cache->run = 0;
+    cache->data_gen = 0;
+    cache->entries = NULL;
+    cache->num_entries = 0;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return;
+    }
+
+    struct cache_index_header header;
+    if(!read_all(fd, &header, sizeof(header))
+    || header.magic != CACHE_MAGIC
+    || header.version != CACHE_FORMAT_VERSION) {
+        goto out;
+    }
+
+    struct cache_entry* entries = mem_alloc(MEM_CACHE, header.num_entries * sizeof *entries + 1);
+    if(!entries) {
+        PRINT_MEMERROR("mem_alloc");
+        goto out;
+    }
+    if(!read_all(fd, entries, header.num_entries * sizeof *entries)) {
+        mem_free(entries);
+        goto out;
+    }
+
+    cache->run = header.run;
+    cache->data_gen = header.data_gen;
+    cache->entries = entries;
+    cache->num_entries = header.num_entries;
+
+out:
+    close(fd);
+}
+
+static bool write_index(struct cache* cache, const struct cache_entry* entries, size_t num_entries) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    cache_path(cache, "index", path, sizeof(path));
+    cache_path(cache, "index.tmp", tmp_path, sizeof(tmp_path));
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, CACHE_FILE_MODE);
+    if(fd < 0) {
+        errprintf("%s: \"%s\" %s\n", __func__, tmp_path, strerror(errno));
+        return false;
+    }
+
+    const struct cache_index_header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_FORMAT_VERSION,
+        .run = cache->run,
+        .data_gen = cache->data_gen,
+        .num_entries = num_entries
+    };
+
+    struct outbuf out;
+    create_outbuf(&out, fd);
+    outbuf_write(&out, (const char*)&header, sizeof(header));
+    outbuf_write(&out, (const char*)entries, num_entries * sizeof *entries);
+    bool result = outbuf_flush(&out) && !out.failed;
+    free_outbuf(&out);
+    close(fd);
+
+    // Readers see the old or the new index, never a half written one.
+    if(!result || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool map_data(struct cache* cache) {
+    struct stat sb;
+    if(fstat(cache->data_fd, &sb) != 0) {
+        errprintf("%s: fstat() | %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    if(cache->data) {
+        munmap((void*)cache->data, cache->data_size);
+        cache->data = NULL;
+        cache->data_size = 0;
+    }
+
+    if(sb.st_size > 0) {
+        void* ptr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, cache->data_fd, 0);
+        if(ptr == MAP_FAILED) {
+            errprintf("%s: mmap() | %s\n", __func__, strerror(errno));
+            return false;
+        }
+        cache->data = ptr;
+        cache->data_size = sb.st_size;
+    }
+    return true;
+}
+
+// Copies 'entries' to the next generation of the data file.
+static bool compact_data(struct cache* cache, struct cache_entry* entries, size_t num_entries) {
+    char path[PATH_MAX];
+    data_file_path(cache, cache->data_gen + 1, path, sizeof(path));
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, CACHE_FILE_MODE);
+    if(fd < 0) {
+        errprintf("%s: \"%s\" %s\n", __func__, path, strerror(errno));
+        return false;
+    }
+
+    struct outbuf out;
+    create_outbuf(&out, fd);
+
+    size_t offset = 0;
+    for(size_t i = 0; i < num_entries; i++) {
+        struct cache_entry* entry = &entries[i];
+        outbuf_write(&out, cache->data + entry->offset, entry->size);
+        entry->offset = offset;
+        offset += entry->size;
+    }
+
+    const bool result = outbuf_flush(&out) && !out.failed;
+    free_outbuf(&out);
+    close(fd);
+
+    if(!result) {
+        unlink(path);
+    }
+    return result;
+}
+
+
+bool open_cache(struct cache* cache, const char* dir, size_t max_size) {
+    memset(cache, 0, sizeof *cache);
+    cache->max_size = max_size;
+    cache->lock_fd = -1;
+    cache->data_fd = -1;
+    create_outbuf(&cache->out, -1);
+
+    char path[PATH_MAX];
+
+    if(!mkdir_p(dir, CACHE_DIR_MODE)) {
+        return false;
+    }
+
+    if(!hash_compiler(&cache->compiler_hash)) {
+        return false;
+    }
+
+    cache->dir = mem_strdup(MEM_CACHE, dir);
+    if(!cache->dir) {
+        PRINT_MEMERROR("mem_strdup");
+        return false;
+    }
+
+    cache_path(cache, "lock", path, sizeof(path));
+    cache->lock_fd = open(path, O_RDWR | O_CREAT, CACHE_FILE_MODE);
+    if(cache->lock_fd < 0 || flock(cache->lock_fd, LOCK_EX) != 0) {
+        errprintf("%s: \"%s\" %s\n", __func__, path, strerror(errno));
+        goto error;
+    }
+
+    read_index(cache);
+    cache->run++;
+
+    data_file_path(cache, cache->data_gen, path, sizeof(path));
+    cache->data_fd = open(path, O_RDWR | O_CREAT | O_APPEND, CACHE_FILE_MODE);
+    if(cache->data_fd < 0) {
+        errprintf("%s: \"%s\" %s\n", __func__, path, strerror(errno));
+        goto error;
+    }
+    if(!map_data(cache)) {
+        goto error;
+    }
+    cache->data_end = cache->data_size;
+    cache->out.fd = cache->data_fd;
+
+    for(size_t i = 0; i < cache->num_entries; i++) {
+        cache->stats.bytes_total += cache->entries[i].size;
+    }
+    return true;
+
+error:
+    close_cache(cache);
+    return false;
+}
+
+void close_cache(struct cache* cache) {
+    if(!cache->dir) {
+        return;
+    }
+
+    struct cache_entry* all = NULL;
+    size_t num_all = 0;
+    const uint64_t old_gen = cache->data_gen;
+
+    if(cache->data_fd < 0) {
+        goto out;
+    }
+
+    // New entries are only indexed if their data was written.
+    if(!outbuf_flush(&cache->out) || cache->out.failed) {
+        cache->num_added = 0;
+    }
+
+    all = mem_alloc(MEM_CACHE, (cache->num_entries + cache->num_added) * sizeof *all + 1);
+    if(!all) {
+        PRINT_MEMERROR("mem_alloc");
+        goto out;
+    }
+
+    // Entries found invalid have 'last_used' 0.
+    for(size_t i = 0; i < cache->num_entries; i++) {
+        if(cache->entries[i].last_used > 0) {
+            all[num_all++] = cache->entries[i];
+        }
+    }
+    memcpy(all + num_all, cache->added, cache->num_added * sizeof *all);
+    num_all += cache->num_added;
+
+    // Same function can be in the input twice.
+    qsort(all, num_all, sizeof *all, compare_entry_keys);
+    size_t num_unique = 0;
+    size_t total = 0;
+    for(size_t i = 0; i < num_all; i++) {
+        if(num_unique > 0 && all[num_unique-1].key == all[i].key) {
+            continue;
+        }
+        all[num_unique++] = all[i];
+        total += all[i].size;
+    }
+    num_all = num_unique;
+
+    if(!map_data(cache)) {
+        goto out;
+    }
+
+    if(cache->data_size > cache->max_size) {
+        qsort(all, num_all, sizeof *all, compare_entry_runs);
+
+        const size_t target = cache->max_size / 100 * CACHE_EVICT_PERCENT;
+        while(num_all > 0 && total > target) {
+            num_all--;
+            total -= all[num_all].size;
+            cache->stats.num_evicted++;
+        }
+
+        qsort(all, num_all, sizeof *all, compare_entry_keys);
+        if(!compact_data(cache, all, num_all)) {
+            goto out;
+        }
+        cache->data_gen++;
+    }
+
+    cache->stats.bytes_total = total;
+    if(write_index(cache, all, num_all) && cache->data_gen != old_gen) {
+        char path[PATH_MAX];
+        data_file_path(cache, old_gen, path, sizeof(path));
+        unlink(path);
+    }
+
+out:
+    mem_free(all);
+    free_outbuf(&cache->out);
+    if(cache->data) {
+        munmap((void*)cache->data, cache->data_size);
+        cache->data = NULL;
+    }
+    if(cache->data_fd > -1) {
+        close(cache->data_fd);
+        cache->data_fd = -1;
+    }
+    if(cache->lock_fd > -1) {
+        close(cache->lock_fd); // Releases the lock.
+        cache->lock_fd = -1;
+    }
+    mem_free(cache->entries);
+    mem_free(cache->added);
+    cache->entries = NULL;
+    cache->added = NULL;
+    mem_free(cache->dir);
+    cache->dir = NULL;
+}
+
+
+uint64_t cache_key(const struct cache* cache, const struct token_array* tokens,
+        size_t start, size_t end, uint32_t salt) {
+    uint64_t hash = cache->compiler_hash ^ salt;
+
+    // Each step is reversible for a given token, so different token lists
+    // only collide as often as random 64 bit values.
+    for(size_t i = start; i < end; i++) {
+        const struct token* tok = &tokens->array[i];
+        hash ^= strtokey(TOKEN_TEXT(tokens, tok), tok->len) + tok->type;
+        hash *= 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+bool cache_get(struct cache* cache, uint64_t key, const char** data, size_t* size) {
+    const struct cache_entry find = { .key = key };
+    struct cache_entry* entry = bsearch(&find, cache->entries, cache->num_entries,
+            sizeof *cache->entries, compare_entry_keys);
+
+    if(!entry || entry->last_used == 0) {
+        cache->stats.misses++;
+        return false;
+    }
+
+    // Data file doesnt match the index.
+    if(entry->offset > cache->data_size || entry->size > cache->data_size - entry->offset) {
+        entry->last_used = 0;
+        cache->stats.misses++;
+        return false;
+    }
+
+    entry->last_used = cache->run;
+    *data = cache->data + entry->offset;
+    *size = entry->size;
+
+    cache->stats.hits++;
+    cache->stats.bytes_read += entry->size;
+    return true;
+}
+
+void cache_put(struct cache* cache, uint64_t key, struct outbuf* data) {
+    if(cache->num_added >= cache->added_num_alloc) {
+        const size_t new_num_alloc = cache->added_num_alloc ? cache->added_num_alloc * 2 : 256;
+        struct cache_entry* new_ptr = mem_realloc(cache->added, new_num_alloc * sizeof *cache->added, MEM_CACHE);
+        if(!new_ptr) {
+            PRINT_MEMERROR("mem_realloc");
+            outbuf_clear(data);
+            return;
+        }
+        cache->added = new_ptr;
+        cache->added_num_alloc = new_num_alloc;
+    }
+
+    const size_t size = outbuf_size(data);
+    for(size_t i = 0; i <= data->curr_chunk; i++) {
+        const struct outbuf_chunk* chunk = &data->chunks[i];
+        if(chunk->len > 0) {
+            outbuf_write(&cache->out, chunk->data, chunk->len);
+        }
+    }
+    outbuf_clear(data);
+
+    struct cache_entry* entry = &cache->added[cache->num_added++];
+    entry->key = key;
+    entry->offset = cache->data_end;
+    entry->size = size;
+    entry->last_used = cache->run;
+
+    cache->data_end += size;
+    cache->stats.bytes_written += size;
+    cache->stats.bytes_total += size;
+}
+
+void cache_print_stats(const struct cache* cache) {
+    const struct cache_stats* st = &cache->stats;
+    errprintf("cache: %zu hits, %zu misses, %zu bytes read, %zu bytes written, "
+            "%zu bytes in cache, %zu evicted\n",
+            st->hits, st->misses, st->bytes_read, st->bytes_written,
+            st->bytes_total, st->num_evicted);
+}
+
@@ -0,0 +1,99 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "token.h"
+#include "outbuf.h"
+
+
+// On-disk cache for the generated code of single functions.
+//
+// Functions are small, a file for each would cost more to open than to compile.
+// So the code of all entries is appended to "<dir>/data.<generation>"
+// and "<dir>/index" lists the entries sorted by key.
+//
+// Keys mix the function's tokens, the output format and a hash of
+// the compiler executable, so a rebuilt compiler never uses old entries.
+//
+// Each compile is a "run" and entries remember the last run which used them.
+// When the data file grows past the maximum size the least recently used
+// entries are dropped and the rest are copied to the next generation of
+// the data file, until it is down to CACHE_EVICT_PERCENT of the maximum.
+// The index is replaced last, so an interrupted compile leaves the old cache usable.
+//
+// The cache is locked while it's open, compiles using the same directory wait for each other.
+
+#define CACHE_DEFAULT_MAX_SIZE (256 * 1024 * 1024)
+#define CACHE_EVICT_PERCENT 75
+
+
+struct cache_stats {
+    size_t hits;
+    size_t misses;
+    size_t bytes_read;
+    size_t bytes_written;
+    size_t bytes_total; // Size of all entries.
+    size_t num_evicted;
+};
+
+struct cache_entry {
+    uint64_t key;
+    uint64_t offset; // In the data file.
+    uint64_t size;
+    uint64_t last_used; // Run number.
+};
+
+struct cache {
+    char*    dir;
+    size_t   max_size;
+    uint64_t compiler_hash;
+
+    int      lock_fd;
+    uint64_t run;
+    uint64_t data_gen;
+
+    // Entries from the index, sorted by key.
+    struct cache_entry* entries;
+    size_t              num_entries;
+
+    // Entries added in this run.
+    struct cache_entry* added;
+    size_t              num_added;
+    size_t              added_num_alloc;
+
+    // Data file is mapped for reading, new entries are appended with 'out'.
+    int           data_fd;
+    const char*   data;
+    size_t        data_size; // Mapped size.
+    size_t        data_end;  // Including what is still buffered in 'out'.
+    struct outbuf out;
+
+    struct cache_stats stats;
+};
+
+
+// Creates 'dir' if it doesnt exist.
+bool open_cache(struct cache* cache, const char* dir, size_t max_size);
+
+// Writes new entries and the index. Evicts entries if the cache is too large.
+void close_cache(struct cache* cache);
+
+// Key of the tokens from 'start' to 'end'.
+// Only token types and texts are hashed, so moving a function in the file keeps it's key.
+uint64_t cache_key(const struct cache* cache, const struct token_array* tokens,
+        size_t start, size_t end, uint32_t salt);
+
+// Returns 'false' if there is no entry for 'key'.
+// '*data' points to the mapped data file and is valid until 'close_cache()'.
+bool cache_get(struct cache* cache, uint64_t key, const char** data, size_t* size);
+
+// Appends everything buffered in 'data' as the entry for 'key' and empties 'data'.
+void cache_put(struct cache* cache, uint64_t key, struct outbuf* data);
+
+void cache_print_stats(const struct cache* cache);
+
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "common.h"
 
@@ -12,8 +13,7 @@ void freeif(void* ptr) {
 
 
 
-bool is_literal_int32(const char* str) {
-    const size_t len = strlen(str);
+bool is_literal_int32(const char* str, size_t len) {
     for(size_t i = 0; i < len; i++) {
         if((str[i] < '0') || (str[i] > '9')) {
             return false;
@@ -22,3 +22,15 @@ bool is_literal_int32(const char* str) {
     return true;
 }
 
+bool parse_int32(const char* str, size_t len, int32_t* value) {
+    int64_t result = 0;
+    for(size_t i = 0; i < len; i++) {
+        result = result * 10 + (str[i] - '0');
+        if(result > INT32_MAX) {
+            return false;
+        }
+    }
+    *value = (int32_t)result;
+    return true;
+}
+
@@ -2,6 +2,8 @@
 #define COMMON_UTILITIES_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof(*a))
@@ -10,7 +12,11 @@ void freeif(void* ptr);
 
 
 
-bool is_literal_int32(const char* str);
+bool is_literal_int32(const char* str, size_t len);
+
+// 'str' must be checked with 'is_literal_int32()' first.
+// Returns 'false' if the value doesnt fit in an int32.
+bool parse_int32(const char* str, size_t len, int32_t* value);
 
 
 #endif
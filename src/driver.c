@@ -0,0 +1,476 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "driver.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "binder.h"
+#include "fileio.h"
+#include "arena.h"
+#include "error.h"
+#include "trace.h"
+#include "memprof.h"
+
+
+// Job indices, the owner takes from 'head' and thieves from 'tail'.
+struct job_queue {
+    pthread_mutex_t lock;
+    size_t*         jobs;
+    size_t          head;
+    size_t          tail;
+};
+
+struct compile_pool;
+
+struct worker {
+    pthread_t            thread;
+    struct job_queue     queue;
+    struct compile_pool* pool;
+    size_t               id;
+};
+
+struct compile_pool {
+    struct compile_job* jobs;
+    size_t              num_jobs;
+
+    struct worker* workers;
+    size_t         num_workers;
+
+    enum output_format format;
+
+    // Signaled when any job is done.
+    pthread_mutex_t done_lock;
+    pthread_cond_t  done_cond;
+};
+
+
+static bool compile_file(const char* input_file, const char* output_file, enum output_format format) {
+    bool result = false;
+
+    struct token_array tokens;
+    if(!tokenize(input_file, &tokens, 1)) {
+        goto out;
+    }
+
+    if(!parse_tokens(&tokens) || !bind_tokens(&tokens)) {
+        goto free_and_out;
+    }
+    arena_reset(get_phase_arena(ARENA_PARSE));
+
+    result = asm_code_gen(&tokens, output_file, format, 1);
+
+free_and_out:
+    free_token_array(&tokens);
+out:
+    // Ready for the next job on this thread.
+    reset_phase_arenas();
+    return result;
+}
+
+
+static bool queue_pop_head(struct job_queue* queue, size_t* job_index) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->head < queue->tail) {
+        *job_index = queue->jobs[queue->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_pop_tail(struct job_queue* queue, size_t* job_index) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->head < queue->tail) {
+        *job_index = queue->jobs[--queue->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Steals from the queue with most jobs left.
+// No jobs are added after start so when all queues look empty the work is done.
+static bool steal_job(struct worker* self, size_t* job_index) {
+    struct compile_pool* pool = self->pool;
+
+    while(true) {
+        struct worker* victim = NULL;
+        size_t victim_left = 0;
+
+        for(size_t i = 1; i < pool->num_workers; i++) {
+            struct worker* other = &pool->workers[(self->id + i) % pool->num_workers];
+
+            pthread_mutex_lock(&other->queue.lock);
+            const size_t left = other->queue.tail - other->queue.head;
+            pthread_mutex_unlock(&other->queue.lock);
+
+            if(left > victim_left) {
+                victim = other;
+                victim_left = left;
+            }
+        }
+
+        if(!victim) {
+            return false;
+        }
+        if(queue_pop_tail(&victim->queue, job_index)) {
+            return true;
+        }
+        // Someone else got it first, look again.
+    }
+}
+
+static void run_job(struct compile_pool* pool, struct compile_job* job) {
+    diag_capture_begin(&job->diag);
+    TRACE_BEGIN("compile job");
+    job->result = compile_file(job->input_file, job->output_file, pool->format);
+    TRACE_END_DETAIL("compile job", job->input_file, strlen(job->input_file));
+    diag_capture_end();
+
+    pthread_mutex_lock(&pool->done_lock);
+    job->done = true;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+}
+
+static void* worker_thread(void* arg) {
+    struct worker* self = arg;
+    struct compile_pool* pool = self->pool;
+
+    size_t job_index = 0;
+    while(queue_pop_head(&self->queue, &job_index)
+       || steal_job(self, &job_index)) {
+        run_job(pool, &pool->jobs[job_index]);
+    }
+
+    free_phase_arenas();
+    return NULL;
+}
+
+
+struct job_order {
+    size_t index;
+    size_t size;
+};
+
+static int compare_job_size(const void* a, const void* b) {
+    const struct job_order* ja = a;
+    const struct job_order* jb = b;
+    if(ja->size != jb->size) {
+        return (ja->size < jb->size) ? 1 : -1;
+    }
+    // Same size, keep the given order.
+    return (ja->index > jb->index) - (ja->index < jb->index);
+}
+
+// Deals jobs to the worker queues round robin, largest first.
+static bool fill_queues(struct compile_pool* pool) {
+    bool result = false;
+
+    struct job_order* order = mem_alloc(MEM_JOBS, pool->num_jobs * sizeof *order);
+    if(!order) {
+        PRINT_MEMERROR("mem_alloc");
+        goto out;
+    }
+
+    for(size_t i = 0; i < pool->num_jobs; i++) {
+        order[i].index = i;
+        order[i].size = pool->jobs[i].input_size;
+    }
+    qsort(order, pool->num_jobs, sizeof *order, compare_job_size);
+
+    for(size_t i = 0; i < pool->num_workers; i++) {
+        struct job_queue* queue = &pool->workers[i].queue;
+        queue->jobs = mem_alloc(MEM_JOBS, (pool->num_jobs / pool->num_workers + 1) * sizeof *queue->jobs);
+        if(!queue->jobs) {
+            PRINT_MEMERROR("mem_alloc");
+            goto free_and_out;
+        }
+    }
+
+    for(size_t i = 0; i < pool->num_jobs; i++) {
+        struct job_queue* queue = &pool->workers[i % pool->num_workers].queue;
+        queue->jobs[queue->tail++] = order[i].index;
+    }
+
+    result = true;
+
+free_and_out:
+    mem_free(order);
+out:
+    return result;
+}
+
+bool compile_jobs(struct compile_job* jobs, size_t num_jobs,
+        enum output_format format, int num_threads) {
+    bool result = false;
+
+    if(num_jobs == 0) {
+        return true;
+    }
+
+    struct compile_pool pool;
+    pool.jobs = jobs;
+    pool.num_jobs = num_jobs;
+    pool.format = format;
+    pool.num_workers = (num_threads > 1) ? (size_t)num_threads : 1;
+    if(pool.num_workers > num_jobs) {
+        pool.num_workers = num_jobs;
+    }
+
+    pool.workers = mem_calloc(MEM_JOBS, pool.num_workers, sizeof *pool.workers);
+    if(!pool.workers) {
+        PRINT_MEMERROR("mem_calloc");
+        return false;
+    }
+
+    pthread_mutex_init(&pool.done_lock, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    for(size_t i = 0; i < pool.num_workers; i++) {
+        struct worker* worker = &pool.workers[i];
+        pthread_mutex_init(&worker->queue.lock, NULL);
+        worker->pool = &pool;
+        worker->id = i;
+    }
+
+    for(size_t i = 0; i < num_jobs; i++) {
+        // Missing files are reported by the job.
+        struct stat sb;
+        jobs[i].input_size = (stat(jobs[i].input_file, &sb) == 0) ? (size_t)sb.st_size : 0;
+        jobs[i].result = false;
+        jobs[i].done = false;
+        jobs[i].diag = (struct diag_buffer){ NULL, 0, 0 };
+    }
+
+    if(!fill_queues(&pool)) {
+        goto free_and_out;
+    }
+
+    size_t num_started = 0;
+    for(size_t i = 0; i < pool.num_workers; i++) {
+        if(pthread_create(&pool.workers[i].thread, NULL, worker_thread, &pool.workers[i]) != 0) {
+            errprintf("%s: pthread_create() | %s\n", __func__, strerror(errno));
+            break;
+        }
+        num_started++;
+    }
+
+    // Running workers steal the jobs of the ones that didnt start.
+    result = (num_started > 0);
+    if(num_started == 0) {
+        goto free_and_out;
+    }
+
+    // Diagnostics in input order.
+    for(size_t i = 0; i < num_jobs; i++) {
+        pthread_mutex_lock(&pool.done_lock);
+        while(!jobs[i].done) {
+            pthread_cond_wait(&pool.done_cond, &pool.done_lock);
+        }
+        pthread_mutex_unlock(&pool.done_lock);
+
+        diag_buffer_print(&jobs[i].diag);
+        free_diag_buffer(&jobs[i].diag);
+
+        if(!jobs[i].result) {
+            result = false;
+        }
+    }
+
+    for(size_t i = 0; i < num_started; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+free_and_out:
+    for(size_t i = 0; i < pool.num_workers; i++) {
+        mem_free(pool.workers[i].queue.jobs);
+        pthread_mutex_destroy(&pool.workers[i].queue.lock);
+    }
+    pthread_cond_destroy(&pool.done_cond);
+    pthread_mutex_destroy(&pool.done_lock);
+    mem_free(pool.workers);
+    return result;
+}
+
+
+static char* output_path_for(const char* input_file, enum output_format format) {
+    static const char INPUT_EXT[] = ".hi_asm";
+
+    const char* ext = "";
+    switch(format) {
+        case OUTPUT_ASM:
+            ext = ".s";
+            break;
+
+        case OUTPUT_ELF_OBJ:
+            ext = ".o";
+            break;
+
+        case OUTPUT_ELF_EXEC:
+            ext = "";
+            break;
+    }
+
+    size_t base_len = strlen(input_file);
+    const size_t input_ext_len = sizeof(INPUT_EXT)-1;
+    if(base_len > input_ext_len
+    && strcmp(input_file + base_len - input_ext_len, INPUT_EXT) == 0) {
+        base_len -= input_ext_len;
+    }
+    else
+    if(ext[0] == 0) {
+        ext = ".out"; // Dont overwrite the input.
+    }
+
+    const size_t ext_len = strlen(ext);
+    char* path = mem_alloc(MEM_JOBS, base_len + ext_len + 1);
+    if(!path) {
+        PRINT_MEMERROR("mem_alloc");
+        return NULL;
+    }
+    memcpy(path, input_file, base_len);
+    memcpy(path + base_len, ext, ext_len + 1);
+    return path;
+}
+
+bool compile_files(const char** input_files, size_t num_files,
+        enum output_format format, int num_threads) {
+    bool result = false;
+
+    struct compile_job* jobs = mem_calloc(MEM_JOBS, num_files, sizeof *jobs);
+    if(!jobs) {
+        PRINT_MEMERROR("mem_calloc");
+        return false;
+    }
+
+    for(size_t i = 0; i < num_files; i++) {
+        jobs[i].input_file = input_files[i];
+        jobs[i].output_file = output_path_for(input_files[i], format);
+        if(!jobs[i].output_file) {
+            goto free_and_out;
+        }
+    }
+
+    result = compile_jobs(jobs, num_files, format, num_threads);
+
+free_and_out:
+    for(size_t i = 0; i < num_files; i++) {
+        mem_free((char*)jobs[i].output_file);
+    }
+    mem_free(jobs);
+    return result;
+}
+
+
+static inline bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+// Copies the next whitespace separated word from 'line'.
+// Returns NULL if there is none.
+static char* next_word(const char** line, const char* line_end) {
+    const char* p = *line;
+    while(p < line_end && is_space(*p)) {
+        p++;
+    }
+    const char* word = p;
+    while(p < line_end && !is_space(*p)) {
+        p++;
+    }
+    *line = p;
+
+    if(p == word) {
+        return NULL;
+    }
+
+    char* copy = mem_alloc(MEM_JOBS, p - word + 1);
+    if(!copy) {
+        PRINT_MEMERROR("mem_alloc");
+        return NULL;
+    }
+    memcpy(copy, word, p - word);
+    copy[p - word] = 0;
+    return copy;
+}
+
+bool compile_manifest(const char* manifest_file, enum output_format format, int num_threads) {
+    bool result = false;
+
+    char* data = NULL;
+    size_t size = 0;
+    if(!map_file(manifest_file, PROT_READ, &data, &size)) {
+        return false;
+    }
+
+    struct compile_job* jobs = NULL;
+    size_t num_jobs = 0;
+    size_t num_alloc = 0;
+
+    const char* line = data;
+    const char* data_end = data + size;
+    size_t line_num = 0;
+
+    while(line < data_end) {
+        const char* line_end = memchr(line, '\n', data_end - line);
+        if(!line_end) {
+            line_end = data_end;
+        }
+        line_num++;
+
+        const char* p = line;
+        while(p < line_end && is_space(*p)) {
+            p++;
+        }
+
+        if(p < line_end && *p != '#') {
+            char* input = next_word(&p, line_end);
+            char* output = next_word(&p, line_end);
+            char* extra = next_word(&p, line_end);
+
+            if(!input || !output || extra) {
+                errmsg(manifest_file, line_num, 0, "Expected \"<input file> <output file>\"");
+                mem_free(input);
+                mem_free(output);
+                mem_free(extra);
+                goto free_and_out;
+            }
+
+            if(num_jobs >= num_alloc) {
+                num_alloc = num_alloc ? num_alloc * 2 : 64;
+                struct compile_job* new_ptr = mem_realloc(jobs, num_alloc * sizeof *jobs, MEM_JOBS);
+                if(!new_ptr) {
+                    PRINT_MEMERROR("mem_realloc");
+                    mem_free(input);
+                    mem_free(output);
+                    goto free_and_out;
+                }
+                jobs = new_ptr;
+            }
+
+            memset(&jobs[num_jobs], 0, sizeof *jobs);
+            jobs[num_jobs].input_file = input;
+            jobs[num_jobs].output_file = output;
+            num_jobs++;
+        }
+
+        line = line_end + 1;
+    }
+
+    result = compile_jobs(jobs, num_jobs, format, num_threads);
+
+free_and_out:
+    for(size_t i = 0; i < num_jobs; i++) {
+        mem_free((char*)jobs[i].input_file);
+        mem_free((char*)jobs[i].output_file);
+    }
+    mem_free(jobs);
+    munmap(data, size);
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "asm_code_gen.h"
+#include "error.h"
+
+
+// Compiles many files in one process on a pool of worker threads.
+//
+// Jobs are dealt to per-worker queues largest input first.
+// A worker takes from the front of its own queue and when it is empty
+// steals from the back of the fullest queue, so one large file
+// doesnt leave the other workers idle.
+//
+// Each job collects its diagnostics and they are printed to stderr
+// in the order the files were given, whatever order the jobs finish in.
+
+
+struct compile_job {
+    const char* input_file;
+    const char* output_file;
+    size_t      input_size; // Only for scheduling.
+
+    bool               result;
+    bool               done;
+    struct diag_buffer diag;
+};
+
+
+// Outputs are named after the inputs: ".hi_asm" is replaced with
+// ".s" or ".o", or removed for executables. (".out" is added if there is no ".hi_asm")
+bool compile_files(const char** input_files, size_t num_files,
+        enum output_format format, int num_threads);
+
+// Each line of the manifest is "<input file> <output file>".
+// Empty lines and lines starting with '#' are skipped.
+bool compile_manifest(const char* manifest_file, enum output_format format, int num_threads);
+
+// Runs all jobs. Returns 'true' if every job succeeded.
+bool compile_jobs(struct compile_job* jobs, size_t num_jobs,
+        enum output_format format, int num_threads);
+
+
+#endif
@@ -0,0 +1,680 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <elf.h>
+
+#include "elf_code_gen.h"
+#include "x86_encode.h"
+#include "error.h"
+#include "arena.h"
+#include "hashmap.h"
+
+
+#define ELF_EXEC_BASE_ADDR 0x400000
+#define ELF_PAGE_SIZE      0x1000
+
+
+struct elf_label {
+    char*  name;
+    size_t offset; // Offset in .text
+};
+
+struct elf_call_fixup {
+    char*  label;
+    size_t at; // Offset of the rel32 field in .text
+};
+
+// Kept in 'code_gen.emit_state'
+struct elf_state {
+    bool executable;
+
+    struct x86_code code;
+
+    struct elf_label* labels;
+    size_t            num_labels;
+    size_t            labels_num_alloc;
+
+    struct elf_call_fixup* fixups;
+    size_t                 num_fixups;
+    size_t                 fixups_num_alloc;
+
+    size_t start_offset;
+    bool   failed;
+};
+
+
+static char* copy_str(struct elf_state* est, const char* str, size_t len) {
+    char* ptr = arena_memalloc(len+1, MEM_CODE);
+    if(!ptr) {
+        PRINT_MEMERROR("arena_memalloc");
+        est->failed = true;
+        return NULL;
+    }
+    memcpy(ptr, str, len);
+    ptr[len] = 0;
+    return ptr;
+}
+
+// Arrays grow geometrically, labels are allocated in between
+// so the arena cant extend them in place.
+static bool grow_array(struct elf_state* est, void** array, size_t* num_alloc, size_t num_used, size_t elem_size) {
+    if(num_used < *num_alloc) {
+        return true;
+    }
+
+    const size_t new_num_alloc = *num_alloc ? *num_alloc * 2 : 64;
+    void* new_ptr = arena_memrealloc(*array, new_num_alloc * elem_size, MEM_CODE);
+    if(!new_ptr) {
+        PRINT_MEMERROR("arena_memrealloc");
+        est->failed = true;
+        return false;
+    }
+    *array = new_ptr;
+    *num_alloc = new_num_alloc;
+    return true;
+}
+
+static void add_label(struct elf_state* est, const char* name, size_t len, size_t offset) {
+    if(!grow_array(est, (void**)&est->labels, &est->labels_num_alloc, est->num_labels, sizeof *est->labels)) {
+        return;
+    }
+    est->labels[est->num_labels].name = copy_str(est, name, len);
+    est->labels[est->num_labels].offset = offset;
+    est->num_labels++;
+}
+
+static void add_call_fixup(struct elf_state* est, const char* label, size_t len, size_t at) {
+    if(!grow_array(est, (void**)&est->fixups, &est->fixups_num_alloc, est->num_fixups, sizeof *est->fixups)) {
+        return;
+    }
+    est->fixups[est->num_fixups].label = copy_str(est, label, len);
+    est->fixups[est->num_fixups].at = at;
+    est->num_fixups++;
+}
+
+// Index in 'elf_state.labels' by name.
+HASHMAP_DEFINE(label_map, struct hashmap_str_key, size_t)
+
+// Calls within .text are resolved here so no relocations are needed.
+// The parser rejects functions defined more than once.
+static bool resolve_call_fixups(struct elf_state* est) {
+    bool result = false;
+
+    struct label_map labels = create_label_map(est->num_labels * 2);
+    if(!labels.table.ctrl) {
+        PRINT_MEMERROR("create_label_map");
+        return false;
+    }
+
+    for(size_t i = 0; i < est->num_labels; i++) {
+        const struct hashmap_str_key key = { est->labels[i].name, strlen(est->labels[i].name) };
+        if(label_map_get(&labels, key)) {
+            errprintf("%s: Function \"%s\" is defined more than once\n", __func__, est->labels[i].name);
+            goto out;
+        }
+        if(!label_map_add(&labels, key, i)) {
+            PRINT_MEMERROR("label_map_add");
+            goto out;
+        }
+    }
+
+    for(size_t i = 0; i < est->num_fixups; i++) {
+        struct elf_call_fixup* fixup = &est->fixups[i];
+        const struct hashmap_str_key key = { fixup->label, strlen(fixup->label) };
+        const size_t* label = label_map_get(&labels, key);
+        if(!label) {
+            errprintf("%s: Undefined function \"%s\"\n", __func__, fixup->label);
+            goto out;
+        }
+        x86_patch_rel32(&est->code, fixup->at, est->labels[*label].offset);
+    }
+    result = true;
+
+out:
+    free_label_map(&labels);
+    return result;
+}
+
+static void free_emitter_state(struct elf_state* est) {
+    for(size_t i = 0; i < est->num_labels; i++) {
+        arena_memfree(est->labels[i].name);
+    }
+    for(size_t i = 0; i < est->num_fixups; i++) {
+        arena_memfree(est->fixups[i].label);
+    }
+    arena_memfree(est->labels);
+    arena_memfree(est->fixups);
+    est->labels = NULL;
+    est->fixups = NULL;
+    est->num_labels = 0;
+    est->num_fixups = 0;
+    est->labels_num_alloc = 0;
+    est->fixups_num_alloc = 0;
+
+    free_x86_code(&est->code);
+}
+
+
+
+static bool elf_begin(struct code_gen* cg, bool executable) {
+    struct elf_state* est = arena_memalloc(sizeof *est, MEM_CODE);
+    if(!est) {
+        PRINT_MEMERROR("arena_memalloc");
+        return false;
+    }
+    cg->emit_state = est;
+
+    est->executable = executable;
+    create_x86_code(&est->code);
+    est->labels = NULL;
+    est->num_labels = 0;
+    est->labels_num_alloc = 0;
+    est->fixups = NULL;
+    est->num_fixups = 0;
+    est->fixups_num_alloc = 0;
+    est->start_offset = 0;
+    est->failed = false;
+    return true;
+}
+
+static bool elf_begin_obj(struct code_gen* cg) {
+    return elf_begin(cg, false);
+}
+
+static bool elf_begin_exec(struct code_gen* cg) {
+    return elf_begin(cg, true);
+}
+
+static bool elf_part_begin(struct code_gen* part) {
+    return elf_begin(part, false);
+}
+
+// Labels and call fixups of the part are moved by the size of the code before it.
+static bool elf_part_join(struct code_gen* cg, struct code_gen* part) {
+    struct elf_state* est = cg->emit_state;
+    struct elf_state* part_est = part->emit_state;
+
+    if(part_est->failed) {
+        est->failed = true;
+        return false;
+    }
+
+    const size_t base = est->code.size;
+    x86_append_code(&est->code, &part_est->code);
+
+    for(size_t i = 0; i < part_est->num_labels; i++) {
+        const struct elf_label* label = &part_est->labels[i];
+        add_label(est, label->name, strlen(label->name), base + label->offset);
+    }
+    for(size_t i = 0; i < part_est->num_fixups; i++) {
+        const struct elf_call_fixup* fixup = &part_est->fixups[i];
+        add_call_fixup(est, fixup->label, strlen(fixup->label), base + fixup->at);
+    }
+
+    return !est->failed && !est->code.failed;
+}
+
+
+// Serialized part: code size and code, then labels and call fixups
+// as count followed by offset, name length and name for each.
+
+static void write_u64(struct outbuf* out, uint64_t value) {
+    outbuf_write(out, (const char*)&value, sizeof(value));
+}
+
+static void write_name(struct outbuf* out, const char* name) {
+    const size_t len = strlen(name);
+    write_u64(out, len);
+    outbuf_write(out, name, len);
+}
+
+static bool elf_part_write(struct code_gen* part, struct outbuf* out) {
+    struct elf_state* est = part->emit_state;
+    if(est->failed || est->code.failed) {
+        return false;
+    }
+
+    write_u64(out, est->code.size);
+    outbuf_write(out, (const char*)est->code.data, est->code.size);
+
+    write_u64(out, est->num_labels);
+    for(size_t i = 0; i < est->num_labels; i++) {
+        write_u64(out, est->labels[i].offset);
+        write_name(out, est->labels[i].name);
+    }
+
+    write_u64(out, est->num_fixups);
+    for(size_t i = 0; i < est->num_fixups; i++) {
+        write_u64(out, est->fixups[i].at);
+        write_name(out, est->fixups[i].label);
+    }
+
+    return !out->failed;
+}
+
+struct part_reader {
+    const char* data;
+    size_t      size;
+    size_t      pos;
+    bool        failed; // Set if the data ended too early.
+};
+
+static const char* read_bytes(struct part_reader* rd, size_t size) {
+    if(rd->failed || size > rd->size - rd->pos) {
+        rd->failed = true;
+        return NULL;
+    }
+    const char* ptr = rd->data + rd->pos;
+    rd->pos += size;
+    return ptr;
+}
+
+static uint64_t read_u64(struct part_reader* rd) {
+    uint64_t value = 0;
+    const char* ptr = read_bytes(rd, sizeof(value));
+    if(ptr) {
+        memcpy(&value, ptr, sizeof(value));
+    }
+    return value;
+}
+
+static bool elf_part_read(struct code_gen* cg, const char* data, size_t size) {
+    struct elf_state* est = cg->emit_state;
+    struct part_reader rd = { data, size, 0, false };
+
+    const size_t base = est->code.size;
+    const uint64_t code_size = read_u64(&rd);
+    const char* code = read_bytes(&rd, code_size);
+    if(!code) {
+        return false;
+    }
+    x86_append_bytes(&est->code, (const uint8_t*)code, code_size);
+
+    const uint64_t num_labels = read_u64(&rd);
+    for(uint64_t i = 0; i < num_labels && !rd.failed; i++) {
+        const uint64_t offset = read_u64(&rd);
+        const uint64_t len = read_u64(&rd);
+        const char* name = read_bytes(&rd, len);
+        if(name) {
+            add_label(est, name, len, base + offset);
+        }
+    }
+
+    const uint64_t num_fixups = read_u64(&rd);
+    for(uint64_t i = 0; i < num_fixups && !rd.failed; i++) {
+        const uint64_t at = read_u64(&rd);
+        const uint64_t len = read_u64(&rd);
+        const char* label = read_bytes(&rd, len);
+        if(label) {
+            add_call_fixup(est, label, len, base + at);
+        }
+    }
+
+    if(rd.failed || rd.pos != rd.size) {
+        est->failed = true;
+        errprintf("%s: Invalid cached code\n", __func__);
+    }
+    return !est->failed && !est->code.failed;
+}
+
+static void elf_func_label(struct code_gen* cg, const char* label, size_t len) {
+    struct elf_state* est = cg->emit_state;
+    add_label(est, label, len, est->code.size);
+}
+
+static void elf_func_enter(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size) {
+    struct elf_state* est = cg->emit_state;
+    for(int reg = REG_RAX; reg <= REG_R15; reg++) {
+        if(saved_regs & (1u << reg)) {
+            x86_push_r64(&est->code, reg);
+        }
+    }
+    if(frame) {
+        x86_push_r64(&est->code, REG_RBP);
+        x86_mov_r64_r64(&est->code, REG_RBP, REG_RSP);
+        if(stack_size > 0) {
+            x86_sub_r64_imm32(&est->code, REG_RSP, stack_size);
+        }
+    }
+}
+
+static void elf_func_leave(struct code_gen* cg, uint32_t saved_regs, bool frame, uint32_t stack_size) {
+    struct elf_state* est = cg->emit_state;
+    if(frame) {
+        if(stack_size > 0) {
+            x86_mov_r64_r64(&est->code, REG_RSP, REG_RBP);
+        }
+        x86_pop_r64(&est->code, REG_RBP);
+    }
+    for(int reg = REG_R15; reg >= REG_RAX; reg--) {
+        if(saved_regs & (1u << reg)) {
+            x86_pop_r64(&est->code, reg);
+        }
+    }
+    x86_ret(&est->code);
+}
+
+static void elf_mov_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    struct elf_state* est = cg->emit_state;
+
+    if(dst->kind == OPERAND_REG) {
+        switch(src->kind) {
+            case OPERAND_IMM:   x86_mov_r32_imm32(&est->code, dst->value, src->value); break;
+            case OPERAND_REG:   x86_mov_r32_r32(&est->code, dst->value, src->value); break;
+            case OPERAND_STACK: x86_mov_r32_m32_rbp(&est->code, dst->value, src->value); break;
+        }
+    }
+    else {
+        switch(src->kind) {
+            case OPERAND_IMM: x86_mov_m32_rbp_imm32(&est->code, dst->value, src->value); break;
+            case OPERAND_REG: x86_mov_m32_rbp_r32(&est->code, dst->value, src->value); break;
+        }
+    }
+}
+
+static void elf_add_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    struct elf_state* est = cg->emit_state;
+
+    if(dst->kind == OPERAND_REG) {
+        switch(src->kind) {
+            case OPERAND_IMM:   x86_add_r32_imm32(&est->code, dst->value, src->value); break;
+            case OPERAND_REG:   x86_add_r32_r32(&est->code, dst->value, src->value); break;
+            case OPERAND_STACK: x86_add_r32_m32_rbp(&est->code, dst->value, src->value); break;
+        }
+    }
+    else {
+        switch(src->kind) {
+            case OPERAND_IMM: x86_add_m32_rbp_imm32(&est->code, dst->value, src->value); break;
+            case OPERAND_REG: x86_add_m32_rbp_r32(&est->code, dst->value, src->value); break;
+        }
+    }
+}
+
+static void elf_xor_i32(struct code_gen* cg, const struct operand* dst, const struct operand* src) {
+    struct elf_state* est = cg->emit_state;
+    x86_xor_r32_r32(&est->code, dst->value, src->value);
+}
+
+static void elf_write_frame(struct code_gen* cg, int size) {
+    struct elf_state* est = cg->emit_state;
+    x86_mov_r64_imm(&est->code, REG_RAX, 1);
+    x86_mov_r64_imm(&est->code, REG_RDI, 1);
+    x86_lea_r64_rbp(&est->code, REG_RSI, size);
+    x86_mov_r64_imm(&est->code, REG_RDX, size);
+    x86_syscall(&est->code);
+}
+
+static void elf_entry_point(struct code_gen* cg, const char* label, size_t len) {
+    struct elf_state* est = cg->emit_state;
+    est->start_offset = est->code.size;
+
+    add_call_fixup(est, label, len, x86_call_rel32(&est->code));
+    x86_mov_r64_imm(&est->code, REG_RAX, 60);
+    x86_mov_r64_imm(&est->code, REG_RDI, 0);
+    x86_syscall(&est->code);
+}
+
+
+
+// Simple string table for .strtab and .shstrtab
+struct elf_strtab {
+    char*  data;
+    size_t size;
+};
+
+static uint32_t strtab_add(struct elf_state* est, struct elf_strtab* tab, const char* str) {
+    const size_t len = strlen(str) + 1;
+    char* new_ptr = arena_memrealloc(tab->data, tab->size + len, MEM_CODE);
+    if(!new_ptr) {
+        PRINT_MEMERROR("arena_memrealloc");
+        est->failed = true;
+        return 0;
+    }
+    tab->data = new_ptr;
+
+    const uint32_t index = tab->size;
+    memcpy(tab->data + tab->size, str, len);
+    tab->size += len;
+    return index;
+}
+
+static inline size_t align_up(size_t n, size_t align) {
+    return (n + (align-1)) & ~(align-1);
+}
+
+static void write_padding(struct outbuf* out, size_t* offset, size_t to) {
+    static const char zeros[16] = { 0 };
+    while(*offset < to) {
+        const size_t n = (to - *offset < sizeof(zeros)) ? (to - *offset) : sizeof(zeros);
+        outbuf_write(out, zeros, n);
+        *offset += n;
+    }
+}
+
+
+enum {
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_SHSTRTAB,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_COUNT
+};
+
+static bool elf_end(struct code_gen* cg) {
+    struct elf_state* est = cg->emit_state;
+    struct outbuf* out = &cg->out;
+    bool result = false;
+
+    struct elf_strtab strtab = { NULL, 0 };
+    struct elf_strtab shstrtab = { NULL, 0 };
+    Elf64_Sym* symtab = NULL;
+
+    if(est->failed || est->code.failed || out->failed) {
+        goto out;
+    }
+
+    if(!resolve_call_fixups(est)) {
+        goto out;
+    }
+
+
+    // Build string and symbol tables.
+
+    strtab_add(est, &strtab, "");
+    strtab_add(est, &shstrtab, "");
+
+    uint32_t sec_names[SEC_COUNT] = { 0 };
+    sec_names[SEC_TEXT] = strtab_add(est, &shstrtab, ".text");
+    sec_names[SEC_SHSTRTAB] = strtab_add(est, &shstrtab, ".shstrtab");
+    sec_names[SEC_SYMTAB] = strtab_add(est, &shstrtab, ".symtab");
+    sec_names[SEC_STRTAB] = strtab_add(est, &shstrtab, ".strtab");
+
+    // Null symbol, section symbol, labels and _start.
+    const size_t num_syms = 2 + est->num_labels + 1;
+    symtab = arena_memalloc(num_syms * sizeof *symtab, MEM_CODE);
+    if(!symtab) {
+        PRINT_MEMERROR("arena_memalloc");
+        goto out;
+    }
+    memset(symtab, 0, num_syms * sizeof *symtab);
+
+    size_t text_offset = sizeof(Elf64_Ehdr);
+    if(est->executable) {
+        text_offset += sizeof(Elf64_Phdr);
+    }
+    text_offset = align_up(text_offset, 16);
+
+    const uint64_t text_addr = est->executable ? (ELF_EXEC_BASE_ADDR + text_offset) : 0;
+
+    size_t sym_idx = 1;
+    symtab[sym_idx].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    symtab[sym_idx].st_shndx = SEC_TEXT;
+    symtab[sym_idx].st_value = text_addr;
+    sym_idx++;
+
+    for(size_t i = 0; i < est->num_labels; i++) {
+        Elf64_Sym* sym = &symtab[sym_idx++];
+        sym->st_name = strtab_add(est, &strtab, est->labels[i].name);
+        sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
+        sym->st_shndx = SEC_TEXT;
+        sym->st_value = text_addr + est->labels[i].offset;
+    }
+
+    const size_t first_global = sym_idx;
+    Elf64_Sym* start_sym = &symtab[sym_idx++];
+    start_sym->st_name = strtab_add(est, &strtab, "_start");
+    start_sym->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+    start_sym->st_shndx = SEC_TEXT;
+    start_sym->st_value = text_addr + est->start_offset;
+
+    if(est->failed) {
+        goto out;
+    }
+
+
+    // File layout.
+    const size_t shstrtab_offset = text_offset + est->code.size;
+    const size_t symtab_offset = align_up(shstrtab_offset + shstrtab.size, 8);
+    const size_t strtab_offset = symtab_offset + num_syms * sizeof *symtab;
+    const size_t shdr_offset = align_up(strtab_offset + strtab.size, 8);
+
+    Elf64_Ehdr ehdr = { 0 };
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = est->executable ? ET_EXEC : ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = est->executable ? (text_addr + est->start_offset) : 0;
+    ehdr.e_phoff = est->executable ? sizeof(Elf64_Ehdr) : 0;
+    ehdr.e_shoff = shdr_offset;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = est->executable ? sizeof(Elf64_Phdr) : 0;
+    ehdr.e_phnum = est->executable ? 1 : 0;
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = SEC_COUNT;
+    ehdr.e_shstrndx = SEC_SHSTRTAB;
+
+    size_t offset = 0;
+    outbuf_write(out, (const char*)&ehdr, sizeof(ehdr));
+    offset += sizeof(ehdr);
+
+    if(est->executable) {
+        // Headers and .text are loaded together.
+        Elf64_Phdr phdr = { 0 };
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_offset = 0;
+        phdr.p_vaddr = ELF_EXEC_BASE_ADDR;
+        phdr.p_paddr = ELF_EXEC_BASE_ADDR;
+        phdr.p_filesz = text_offset + est->code.size;
+        phdr.p_memsz = phdr.p_filesz;
+        phdr.p_align = ELF_PAGE_SIZE;
+
+        outbuf_write(out, (const char*)&phdr, sizeof(phdr));
+        offset += sizeof(phdr);
+    }
+
+    write_padding(out, &offset, text_offset);
+    outbuf_write(out, (const char*)est->code.data, est->code.size);
+    offset += est->code.size;
+
+    outbuf_write(out, shstrtab.data, shstrtab.size);
+    offset += shstrtab.size;
+
+    write_padding(out, &offset, symtab_offset);
+    outbuf_write(out, (const char*)symtab, num_syms * sizeof *symtab);
+    offset += num_syms * sizeof *symtab;
+
+    outbuf_write(out, strtab.data, strtab.size);
+    offset += strtab.size;
+
+    write_padding(out, &offset, shdr_offset);
+
+    Elf64_Shdr shdrs[SEC_COUNT] = { 0 };
+
+    shdrs[SEC_TEXT].sh_name = sec_names[SEC_TEXT];
+    shdrs[SEC_TEXT].sh_type = SHT_PROGBITS;
+    shdrs[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdrs[SEC_TEXT].sh_addr = text_addr;
+    shdrs[SEC_TEXT].sh_offset = text_offset;
+    shdrs[SEC_TEXT].sh_size = est->code.size;
+    shdrs[SEC_TEXT].sh_addralign = 16;
+
+    shdrs[SEC_SHSTRTAB].sh_name = sec_names[SEC_SHSTRTAB];
+    shdrs[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    shdrs[SEC_SHSTRTAB].sh_offset = shstrtab_offset;
+    shdrs[SEC_SHSTRTAB].sh_size = shstrtab.size;
+    shdrs[SEC_SHSTRTAB].sh_addralign = 1;
+
+    shdrs[SEC_SYMTAB].sh_name = sec_names[SEC_SYMTAB];
+    shdrs[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    shdrs[SEC_SYMTAB].sh_offset = symtab_offset;
+    shdrs[SEC_SYMTAB].sh_size = num_syms * sizeof *symtab;
+    shdrs[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    shdrs[SEC_SYMTAB].sh_info = first_global;
+    shdrs[SEC_SYMTAB].sh_addralign = 8;
+    shdrs[SEC_SYMTAB].sh_entsize = sizeof *symtab;
+
+    shdrs[SEC_STRTAB].sh_name = sec_names[SEC_STRTAB];
+    shdrs[SEC_STRTAB].sh_type = SHT_STRTAB;
+    shdrs[SEC_STRTAB].sh_offset = strtab_offset;
+    shdrs[SEC_STRTAB].sh_size = strtab.size;
+    shdrs[SEC_STRTAB].sh_addralign = 1;
+
+    outbuf_write(out, (const char*)shdrs, sizeof(shdrs));
+
+    result = !out->failed;
+
+out:
+    arena_memfree(strtab.data);
+    arena_memfree(shstrtab.data);
+    arena_memfree(symtab);
+    free_emitter_state(est);
+    arena_memfree(est);
+    cg->emit_state = NULL;
+    return result;
+}
+
+
+static const struct code_emitter ELF_OBJ_EMITTER = {
+    .begin         = elf_begin_obj,
+    .func_label    = elf_func_label,
+    .func_enter    = elf_func_enter,
+    .func_leave    = elf_func_leave,
+    .mov_i32       = elf_mov_i32,
+    .add_i32       = elf_add_i32,
+    .xor_i32       = elf_xor_i32,
+    .write_frame   = elf_write_frame,
+    .entry_point   = elf_entry_point,
+    .end           = elf_end,
+    .part_begin    = elf_part_begin,
+    .part_join     = elf_part_join,
+    .part_write    = elf_part_write,
+    .part_read     = elf_part_read
+};
+
+static const struct code_emitter ELF_EXEC_EMITTER = {
+    .begin         = elf_begin_exec,
+    .func_label    = elf_func_label,
+    .func_enter    = elf_func_enter,
+    .func_leave    = elf_func_leave,
+    .mov_i32       = elf_mov_i32,
+    .add_i32       = elf_add_i32,
+    .xor_i32       = elf_xor_i32,
+    .write_frame   = elf_write_frame,
+    .entry_point   = elf_entry_point,
+    .end           = elf_end,
+    .part_begin    = elf_part_begin,
+    .part_join     = elf_part_join,
+    .part_write    = elf_part_write,
+    .part_read     = elf_part_read
+};
+
+const struct code_emitter* get_elf_emitter(bool executable) {
+    return executable ? &ELF_EXEC_EMITTER : &ELF_OBJ_EMITTER;
+}
+
@@ -0,0 +1,15 @@
+#ifndef ELF_CODE_GEN_H
+#define ELF_CODE_GEN_H
+
+#include <stdbool.h>
+
+#include "asm_code_gen.h"
+
+
+// Emitter which encodes the instructions directly into machine code
+// and writes ELF64 relocatable object or static executable.
+// Then "nasm" and "ld" are not needed.
+const struct code_emitter* get_elf_emitter(bool executable);
+
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -7,6 +8,50 @@
 #include "error.h"
 
 
+static _Thread_local struct diag_buffer* diag_capture = NULL;
+
+
+// Text is dropped if there is no memory for it.
+static void diag_append(struct diag_buffer* buf, const char* text, size_t len) {
+    if(buf->size + len > buf->mem_size) {
+        size_t mem_size = buf->mem_size ? buf->mem_size * 2 : 1024;
+        while(mem_size < buf->size + len) {
+            mem_size *= 2;
+        }
+
+        char* new_ptr = realloc(buf->data, mem_size);
+        if(!new_ptr) {
+            return; // Nowhere to report this.
+        }
+        buf->data = new_ptr;
+        buf->mem_size = mem_size;
+    }
+
+    memcpy(buf->data + buf->size, text, len);
+    buf->size += len;
+}
+
+// 'fd' is used when not capturing.
+static void diag_write(int fd, const char* text, size_t len) {
+    if(diag_capture) {
+        diag_append(diag_capture, text, len);
+        return;
+    }
+    write(fd, text, len);
+}
+
+static void diag_vprintf(int fd, const char* fmt, va_list args) {
+    char buffer[1024];
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    if(len < 0) {
+        return;
+    }
+    if((size_t)len >= sizeof(buffer)) {
+        len = sizeof(buffer)-1;
+    }
+    diag_write(fd, buffer, len);
+}
+
 
 void errmsg
 (
@@ -28,15 +73,18 @@ void errmsg
             column);
 
     if(buflen < 0) {
-        fprintf(stderr, "%s: %s\n", __func__, strerror(errno));
+        errprintf("%s: %s\n", __func__, strerror(errno));
         goto skip;
     }
 
-    buflen += vsnprintf(buffer + buflen, sizeof(buffer)-1,
+    buflen += vsnprintf(buffer + buflen, sizeof(buffer)-1 - buflen,
             fmt, args);
+    if((size_t)buflen > sizeof(buffer)-2) {
+        buflen = sizeof(buffer)-2;
+    }
+    buffer[buflen++] = '\n';
 
-    write(STDOUT_FILENO, buffer, buflen);
-    write(STDOUT_FILENO, "\n", 1);
+    diag_write(STDOUT_FILENO, buffer, buflen);
 
 skip:
     va_end(args);
@@ -50,6 +98,45 @@ void print_memalloc_error_msg
     const char* func_file,
     const char* cause
 ){
-    fprintf(stderr, "(INTERNAL MEMORY ERROR): From(%s, %s()) %s: %s\n",
+    errprintf("(INTERNAL MEMORY ERROR): From(%s, %s()) %s: %s\n",
             func_file, func_name, cause, strerror(errno));
 }
+
+
+void errprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    if(!diag_capture) {
+        vfprintf(stderr, fmt, args);
+    }
+    else {
+        diag_vprintf(STDERR_FILENO, fmt, args);
+    }
+
+    va_end(args);
+}
+
+
+void diag_capture_begin(struct diag_buffer* buf) {
+    diag_capture = buf;
+}
+
+void diag_capture_end() {
+    diag_capture = NULL;
+}
+
+void diag_buffer_print(struct diag_buffer* buf) {
+    if(buf->size > 0) {
+        fflush(stdout);
+        fwrite(buf->data, 1, buf->size, stderr);
+    }
+    buf->size = 0;
+}
+
+void free_diag_buffer(struct diag_buffer* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->size = 0;
+    buf->mem_size = 0;
+}
@@ -24,5 +24,26 @@ void print_memalloc_error_msg
     print_memalloc_error_msg(__func__, __FILE__, cause)
 
 
+// Same as 'fprintf(stderr, ...)' unless the thread is capturing diagnostics.
+void errprintf(const char* fmt, ...);
+
+
+// While a thread is capturing, 'errmsg()', 'errprintf()' and memory errors
+// from that thread are appended here instead of being printed.
+// Parallel jobs use this to print their diagnostics in a fixed order.
+struct diag_buffer {
+    char*  data;
+    size_t size;
+    size_t mem_size;
+};
+
+void diag_capture_begin(struct diag_buffer* buf);
+void diag_capture_end();
+
+// Writes the collected text to stderr and empties the buffer.
+void diag_buffer_print(struct diag_buffer* buf);
+void free_diag_buffer(struct diag_buffer* buf);
+
+
 
 #endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // mremap()
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -8,6 +9,8 @@
 #include <sys/mman.h>
 
 #include "fileio.h"
+#include "error.h"
+#include "trace.h"
 
 
 bool file_exists(const char* path) {
@@ -41,7 +44,7 @@ bool mkdir_p(const char* path, mode_t perm) {
         
         buffer[buffer_idx++] = ch;
         if(buffer_idx >= sizeof(buffer)) {
-            fprintf(stderr, "%s: The path is too long\n", __func__);
+            errprintf("%s: The path is too long\n", __func__);
             goto out;
         }
 
@@ -49,7 +52,7 @@ bool mkdir_p(const char* path, mode_t perm) {
         || (i+1 >= path_length)) {
             if(!dir_exists(buffer)) {
                 if(mkdir(buffer, perm) != 0) {
-                    fprintf(stderr, "%s: \"%s\" %s\n", __func__, buffer, strerror(errno));
+                    errprintf("%s: \"%s\" %s\n", __func__, buffer, strerror(errno));
                     goto out;
                 }
             }
@@ -65,7 +68,7 @@ out:
 ssize_t file_size(const char* path) {
     struct stat sb;
     if(lstat(path, &sb) < 0) {
-        fprintf(stderr, "%s: lstat() | %s\n", __func__, strerror(errno));
+        errprintf("%s: lstat() | %s\n", __func__, strerror(errno));
         return -1;
     }
 
@@ -95,29 +98,32 @@ bool map_file(const char* path, int prot, char** out, size_t* out_size) {
 
     int fd = open(path, open_flags);
     struct stat sb;
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
 
 
     if(fd < 0) {
-        fprintf(stderr, "%s: open() | %s\n", __func__, strerror(errno));
+        errprintf("%s: open() | %s\n", __func__, strerror(errno));
         goto out;
     }
 
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
     if(fstat(fd, &sb) < 0) {
-        fprintf(stderr, "%s: fstat() | %s\n", __func__, strerror(errno));
+        errprintf("%s: fstat() | %s\n", __func__, strerror(errno));
         goto out;
     }
     
     *out_size = sb.st_size;
 
     if(sb.st_size == 0) {
-        fprintf(stderr, "%s: Not mapping empty file \"%s\"\n", __func__, path);
+        errprintf("%s: Not mapping empty file \"%s\"\n", __func__, path);
         goto out;
     }
 
     if(out) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
         *out = mmap(NULL, sb.st_size, prot, mmap_flags, fd, 0);
         if(*out == MAP_FAILED) {
-            fprintf(stderr, "%s: mmap() | %s\n", __func__, strerror(errno));
+            errprintf("%s: mmap() | %s\n", __func__, strerror(errno));
             goto out;
         }
     }
@@ -127,6 +133,7 @@ bool map_file(const char* path, int prot, char** out, size_t* out_size) {
 out:
 
     if(fd > 0) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
         close(fd);
     }
 
@@ -134,6 +141,59 @@ out:
 }
 
 
+bool read_fd_mapped(int fd, char** out, size_t* out_size) {
+    bool result = false;
+
+    size_t mem_size = 64 * 1024;
+    size_t size = 0;
+    char* data = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(data == MAP_FAILED) {
+        errprintf("%s: mmap() | %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    while(true) {
+        if(size == mem_size) {
+            char* new_ptr = mremap(data, mem_size, mem_size * 2, MREMAP_MAYMOVE);
+            if(new_ptr == MAP_FAILED) {
+                errprintf("%s: mremap() | %s\n", __func__, strerror(errno));
+                goto out;
+            }
+            data = new_ptr;
+            mem_size *= 2;
+        }
+
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        ssize_t n = read(fd, data + size, mem_size - size);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            errprintf("%s: read() | %s\n", __func__, strerror(errno));
+            goto out;
+        }
+        if(n == 0) {
+            break;
+        }
+        size += n;
+    }
+
+    if(size == 0) {
+        errprintf("%s: Nothing to read\n", __func__);
+        goto out;
+    }
+
+    *out = data;
+    *out_size = size;
+    result = true;
+
+out:
+    if(!result) {
+        munmap(data, mem_size);
+    }
+    return result;
+}
+
 bool write_file(const char* path, void* data, size_t size) {
     bool result = false;
     if(!file_exists(path)) {
@@ -142,12 +202,12 @@ bool write_file(const char* path, void* data, size_t size) {
 
     int fd = open(path, O_WRONLY | O_TRUNC);
     if(fd < 0) {
-        fprintf(stderr, "%s: open() | %s\n", __func__, strerror(errno));
+        errprintf("%s: open() | %s\n", __func__, strerror(errno));
         goto out;
     }
 
     if(write(fd, data, size) < 0) {
-        fprintf(stderr, "%s: write() | %s\n", __func__, strerror(errno));
+        errprintf("%s: write() | %s\n", __func__, strerror(errno));
         goto close_and_out;
     }
 
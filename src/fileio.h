@@ -19,6 +19,10 @@ bool mkdir_p(const char* path, mode_t perm);
 // to avoid undefined reads in the future for the file.
 bool map_file(const char* path, int prot, char** out, size_t* out_size);
 
+// Reads everything from 'fd' (until end of file) into anonymous memory
+// so it can be used like a file from 'map_file()' and freed with 'munmap()'.
+bool read_fd_mapped(int fd, char** out, size_t* out_size);
+
 bool write_file(const char* path, void* data, size_t size);
 
 // On error returns -1 otherwise the file size.
@@ -44,374 +44,233 @@ static void hashmap_error_ext(const char* from_func, const char* fmt, ...) {
     hashmap_error_ext(__func__, message, ##__VA_ARGS__)
 
 
-// Allocates more memory for bucket if needed.
-static bool hashmap_memcheck_bucket(struct hashmap_bucket_t* bucket, size_t new_mem_size) {
-    if(bucket->pairs && (bucket->pairs_mem_size >= new_mem_size)) {
-        return true; // Nothing needs to be done.
-    }
-    if(bucket->pairs && (new_mem_size < bucket->pairs_mem_size)) {
-        return true; // Dont allow memory size to be decreased.
-    }
-
-    struct hashmap_pair_t* new_ptr = realloc(bucket->pairs, new_mem_size);
-    if(!new_ptr) {
-        hashmap_error("realloc() failed! bucket->pairs = %p, new_mem_size = %li | %s",
-                bucket->pairs, new_mem_size, strerror(errno));
-        return false;
-    }
-
-    const size_t start_idx = bucket->pairs_mem_size / sizeof(*bucket->pairs);
-    const size_t end_idx = new_mem_size / sizeof(*bucket->pairs);
-   
-    bucket->pairs = new_ptr;
-    
-    for(size_t i = start_idx; i < end_idx; i++) {
-        struct hashmap_pair_t* pair = &bucket->pairs[i];
-        pair->used = false;
-        pair->key = 0;
-        pair->ptr = NULL;
-        pair->mem_size = 0;
+// Finds empty or deleted slot for the key, the key must not be in the map already.
+// Groups are probed with triangular numbers (1, 2, 3 ...),
+// this visits every group when the group count is power of 2.
+static size_t hashmap_find_free_slot(const uint8_t* ctrl, size_t map_size, uint64_t hash) {
+    const size_t group_mask = (map_size / HASHMAP_GROUP_SIZE) - 1;
+
+    size_t group_idx = hashmap_first_group(map_size, hash);
+    for(size_t step = 1; ; step++) {
+        const size_t base = group_idx * HASHMAP_GROUP_SIZE;
+        const uint32_t free_mask = hashmap_group_match_free(&ctrl[base]);
+        if(free_mask) {
+            return base + __builtin_ctz(free_mask);
+        }
+        group_idx = (group_idx + step) & group_mask;
     }
-
-    bucket->pairs_mem_size = new_mem_size;
-
-    return true;
 }
 
-// Allocates more memory for hash map bucket array if needed.
-static bool hashmap_memcheck_add(struct hashmap_t* map, size_t new_mem_size) {
-    if(map->buckets && (map->buckets_mem_size >= new_mem_size)) {
-        return true; // Nothing needs to be done.
-    }
-    if(map->buckets && (new_mem_size < map->buckets_mem_size)) {
-        return true; // Dont allow memory size to be decreased.
-    }
-    
-    const size_t new_map_size = next_pow2_64(new_mem_size / sizeof(*map->buckets));
-
-    struct hashmap_bucket_t* new_ptr = realloc(map->buckets, new_map_size * sizeof(*map->buckets));
-    if(!new_ptr) {
-        hashmap_error("realloc() failed! map->buckets = %p, new_mem_size = %li | %s",
-                map->buckets, new_mem_size, strerror(errno));
-        return false;
-    }
-
-    map->buckets = new_ptr;
-    map->buckets_mem_size = new_mem_size;
-
-    for(size_t i = map->map_size; i < new_map_size; i++) {
-        struct hashmap_bucket_t* bucket = &map->buckets[i];
-        bucket->pairs = NULL;
-        bucket->pairs_mem_size = 0;
-        bucket->num_pairs = 0;
-        bucket->next = NULL;
 
-        // Allocate one element for pair array
-        // so in best case scenario we
-        // dont need to allocate more memory when adding pairs to hashmap
-        hashmap_memcheck_bucket(bucket, sizeof(*bucket->pairs));
-    }
-    
-    map->map_size = new_map_size;
-
-    return true;
-}
+// String hash, this is wyhash (final version 4).
+// Every byte of the string affects all bits of the result.
 
-struct hashmap_t create_hashmap(size_t initial_map_size) {
-    struct hashmap_t map;
-   
-    map.map_size = 0;
-    map.buckets_mem_size = 0;
-    map.buckets = NULL;
-    
-    hashmap_memcheck_add(&map, initial_map_size * sizeof(*map.buckets));
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
 
-    map.buckets_link_tail = NULL;
-    return map;
+static inline void wy_mum(uint64_t* a, uint64_t* b) {
+    const __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
 }
 
-void free_hashmap(struct hashmap_t* map) {
-    size_t free_count = 0;
-    size_t free_count_pairptr = 0;
-    for(size_t i = 0; i < map->map_size; i++) {
-        struct hashmap_bucket_t* bucket = &map->buckets[i];
-        if(bucket->pairs) {
-            for(size_t j = 0; j < bucket->num_pairs; j++) {
-                struct hashmap_pair_t* pair = &bucket->pairs[j];
-                if(pair->ptr && pair->mem_size) {
-                    free(pair->ptr);
-                    pair->ptr = NULL;
-                    free_count_pairptr++;
-                }
-            }
-
-            free(bucket->pairs);
-            free_count++;
-        }
-            
-        bucket->pairs = NULL;
-        bucket->pairs_mem_size = 0;
-        bucket->num_pairs = 0;
-        bucket->next = NULL;
-    }
-
-    free(map->buckets);
-    map->buckets = NULL;
-    map->buckets_link_tail = NULL;
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
 }
 
-
-uint64_t hash_i32_key(int key) {
-    return (key ^ (key & 0xFF000000)) * 2654435761;
+static inline uint64_t wy_r8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
 }
 
-uint64_t strtokey(const char* str) {
-    uint64_t key = 0;
-
-    size_t len = strlen(str);
-    for(size_t i = 0; i < len; i++) {
-        key = hash_i32_key((int)str[i]);
-    }
-    return key;
+static inline uint64_t wy_r4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
 }
 
-void hashmap_clear(struct hashmap_t* map) {
-    struct hashmap_bucket_t* bucket = map->buckets_link_tail;
-    while(bucket) {
-        bucket->num_pairs = 0;
-        bucket = bucket->next;
-    }
+// 1 to 3 bytes.
+static inline uint64_t wy_r3(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
 }
 
-bool hashmap_key_exists(struct hashmap_t* map, int key, 
-        struct hashmap_bucket_t** bucket_out, size_t* bucket_pair_index_out) {
-    
-    const size_t bucket_idx = hash_i32_key(key) % map->map_size;
-    struct hashmap_bucket_t* bucket = &map->buckets[bucket_idx];
-    
-    if(bucket_out) {
-        *bucket_out = bucket;
+uint64_t strtokey(const char* str, size_t len) {
+    const uint8_t* p = (const uint8_t*)str;
+    uint64_t seed = wy_mix(WY_P0, WY_P1) ^ WY_P0;
+    uint64_t a = 0;
+    uint64_t b = 0;
+
+    if(len <= 16) {
+        if(len >= 4) {
+            const size_t mid = (len >> 3) << 2;
+            a = (wy_r4(p) << 32) | wy_r4(p + mid);
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+        }
+        else
+        if(len > 0) {
+            a = wy_r3(p, len);
+        }
     }
-   
-    for(size_t i = 0; i < bucket->num_pairs; i++) {
-        if(bucket->pairs[i].used && (bucket->pairs[i].key == key)) {
-            if(bucket_pair_index_out) {
-                *bucket_pair_index_out = i;
-            }
-            return true;
+    else {
+        size_t i = len;
+        if(i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ WY_P1, wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ WY_P2, wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ WY_P3, wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16) {
+            seed = wy_mix(wy_r8(p) ^ WY_P1, wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
         }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
     }
 
-    return false;
+    a ^= WY_P1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
 }
 
+// Storage for HASHMAP_DEFINE() maps.
 
-static inline bool prep_hashmap_op_add(struct hashmap_t* map, int key, 
-        struct hashmap_bucket_t** bucket_out, struct hashmap_pair_t** pair_out) {
+static bool hashmap_table_alloc(struct hashmap_table* table, size_t map_size, size_t slot_size) {
+    uint8_t* ctrl = HASHMAP_MEMALLOC(map_size * sizeof *ctrl);
+    void* slots = HASHMAP_MEMALLOC(map_size * slot_size);
 
-    const size_t bucket_idx = hash_i32_key(key) % map->map_size;
-    struct hashmap_bucket_t* bucket = &map->buckets[bucket_idx];
-
-    if(hashmap_key_exists(map, key, NULL, NULL)) {
-        return false;
-    }
-
-    // Allocate more memory if needed.
-    if(!hashmap_memcheck_bucket(bucket, bucket->pairs_mem_size + sizeof(*bucket->pairs))) {
+    if(!ctrl || !slots) {
+        hashmap_error("Failed to allocate %li slots | %s", map_size, strerror(errno));
+        if(ctrl) {
+            HASHMAP_MEMFREE(ctrl);
+        }
+        if(slots) {
+            HASHMAP_MEMFREE(slots);
+        }
         return false;
     }
 
-    *bucket_out = bucket;
-    *pair_out = &bucket->pairs[bucket->num_pairs];
+    memset(ctrl, HASHMAP_CTRL_EMPTY, map_size * sizeof *ctrl);
 
+    table->ctrl = ctrl;
+    table->slots = slots;
+    table->map_size = map_size;
+    table->num_used = 0;
+    table->num_deleted = 0;
     return true;
 }
 
-static inline bool prep_hashmap_op_put(struct hashmap_t* map, int key, 
-        struct hashmap_bucket_t** bucket_out, struct hashmap_pair_t** pair_out, bool* key_exists) {
-   
-    size_t pair_index = 0;
+static bool hashmap_table_rehash(struct hashmap_table* table, size_t new_map_size, size_t slot_size) {
+    struct hashmap_table old = *table;
 
-    *key_exists = hashmap_key_exists(map, key, bucket_out, &pair_index);
-    if(!*key_exists) {
-    
-        // Allocate more memory if needed.
-        if(!hashmap_memcheck_bucket
-            (*bucket_out, (*bucket_out)->pairs_mem_size + sizeof((*bucket_out)->pairs))) {
-            return false;
-        }
-
-        *pair_out = &(*bucket_out)->pairs[(*bucket_out)->num_pairs];
-    }
-    else {
-        *pair_out = &(*bucket_out)->pairs[pair_index];
+    if(!hashmap_table_alloc(table, new_map_size, slot_size)) {
+        *table = old;
+        return false;
     }
 
-    return true;
-}
-
-static inline void hashmap_update_linked_list(struct hashmap_t* map, struct hashmap_bucket_t* bucket) {
-    bucket->num_pairs++;
-    bucket->next = map->buckets_link_tail;
-    map->buckets_link_tail = bucket;
-}
+    for(size_t i = 0; i < old.map_size; i++) {
+        if(old.ctrl[i] & 0x80) {
+            continue;
+        }
 
+        const uint8_t* old_slot = (const uint8_t*)old.slots + i * slot_size;
+        uint64_t hash;
+        memcpy(&hash, old_slot, sizeof hash);
 
-bool hashmap_add(struct hashmap_t* map, int key, void* ptr) {
-    struct hashmap_bucket_t* bucket = NULL;
-    struct hashmap_pair_t* pair = NULL;
-    
-    if(!prep_hashmap_op_add(map, key, &bucket, &pair)) {
-        return false;
+        const size_t index = hashmap_find_free_slot(table->ctrl, table->map_size, hash);
+        table->ctrl[index] = hashmap_h2(hash);
+        memcpy((uint8_t*)table->slots + index * slot_size, old_slot, slot_size);
+        table->num_used++;
     }
 
-    pair->key = key;
-    pair->ptr = ptr;
-    pair->mem_size = 0;
-    pair->used = true;
-
-    hashmap_update_linked_list(map, bucket);
+    if(old.ctrl) {
+        HASHMAP_MEMFREE(old.ctrl);
+        HASHMAP_MEMFREE(old.slots);
+    }
+    HASHMAP_TRACK_COPY(table->num_used * slot_size);
     return true;
 }
 
-bool hashmap_add_new(struct hashmap_t* map, int key, void* data_ptr, size_t size) {
-    struct hashmap_bucket_t* bucket = NULL;
-    struct hashmap_pair_t* pair = NULL;
+bool hashmap_table_init(struct hashmap_table* table, size_t initial_map_size, size_t slot_size) {
+    table->map_size = 0;
+    table->num_used = 0;
+    table->num_deleted = 0;
+    table->ctrl = NULL;
+    table->slots = NULL;
 
-    if(!prep_hashmap_op_add(map, key, &bucket, &pair)) {
-        return false;
+    size_t map_size = next_pow2_64(initial_map_size);
+    if(map_size < HASHMAP_GROUP_SIZE) {
+        map_size = HASHMAP_GROUP_SIZE;
     }
 
-    pair->key = key;
-    pair->used = true;
-    
-    pair->ptr = malloc(size);
-    pair->mem_size = size;
-
-    memmove(pair->ptr, data_ptr, size);
-
-    hashmap_update_linked_list(map, bucket);
-    return true;
+    return hashmap_table_alloc(table, map_size, slot_size);
 }
 
-bool hashmap_put_new(struct hashmap_t* map, int key, void* data_ptr, size_t size) {
-    struct hashmap_bucket_t* bucket = NULL;
-    struct hashmap_pair_t* pair = NULL;
-
-    bool key_exists = false;
-    if(!prep_hashmap_op_put(map, key, &bucket, &pair, &key_exists)) {
-        return false;
+void hashmap_table_free(struct hashmap_table* table) {
+    if(table->ctrl) {
+        HASHMAP_MEMFREE(table->ctrl);
+        HASHMAP_MEMFREE(table->slots);
     }
+    table->ctrl = NULL;
+    table->slots = NULL;
+    table->map_size = 0;
+    table->num_used = 0;
+    table->num_deleted = 0;
+}
 
-    pair->key = key;
-    pair->used = true;
-    
-    // Here the 'ptr' may be already allocated because this function can replace it.
-    // But dont bother to reallocate it if the memory size seems to be same.
-
-    if(pair->mem_size != size) {
-        free(pair->ptr);
-        pair->ptr = NULL;
+void hashmap_table_clear(struct hashmap_table* table) {
+    if(table->ctrl) {
+        memset(table->ctrl, HASHMAP_CTRL_EMPTY, table->map_size * sizeof *table->ctrl);
     }
+    table->num_used = 0;
+    table->num_deleted = 0;
+}
 
-    if(!pair->ptr) {
-        pair->ptr = malloc(size);
+bool hashmap_table_reserve(struct hashmap_table* table, size_t slot_size) {
+    if((table->num_used + table->num_deleted + 1) * 8 <= table->map_size * HASHMAP_MAX_LOAD) {
+        return true;
     }
 
-    memmove(pair->ptr, data_ptr, size);
-    pair->mem_size = size;
-
-    if(!key_exists) {
-        // New element was added.
-        hashmap_update_linked_list(map, bucket);
+    size_t new_map_size = table->map_size;
+    if((table->num_used + 1) * 16 > table->map_size * HASHMAP_MAX_LOAD) {
+        new_map_size *= 2;
     }
-    return true;
-}
-
-bool hashmap_put(struct hashmap_t* map, int key, void* ptr) {
-    struct hashmap_bucket_t* bucket = NULL;
-    struct hashmap_pair_t* pair = NULL;
-
-    bool key_exists = false;
-    if(!prep_hashmap_op_put(map, key, &bucket, &pair, &key_exists)) {
-        return false;
+    if(new_map_size < HASHMAP_GROUP_SIZE) {
+        new_map_size = HASHMAP_GROUP_SIZE;
     }
 
-    pair->key = key;
-    pair->ptr = ptr;
-    pair->mem_size = 0;
-    pair->used = true;
-
-    if(!key_exists) {
-        // New element was added.
-        hashmap_update_linked_list(map, bucket);
-    }
-    return true;
+    return hashmap_table_rehash(table, new_map_size, slot_size);
 }
 
-bool hashmap_del(struct hashmap_t* map, int key) {
-    struct hashmap_bucket_t* bucket = NULL;
-    size_t pair_index = 0;
-
-    const bool key_exists = hashmap_key_exists(map, key, &bucket, &pair_index);
-
-    if(key_exists) {
-        struct hashmap_pair_t* pair = &bucket->pairs[pair_index];
-        pair->used = false;
-        pair->key = 0;
-
-        if(pair->ptr && pair->mem_size) {
-            free(pair->ptr);
-        }
-
-        pair->mem_size = 0;
-        pair->ptr = NULL;
-
-        //                 ,-----------.
-        //                /             v
-        // ... -> [o] -> [o]    [X]    [o] -> ...
-
-        struct hashmap_bucket_t* bucket_it = map->buckets_link_tail;
-        struct hashmap_bucket_t* prev_bucket_it = NULL;
-
-        while(bucket_it) {
-
-            if(bucket_it == bucket) {
-                if(prev_bucket_it) {
-                    prev_bucket_it->next = bucket->next;
-                }
-                else {
-                    // Last bucket doesnt have previous.
-                    map->buckets_link_tail = bucket->next;
-                }
-                break;
-            }
-
-            prev_bucket_it = bucket_it;
-            bucket_it = bucket_it->next;
-        }
-
-        bucket->num_pairs--;
+size_t hashmap_table_claim(struct hashmap_table* table, uint64_t hash) {
+    const size_t index = hashmap_find_free_slot(table->ctrl, table->map_size, hash);
+    if(table->ctrl[index] == HASHMAP_CTRL_DELETED) {
+        table->num_deleted--;
     }
-
-    return key_exists;
+    table->ctrl[index] = hashmap_h2(hash);
+    table->num_used++;
+    return index;
 }
 
-struct hashmap_pair_t* hashmap_get(struct hashmap_t* map, int key) {
-    struct hashmap_pair_t* pair = NULL;
-
-    const size_t bucket_idx = hash_i32_key(key) % map->map_size;
-    struct hashmap_bucket_t* bucket = &map->buckets[bucket_idx];
-
-    for(size_t i = 0; i < bucket->num_pairs; i++) {
-        struct hashmap_pair_t* pair_it = &bucket->pairs[i];
-        if(pair_it->used && (pair_it->key == key)) {
-            pair = pair_it;
-            break;
-        }
+void hashmap_table_release(struct hashmap_table* table, size_t index) {
+    const size_t base = index & ~(size_t)(HASHMAP_GROUP_SIZE-1);
+    if(hashmap_group_match(&table->ctrl[base], HASHMAP_CTRL_EMPTY)) {
+        table->ctrl[index] = HASHMAP_CTRL_EMPTY;
     }
-
-    return pair;
+    else {
+        table->ctrl[index] = HASHMAP_CTRL_DELETED;
+        table->num_deleted++;
+    }
+    table->num_used--;
 }
-
-
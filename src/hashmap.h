@@ -1,101 +1,289 @@
 #ifndef HASHMAP_H
 #define HASHMAP_H
 
+// By default memory comes from the arena selected with 'arena_use()'
 #ifndef HASHMAP_MEMALLOC
-#define HASHMAP_MEMALLOC(size) malloc(size)
+#define HASHMAP_MEMALLOC(size) arena_memalloc(size, MEM_HASHMAP)
+#endif
+
+// Bytes moved to a new table when it grows.
+#ifndef HASHMAP_TRACK_COPY
+#define HASHMAP_TRACK_COPY(size) mem_track_copy(MEM_HASHMAP, size)
 #endif
 
 #ifndef HASHMAP_MEMFREE
-#define HASHMAP_MEMFREE(size) free(size)
+#define HASHMAP_MEMFREE(ptr) arena_memfree(ptr)
 #endif
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
 
+#include "arena.h"
+#include "trace.h"
 
-struct hashmap_pair_t {
-    bool  used;
-    int   key;
-    void* ptr;
- 
-    // If the memory size is 0 and 'used' is set to 'true'
-    // Then only a pointer was copied here.
-    //
-    // If the memory size is > 0 and 'used' is set to 'true'
-    // Then memory was allocated for the element.
-    size_t mem_size;
-};
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-struct hashmap_bucket_t {
-    struct hashmap_pair_t* pairs;
-    size_t                 pairs_mem_size;
-    size_t                 num_pairs;
 
-    // Points to "next" bucket which num_pairs > 0,
-    // Note: the elements will be in reverse order from how you added them.
-    struct hashmap_bucket_t* next;
-};
+// Open addressing hash table (swiss table style).
+//
+// Each slot has one control byte: empty, deleted or 7 bits of the key's hash.
+// Lookups compare control bytes of 16 slots at once and only check
+// the keys where the hash bits matched.
 
-struct hashmap_t {
-    size_t map_size;
-    size_t buckets_mem_size;
-    struct hashmap_bucket_t* buckets;
+#define HASHMAP_GROUP_SIZE 16
 
-    struct hashmap_bucket_t* buckets_link_tail;
-};
+// Table grows when used + deleted slots exceed this. (n / 8)
+#define HASHMAP_MAX_LOAD 7
 
-const char* hashmap_get_errmsg();
 
-struct hashmap_t create_hashmap(size_t initial_map_size);
-void             free_hashmap(struct hashmap_t* map);
+#define HASHMAP_CTRL_EMPTY   0x80
+#define HASHMAP_CTRL_DELETED 0xFE
+// Used slots have the low 7 bits of the hash (0x00 - 0x7F).
 
 
-bool hashmap_key_exists(struct hashmap_t* map, int key,
-        struct hashmap_bucket_t** bucket_out,            // Optional
-        size_t*                   bucket_pair_index_out  // Optional
-);     
+static inline uint64_t hashmap_hash_int(int key) {
+    uint64_t h = (uint32_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
+static inline uint8_t hashmap_h2(uint64_t hash) {
+    return hash & 0x7F;
+}
 
-uint64_t strtokey(const char* str);
+static inline size_t hashmap_first_group(size_t map_size, uint64_t hash) {
+    return (hash >> 7) & ((map_size / HASHMAP_GROUP_SIZE) - 1);
+}
 
 
-void hashmap_clear(struct hashmap_t* map);
+// Bit N is set if control byte N of the group is 'value'.
+static inline uint32_t hashmap_group_match(const uint8_t* group, uint8_t value) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < HASHMAP_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] == value) << i;
+    }
+    return mask;
+#endif
+}
 
-// Add existing pointer to hashmap.
-// 'ptr' is only copied (not memory where it points to).
-//
-// 'false' is returned if map contains the key same already or a memory error happened. 
-// 'true' is returned on success.
-bool hashmap_add(struct hashmap_t* map, int key, void* ptr);
+// Bit N is set if slot N of the group is empty or deleted.
+// Both have the high bit set.
+static inline uint32_t hashmap_group_match_free(const uint8_t* group) {
+#if defined(__SSE2__)
+    const __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < HASHMAP_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
 
-// Insert or replace existing pointer to hashmap.
-// 'ptr' is only copied (not memory where it points to).
-//
-// 'false' is returned if map doesnt contain the key or a memory error happened. 
-// 'true' is returned on success.
-bool hashmap_put(struct hashmap_t* map, int key, void* ptr);
+const char* hashmap_get_errmsg();
 
+// 64 bit hash of the whole string.
+uint64_t strtokey(const char* str, size_t len);
 
-// These functions behaviour is same as above but only differences are
-// that they allocate memory
-// and then copy 'size' number of bytes from 'data_ptr'.
+
+// Typed map, values are stored inline in the slots.
+//
+// HASHMAP_DEFINE(name, K, V) generates 'struct name' and:
+//   struct name create_##name(size_t initial_map_size)
+//   void        free_##name(struct name* map)
+//   void        name##_clear(struct name* map)
+//   V*          name##_get(struct name* map, K key)        NULL if not found.
+//   bool        name##_add(struct name* map, K key, V value) 'false' if the key exists or on memory error.
+//   bool        name##_put(struct name* map, K key, V value) Insert or replace.
+//   bool        name##_del(struct name* map, K key)
 //
-// Their memory is freed when:
-// 'hashmap_del()' function is called with the corresponding key.
-// or 'free_hashmap()' function is called.
-bool hashmap_add_new(struct hashmap_t* map, int key, void* data_ptr, size_t size);
-bool hashmap_put_new(struct hashmap_t* map, int key, void* data_ptr, size_t size);
+// K can be 'int' or 'struct hashmap_str_key'.
+// Keys and values are copied as is, string key memory must outlive the element.
+// Only the slot array is allocated (with HASHMAP_MEMALLOC), adding elements
+// allocates nothing unless the table grows.
+//
+// Pointers returned by 'get' are valid until the next add or put.
 
 
-// Delete element from hashmap.
-//
-// 'false' is returned if map doesnt contain the key or memory error happened.
-// 'true' is returned on success.
-bool hashmap_del(struct hashmap_t* map, int key);
+struct hashmap_str_key {
+    const char* str;
+    size_t      len;
+};
+
+static inline uint64_t hashmap_hash_str_key(struct hashmap_str_key key) {
+    return strtokey(key.str, key.len);
+}
+
+static inline bool hashmap_eq_int(int a, int b) {
+    return a == b;
+}
+
+static inline bool hashmap_eq_str_key(struct hashmap_str_key a, struct hashmap_str_key b) {
+    return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+
+#define HASHMAP_KEY_HASH(key)\
+    _Generic((key),\
+        int: hashmap_hash_int,\
+        struct hashmap_str_key: hashmap_hash_str_key\
+    )(key)
+
+#define HASHMAP_KEY_EQ(a, b)\
+    _Generic((a),\
+        int: hashmap_eq_int,\
+        struct hashmap_str_key: hashmap_eq_str_key\
+    )(a, b)
+
+
+// Storage shared by all typed maps.
+// Slot layout is not known here, but each slot starts with its 'uint64_t hash'.
+struct hashmap_table {
+    size_t map_size;
+    size_t num_used;
+    size_t num_deleted;
+
+    uint8_t* ctrl;
+    void*    slots;
+};
+
+bool   hashmap_table_init(struct hashmap_table* table, size_t initial_map_size, size_t slot_size);
+void   hashmap_table_free(struct hashmap_table* table);
+void   hashmap_table_clear(struct hashmap_table* table);
+
+// Makes room for one more element.
+bool   hashmap_table_reserve(struct hashmap_table* table, size_t slot_size);
+
+// Marks free slot used for 'hash' and returns its index.
+// 'hashmap_table_reserve()' must be called first.
+size_t hashmap_table_claim(struct hashmap_table* table, uint64_t hash);
+void   hashmap_table_release(struct hashmap_table* table, size_t index);
 
 
+#define HASHMAP_DEFINE(name, K, V)\
+\
+struct name##_slot {\
+    uint64_t hash; /* Must be first. */\
+    K        key;\
+    V        value;\
+};\
+\
+struct name {\
+    struct hashmap_table table;\
+};\
+\
+static inline struct name create_##name(size_t initial_map_size) {\
+    struct name map;\
+    hashmap_table_init(&map.table, initial_map_size, sizeof(struct name##_slot));\
+    return map;\
+}\
+\
+static inline void free_##name(struct name* map) {\
+    hashmap_table_free(&map->table);\
+}\
+\
+static inline void name##_clear(struct name* map) {\
+    hashmap_table_clear(&map->table);\
+}\
+\
+static inline bool name##_find(const struct name* map, K key, uint64_t hash, size_t* index_out) {\
+    const struct hashmap_table* table = &map->table;\
+    const struct name##_slot* slots = table->slots;\
+    if(table->map_size == 0) {\
+        return false;\
+    }\
+\
+    const uint8_t h2 = hashmap_h2(hash);\
+    const size_t group_mask = (table->map_size / HASHMAP_GROUP_SIZE) - 1;\
+\
+    size_t group_idx = hashmap_first_group(table->map_size, hash);\
+    for(size_t step = 1; step <= group_mask + 1; step++) {\
+        const size_t base = group_idx * HASHMAP_GROUP_SIZE;\
+        const uint8_t* group = &table->ctrl[base];\
+\
+        uint32_t match = hashmap_group_match(group, h2);\
+        while(match) {\
+            const size_t index = base + __builtin_ctz(match);\
+            if(slots[index].hash == hash && HASHMAP_KEY_EQ(slots[index].key, key)) {\
+                TRACE_COUNT(TRACE_HASHMAP_PROBES, step);\
+                *index_out = index;\
+                return true;\
+            }\
+            match &= match - 1;\
+        }\
+\
+        if(hashmap_group_match(group, HASHMAP_CTRL_EMPTY)) {\
+            TRACE_COUNT(TRACE_HASHMAP_PROBES, step);\
+            return false;\
+        }\
+\
+        group_idx = (group_idx + step) & group_mask;\
+    }\
+\
+    return false;\
+}\
+\
+static inline V* name##_get(struct name* map, K key) {\
+    size_t index = 0;\
+    if(!name##_find(map, key, HASHMAP_KEY_HASH(key), &index)) {\
+        return NULL;\
+    }\
+    return &((struct name##_slot*)map->table.slots)[index].value;\
+}\
+\
+static inline bool name##_insert(struct name* map, K key, uint64_t hash, V value) {\
+    if(!hashmap_table_reserve(&map->table, sizeof(struct name##_slot))) {\
+        return false;\
+    }\
+\
+    const size_t index = hashmap_table_claim(&map->table, hash);\
+    struct name##_slot* slot = &((struct name##_slot*)map->table.slots)[index];\
+    slot->hash = hash;\
+    slot->key = key;\
+    slot->value = value;\
+    return true;\
+}\
+\
+static inline bool name##_add(struct name* map, K key, V value) {\
+    const uint64_t hash = HASHMAP_KEY_HASH(key);\
+    size_t index = 0;\
+    if(name##_find(map, key, hash, &index)) {\
+        return false;\
+    }\
+    return name##_insert(map, key, hash, value);\
+}\
+\
+static inline bool name##_put(struct name* map, K key, V value) {\
+    const uint64_t hash = HASHMAP_KEY_HASH(key);\
+    size_t index = 0;\
+    if(name##_find(map, key, hash, &index)) {\
+        ((struct name##_slot*)map->table.slots)[index].value = value;\
+        return true;\
+    }\
+    return name##_insert(map, key, hash, value);\
+}\
+\
+static inline bool name##_del(struct name* map, K key) {\
+    size_t index = 0;\
+    if(!name##_find(map, key, HASHMAP_KEY_HASH(key), &index)) {\
+        return false;\
+    }\
+    hashmap_table_release(&map->table, index);\
+    return true;\
+}
 
-struct hashmap_pair_t* hashmap_get(struct hashmap_t* map, int key);
 
 
 
@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "incremental.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "binder.h"
+#include "arena.h"
+#include "error.h"
+#include "trace.h"
+#include "hashmap.h"
+
+
+// Tokens of one function, or what is left after the last function.
+struct cached_func {
+    size_t   start; // Token range in the input.
+    size_t   end;
+    uint64_t key;
+
+    // Code from the cache, NULL if it wasn't found.
+    const char* data;
+    size_t      size;
+
+    // If not found, token range after parsing.
+    size_t   parsed_start;
+    size_t   parsed_end;
+};
+
+struct cached_funcs {
+    struct cached_func* array;
+    size_t              count;
+    size_t              num_alloc;
+};
+
+// Names of the functions in the input, keys point to the source.
+HASHMAP_DEFINE(func_name_map, struct hashmap_str_key, bool)
+
+
+static struct cached_func* add_func(struct cached_funcs* funcs, size_t start, size_t end) {
+    if(funcs->count >= funcs->num_alloc) {
+        const size_t new_num_alloc = funcs->num_alloc ? funcs->num_alloc * 2 : 256;
+        struct cached_func* new_ptr = arena_memrealloc(funcs->array, new_num_alloc * sizeof *funcs->array, MEM_JOBS);
+        if(!new_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return NULL;
+        }
+        funcs->array = new_ptr;
+        funcs->num_alloc = new_num_alloc;
+    }
+
+    struct cached_func* func = &funcs->array[funcs->count++];
+    memset(func, 0, sizeof *func);
+    func->start = start;
+    func->end = end;
+    return func;
+}
+
+// Adds the name of the function whose "func" is at 'i', headers which
+// arent whole are left to the parser. Returns 'false' if the name was
+// added before or on memory error.
+static bool add_func_name(struct func_name_map* names, const struct token_array* tokens, size_t i, size_t end) {
+    if(i+4 >= end
+    || tokens->array[i+1].type != TOK_COLON
+    || tokens->array[i+3].type != TOK_DOT
+    || tokens->array[i+4].type != TOK_SYMBOL) {
+        return true;
+    }
+
+    const struct token* label_tok = &tokens->array[i+4];
+    const struct hashmap_str_key name = { TOKEN_TEXT(tokens, label_tok), label_tok->len };
+    return func_name_map_add(names, name, true);
+}
+
+// Splits the tokens (before parsing) after each "}" which closes a function.
+// Returns 'false' if they cant be split.
+static bool split_funcs(struct token_array* tokens, struct cached_funcs* funcs) {
+    size_t end = tokens->token_count;
+    if(end > 0 && tokens->array[end-1].type == TOK_EOF) {
+        end--;
+    }
+
+    // Cached functions are not parsed, so the parser cant see
+    // a name defined again in one of them.
+    struct func_name_map names = create_func_name_map(64);
+    if(!names.table.ctrl) {
+        PRINT_MEMERROR("create_func_name_map");
+        return false;
+    }
+
+    bool result = false;
+    size_t func_start = 0;
+    size_t depth = 0;
+
+    for(size_t i = 0; i < end; i++) {
+        switch(tokens->array[i].type) {
+            case TOK_OPEN_SCOPE:
+                depth++;
+                break;
+
+            case TOK_CLOSE_SCOPE:
+                if(depth == 0) {
+                    goto out; // Parser reports it.
+                }
+                depth--;
+                if(depth == 0) {
+                    if(!add_func(funcs, func_start, i+1)) {
+                        goto out;
+                    }
+                    func_start = i+1;
+                }
+                break;
+
+            case TOK_VAR:
+                if(depth == 0) {
+                    goto out;
+                }
+                break;
+
+            case TOK_FUNC:
+                if(!add_func_name(&names, tokens, i, end)) {
+                    goto out; // Parser reports a name defined again.
+                }
+                break;
+        }
+    }
+
+    if(func_start < end && !add_func(funcs, func_start, end)) {
+        goto out;
+    }
+    result = true;
+
+out:
+    free_func_name_map(&names);
+    return result;
+}
+
+// Parsing removes tokens, find the functions again from the parsed tokens.
+// They are in the same order and each closed one ends with a "}" at depth 0.
+static void find_parsed_funcs(struct token_array* parsed, struct cached_funcs* funcs) {
+    size_t func_index = 0;
+    size_t func_start = 0;
+    size_t depth = 0;
+
+    for(size_t i = 0; i < parsed->token_count; i++) {
+        if(parsed->array[i].type == TOK_OPEN_SCOPE) {
+            depth++;
+        }
+        else
+        if(parsed->array[i].type == TOK_CLOSE_SCOPE && --depth == 0) {
+            while(func_index < funcs->count && funcs->array[func_index].data) {
+                func_index++;
+            }
+            if(func_index >= funcs->count) {
+                break;
+            }
+            funcs->array[func_index].parsed_start = func_start;
+            funcs->array[func_index].parsed_end = i+1;
+            func_index++;
+            func_start = i+1;
+        }
+    }
+
+    // Only the last one can be left open.
+    for(; func_index < funcs->count; func_index++) {
+        if(!funcs->array[func_index].data) {
+            funcs->array[func_index].parsed_start = func_start;
+            funcs->array[func_index].parsed_end = parsed->token_count;
+        }
+    }
+}
+
+static bool gen_funcs(struct token_array* parsed, struct cached_funcs* funcs,
+        const char* output_file, enum output_format format, struct cache* cache) {
+    struct code_gen cg;
+    if(!asm_code_gen_begin(&cg, output_file, format)) {
+        return false;
+    }
+
+    // Each function is generated as a part so it's code can be saved alone.
+    struct arena part_arena;
+    create_arena(&part_arena, "cached part");
+
+    struct outbuf entry;
+    create_outbuf(&entry, -1);
+
+    bool result = true;
+    for(size_t i = 0; i < funcs->count && result; i++) {
+        struct cached_func* func = &funcs->array[i];
+
+        if(func->data) {
+            result = cg.emit->part_read(&cg, func->data, func->size);
+            continue;
+        }
+
+        struct code_gen part;
+        struct arena* prev_arena = arena_use(&part_arena);
+        result = asm_code_gen_part_begin(&part, &cg);
+        if(result) {
+            asm_code_gen_part_tokens(&part, parsed, func->parsed_start, func->parsed_end);
+            if(cg.emit->part_write(&part, &entry)) {
+                cache_put(cache, func->key, &entry);
+            }
+            outbuf_clear(&entry);
+        }
+        arena_use(prev_arena);
+
+        if(result) {
+            result = cg.emit->part_join(&cg, &part);
+            asm_code_gen_part_end(&part);
+        }
+        arena_reset(&part_arena);
+    }
+
+    free_outbuf(&entry);
+    free_arena(&part_arena);
+
+    if(!result) {
+        asm_code_gen_abort(&cg);
+        return false;
+    }
+    return asm_code_gen_end(&cg);
+}
+
+static bool compile_uncached(struct token_array* tokens, const char* output_file,
+        enum output_format format, int num_threads) {
+    if(!parse_tokens(tokens) || !bind_tokens(tokens)) {
+        return false;
+    }
+    arena_reset(get_phase_arena(ARENA_PARSE));
+    return asm_code_gen(tokens, output_file, format, num_threads);
+}
+
+bool compile_cached(const char* input_file, const char* output_file,
+        enum output_format format, int num_threads, struct cache* cache) {
+    bool result = false;
+    struct arena* prev_arena = arena_use_phase(ARENA_CODEGEN);
+
+    struct token_array tokens;
+    if(!tokenize(input_file, &tokens, num_threads)) {
+        goto out;
+    }
+
+    struct cached_funcs funcs = { NULL, 0, 0 };
+    if(!split_funcs(&tokens, &funcs)) {
+        result = compile_uncached(&tokens, output_file, format, num_threads);
+        goto free_and_out;
+    }
+
+    // Functions not in the cache are parsed together.
+    struct token_array parsed;
+    create_token_subarray(&parsed, &tokens);
+
+    // Object files and executables have the same code for functions,
+    // code generation options change it.
+    uint32_t salt = (format == OUTPUT_ASM) ? OUTPUT_ASM : OUTPUT_ELF_OBJ;
+    salt |= code_gen_options.regalloc << 8;
+    salt |= code_gen_options.dump_vars << 9;
+    salt |= code_gen_options.passes << 10;
+    salt |= code_gen_options.peephole << 14;
+    TRACE_BEGIN("cache lookup");
+
+    for(size_t i = 0; i < funcs.count; i++) {
+        struct cached_func* func = &funcs.array[i];
+        func->key = cache_key(cache, &tokens, func->start, func->end, salt);
+
+        if(!cache_get(cache, func->key, &func->data, &func->size)) {
+            if(!token_array_append(&parsed, &tokens.array[func->start], func->end - func->start)) {
+                goto free_parsed_and_out;
+            }
+        }
+    }
+
+    TRACE_END("cache lookup");
+
+    const struct token eof_tok = { .type = TOK_EOF, .offset = tokens.source_size };
+    if(!token_array_append(&parsed, &eof_tok, 1)) {
+        goto free_parsed_and_out;
+    }
+
+    if(!parse_tokens(&parsed) || !bind_tokens(&parsed)) {
+        goto free_parsed_and_out;
+    }
+    arena_reset(get_phase_arena(ARENA_PARSE));
+
+    find_parsed_funcs(&parsed, &funcs);
+    TRACE_BEGIN("codegen");
+    result = gen_funcs(&parsed, &funcs, output_file, format, cache);
+    TRACE_END("codegen");
+
+free_parsed_and_out:
+    free_token_subarray(&parsed);
+free_and_out:
+    free_token_array(&tokens);
+out:
+    arena_use(prev_arena);
+    return result;
+}
@@ -0,0 +1,21 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+
+#include "asm_code_gen.h"
+#include "cache.h"
+
+
+// Compiles with a code cache. The tokens are split into functions
+// and each function is looked up from the cache by the hash of it's tokens.
+// Only the functions which are not found are parsed and generated,
+// the code of the rest is copied from the cache. Output is the same as without the cache.
+//
+// Variables declared outside functions are visible to the following functions,
+// if there are any the whole input is compiled without the cache.
+bool compile_cached(const char* input_file, const char* output_file,
+        enum output_format format, int num_threads, struct cache* cache);
+
+
+#endif
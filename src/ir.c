@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "ir.h"
+#include "arena.h"
+#include "error.h"
+
+
+void create_ir_func(struct ir_func* func) {
+    memset(func, 0, sizeof *func);
+}
+
+void free_ir_func(struct ir_func* func) {
+    arena_memfree(func->scratch);
+    arena_memfree(func->slots);
+    arena_memfree(func->instrs);
+    memset(func, 0, sizeof *func);
+}
+
+static bool ir_slots_memcheck(struct ir_func* func, size_t num_slots) {
+    if(num_slots <= func->slots_num_alloc) {
+        return true;
+    }
+
+    struct slot* slots = arena_memrealloc(func->slots, num_slots * sizeof *slots, MEM_IR);
+    if(!slots) {
+        PRINT_MEMERROR("arena_memrealloc");
+        return false;
+    }
+    func->slots = slots;
+
+    uint32_t* scratch = arena_memrealloc(func->scratch,
+            num_slots * IR_SCRATCH_PER_SLOT * sizeof *scratch, MEM_IR);
+    if(!scratch) {
+        PRINT_MEMERROR("arena_memrealloc");
+        return false;
+    }
+    func->scratch = scratch;
+    func->slots_num_alloc = num_slots;
+    return true;
+}
+
+static struct ir_instr* add_instr(struct ir_func* func) {
+    if(func->instr_count >= func->instrs_num_alloc) {
+        const size_t num_alloc = func->instrs_num_alloc ? func->instrs_num_alloc * 2 : 64;
+
+        struct ir_instr* tmp_ptr = arena_memrealloc(func->instrs, num_alloc * sizeof *tmp_ptr, MEM_IR);
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return NULL;
+        }
+        func->instrs = tmp_ptr;
+        func->instrs_num_alloc = num_alloc;
+    }
+    return &func->instrs[func->instr_count++];
+}
+
+// "mov @x <- 5" and "add @x <- 5", other forms are not generated yet.
+static bool lower_assign(struct ir_func* func, const struct token* tok) {
+    const struct token* lhs_tok = tok + 1;
+    const struct token* rhs_tok = tok + 2;
+
+    if(lhs_tok->type != PTOK_VAR || rhs_tok->type != PTOK_LIT_I32) {
+        return true;
+    }
+
+    struct ir_instr* instr = add_instr(func);
+    if(!instr) {
+        return false;
+    }
+
+    const struct ir_operand value = { .kind = IR_CONST, .value = rhs_tok->data.lit_i32.value };
+    instr->dst = lhs_tok->data.var.slot;
+
+    if(tok->type == TOK_MOV) {
+        instr->op = IR_MOV;
+        instr->a = value;
+    }
+    else {
+        instr->op = IR_ADD;
+        instr->a = (struct ir_operand){ .kind = IR_VAR, .slot = instr->dst };
+        instr->b = value;
+    }
+    return true;
+}
+
+bool ir_build_func(struct ir_func* func, const struct token_array* tokens, size_t start, size_t end,
+        bool dump_vars, size_t* close) {
+    const struct frame_table* frames = &tokens->frames;
+    const struct frame* frame = &frames->frames[tokens->array[start].data.scope.frame];
+
+    func->instr_count = 0;
+    func->num_slots = 0;
+    func->frame_size = frame->size;
+    func->live_out = dump_vars;
+
+    if(!ir_slots_memcheck(func, frame->num_slots)) {
+        return false;
+    }
+    memcpy(func->slots, &frames->slots[frame->first_slot], frame->num_slots * sizeof *func->slots);
+    func->num_slots = frame->num_slots;
+
+    if(dump_vars) {
+        for(uint32_t i = 0; i < func->num_slots; i++) {
+            struct ir_instr* instr = add_instr(func);
+            if(!instr) {
+                return false;
+            }
+            instr->op = IR_MOV;
+            instr->dst = i;
+            instr->a = (struct ir_operand){ .kind = IR_CONST, .value = 0 };
+        }
+    }
+
+    size_t depth = 0;
+    size_t i = start;
+    for(; i < end; i++) {
+        const struct token* tok = &tokens->array[i];
+
+        if(tok->type == TOK_EOF) {
+            break;
+        }
+
+        switch(tok->type) {
+            case TOK_OPEN_SCOPE:
+                depth++;
+                break;
+
+            case TOK_CLOSE_SCOPE:
+                if(--depth == 0) {
+                    *close = i;
+                    return true;
+                }
+                break;
+
+            case TOK_MOV:
+            case TOK_ADD:
+                if(i + 2 < end && !lower_assign(func, tok)) {
+                    return false;
+                }
+                break;
+        }
+    }
+
+    *close = i;
+    return true;
+}
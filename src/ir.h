@@ -0,0 +1,81 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "token.h"
+
+
+// Three-address code of one function, built from bound tokens.
+//
+//   mov @x <- 5   ->  x = 5
+//   add @x <- 5   ->  x = x + 5
+//
+// The language has no branches, so a function is one basic block.
+// Variables are the slots of the function's frame. The function has its own
+// copy of the slots so passes can remove variables without changing the frame table.
+
+enum ir_op {
+    IR_NOP, // Removed by a pass.
+    IR_MOV, // dst = a
+    IR_ADD  // dst = a + b
+};
+
+enum ir_operand_kind {
+    IR_CONST,
+    IR_VAR
+};
+
+struct ir_operand {
+    uint8_t kind; // enum ir_operand_kind
+    union {
+        int32_t  value; // IR_CONST
+        uint32_t slot;  // IR_VAR
+    };
+};
+
+struct ir_instr {
+    uint8_t           op;  // enum ir_op
+    uint32_t          dst; // Slot which is written.
+    struct ir_operand a;
+    struct ir_operand b;   // Only for IR_ADD
+};
+
+struct ir_func {
+    struct ir_instr* instrs;
+    size_t           instr_count;
+    size_t           instrs_num_alloc;
+
+    struct slot* slots;
+    uint32_t     num_slots;
+    uint32_t     frame_size;       // Bytes below rbp.
+    size_t       slots_num_alloc;  // Also of 'scratch'
+
+    // Variables are read after the function returns ('--dump-vars').
+    bool live_out;
+
+    // Per slot memory for the passes, 'IR_SCRATCH_PER_SLOT' for each slot.
+    uint32_t* scratch;
+};
+
+#define IR_SCRATCH_PER_SLOT 2
+
+
+// Memory comes from the arena selected with 'arena_use()'
+// and is kept for the next function.
+void create_ir_func(struct ir_func* func);
+void free_ir_func(struct ir_func* func);
+
+// Builds the function whose "{" is at 'start' from tokens up to its "}".
+// '*close' is set to the index of the "}", or to where the tokens ended
+// ('end' or TOK_EOF) if the function isnt closed.
+// With 'dump_vars' the variables start from 0 and are live when the function returns.
+// Returns 'false' on memory error.
+bool ir_build_func(struct ir_func* func, const struct token_array* tokens, size_t start, size_t end,
+        bool dump_vars, size_t* close);
+
+
+
+#endif
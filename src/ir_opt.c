@@ -0,0 +1,257 @@
+#include <string.h>
+
+#include "ir_opt.h"
+#include "binder.h"
+#include "error.h"
+
+
+#define NO_SLOT UINT32_MAX
+
+
+static const char* pass_names[IR_NUM_PASSES] = {
+    [IR_PASS_CONST_PROP]  = "const-prop",
+    [IR_PASS_DEAD_STORES] = "dead-stores",
+    [IR_PASS_UNUSED_VARS] = "unused-vars"
+};
+
+static struct ir_pass_stats pass_stats[IR_NUM_PASSES];
+
+static size_t instrs_before = 0;
+static size_t instrs_after = 0;
+static size_t vars_before = 0;
+static size_t vars_after = 0;
+
+
+#define ADD(var, n) __atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED)
+#define LOAD(var)   __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+// Functions are optimized on many threads, each adds its counts once.
+static void add_stats(enum ir_pass pass, const struct ir_pass_stats* stats) {
+    struct ir_pass_stats* total = &pass_stats[pass];
+    ADD(total->funcs, 1);
+    if(stats->operands) {
+        ADD(total->operands, stats->operands);
+    }
+    if(stats->folded) {
+        ADD(total->folded, stats->folded);
+    }
+    if(stats->removed) {
+        ADD(total->removed, stats->removed);
+    }
+}
+
+static inline bool instr_reads(const struct ir_instr* instr, const struct ir_operand** a,
+        const struct ir_operand** b) {
+    *a = (instr->a.kind == IR_VAR) ? &instr->a : NULL;
+    *b = (instr->op == IR_ADD && instr->b.kind == IR_VAR) ? &instr->b : NULL;
+    return *a || *b;
+}
+
+
+static void const_prop(struct ir_func* func, struct ir_pass_stats* stats) {
+    uint32_t* known = func->scratch;
+    int32_t* values = (int32_t*)(known + func->num_slots);
+
+    memset(known, 0, func->num_slots * sizeof *known);
+
+    for(size_t i = 0; i < func->instr_count; i++) {
+        struct ir_instr* instr = &func->instrs[i];
+        if(instr->op == IR_NOP) {
+            continue;
+        }
+
+        struct ir_operand* operands[2] = { &instr->a, (instr->op == IR_ADD) ? &instr->b : NULL };
+        for(size_t j = 0; j < 2; j++) {
+            struct ir_operand* op = operands[j];
+            if(op && op->kind == IR_VAR && known[op->slot]) {
+                *op = (struct ir_operand){ .kind = IR_CONST, .value = values[op->slot] };
+                stats->operands++;
+            }
+        }
+
+        // Wraps around like the add instruction.
+        if(instr->op == IR_ADD && instr->a.kind == IR_CONST && instr->b.kind == IR_CONST) {
+            instr->op = IR_MOV;
+            instr->a.value = (int32_t)((uint32_t)instr->a.value + (uint32_t)instr->b.value);
+            stats->folded++;
+        }
+
+        known[instr->dst] = (instr->op == IR_MOV && instr->a.kind == IR_CONST);
+        if(known[instr->dst]) {
+            values[instr->dst] = instr->a.value;
+        }
+    }
+}
+
+// Backwards, a write is dead if the variable isnt read before it's written again.
+static void dead_stores(struct ir_func* func, struct ir_pass_stats* stats) {
+    uint32_t* live = func->scratch;
+
+    for(uint32_t i = 0; i < func->num_slots; i++) {
+        live[i] = func->live_out;
+    }
+
+    for(size_t i = func->instr_count; i-- > 0;) {
+        struct ir_instr* instr = &func->instrs[i];
+        if(instr->op == IR_NOP) {
+            continue;
+        }
+
+        if(!live[instr->dst]) {
+            instr->op = IR_NOP;
+            stats->removed++;
+            continue;
+        }
+
+        live[instr->dst] = false;
+        const struct ir_operand* a;
+        const struct ir_operand* b;
+        if(instr_reads(instr, &a, &b)) {
+            if(a) {
+                live[a->slot] = true;
+            }
+            if(b) {
+                live[b->slot] = true;
+            }
+        }
+    }
+}
+
+// Used variables keep their order, offsets are given like 'bind_tokens()' does.
+static void unused_vars(struct ir_func* func, struct ir_pass_stats* stats) {
+    uint32_t* new_slot = func->scratch;
+
+    if(func->live_out) {
+        return; // All are read after the return.
+    }
+
+    for(uint32_t i = 0; i < func->num_slots; i++) {
+        new_slot[i] = NO_SLOT;
+    }
+    for(size_t i = 0; i < func->instr_count; i++) {
+        const struct ir_instr* instr = &func->instrs[i];
+        if(instr->op == IR_NOP) {
+            continue;
+        }
+        new_slot[instr->dst] = 0;
+
+        const struct ir_operand* a;
+        const struct ir_operand* b;
+        if(instr_reads(instr, &a, &b)) {
+            if(a) {
+                new_slot[a->slot] = 0;
+            }
+            if(b) {
+                new_slot[b->slot] = 0;
+            }
+        }
+    }
+
+    uint32_t count = 0;
+    uint32_t size = 0;
+    for(uint32_t i = 0; i < func->num_slots; i++) {
+        if(new_slot[i] == NO_SLOT) {
+            continue;
+        }
+        new_slot[i] = count;
+        func->slots[count] = func->slots[i];
+        size += var_type_size(func->slots[count].type);
+        func->slots[count].rbp_off = size;
+        count++;
+    }
+
+    if(count == func->num_slots) {
+        return;
+    }
+    stats->removed += func->num_slots - count;
+    func->num_slots = count;
+    func->frame_size = size;
+
+    for(size_t i = 0; i < func->instr_count; i++) {
+        struct ir_instr* instr = &func->instrs[i];
+        if(instr->op == IR_NOP) {
+            continue;
+        }
+        instr->dst = new_slot[instr->dst];
+        if(instr->a.kind == IR_VAR) {
+            instr->a.slot = new_slot[instr->a.slot];
+        }
+        if(instr->op == IR_ADD && instr->b.kind == IR_VAR) {
+            instr->b.slot = new_slot[instr->b.slot];
+        }
+    }
+}
+
+typedef void (*ir_pass_func)(struct ir_func* func, struct ir_pass_stats* stats);
+
+static const ir_pass_func pass_funcs[IR_NUM_PASSES] = {
+    [IR_PASS_CONST_PROP]  = const_prop,
+    [IR_PASS_DEAD_STORES] = dead_stores,
+    [IR_PASS_UNUSED_VARS] = unused_vars
+};
+
+void ir_optimize(struct ir_func* func, uint32_t passes) {
+    if(!passes) {
+        return;
+    }
+
+    ADD(instrs_before, func->instr_count);
+    ADD(vars_before, func->num_slots);
+
+    for(size_t i = 0; i < IR_NUM_PASSES; i++) {
+        if(passes & IR_PASS_BIT(i)) {
+            struct ir_pass_stats stats = { 0 };
+            pass_funcs[i](func, &stats);
+            add_stats(i, &stats);
+        }
+    }
+
+    size_t count = 0;
+    for(size_t i = 0; i < func->instr_count; i++) {
+        if(func->instrs[i].op != IR_NOP) {
+            func->instrs[count++] = func->instrs[i];
+        }
+    }
+    func->instr_count = count;
+
+    ADD(instrs_after, func->instr_count);
+    ADD(vars_after, func->num_slots);
+}
+
+
+void ir_get_pass_stats(enum ir_pass pass, struct ir_pass_stats* stats) {
+    stats->funcs = LOAD(pass_stats[pass].funcs);
+    stats->operands = LOAD(pass_stats[pass].operands);
+    stats->folded = LOAD(pass_stats[pass].folded);
+    stats->removed = LOAD(pass_stats[pass].removed);
+}
+
+void ir_reset_stats() {
+    memset(pass_stats, 0, sizeof pass_stats);
+    instrs_before = 0;
+    instrs_after = 0;
+    vars_before = 0;
+    vars_after = 0;
+}
+
+void ir_print_report(uint32_t passes) {
+    errprintf("%-16s %10s %10s %10s %10s\n",
+            "Optimizations", "functions", "operands", "folded", "removed");
+
+    for(size_t i = 0; i < IR_NUM_PASSES; i++) {
+        if(!(passes & IR_PASS_BIT(i))) {
+            errprintf("  %-14s %10s\n", pass_names[i], "off");
+            continue;
+        }
+
+        struct ir_pass_stats stats;
+        ir_get_pass_stats(i, &stats);
+        errprintf("  %-14s %10zu %10zu %10zu %10zu\n",
+                pass_names[i], stats.funcs, stats.operands, stats.folded, stats.removed);
+    }
+
+    if(passes) {
+        errprintf("Instructions: %zu -> %zu\n", LOAD(instrs_before), LOAD(instrs_after));
+        errprintf("Variables:    %zu -> %zu\n", LOAD(vars_before), LOAD(vars_after));
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef IR_OPT_H
+#define IR_OPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+
+// Optimization passes over the IR of one function, run in this order.
+// Each pass rewrites the function in place, removed instructions are
+// dropped at the end.
+enum ir_pass {
+    IR_PASS_CONST_PROP,  // Uses of variables with a known value read the constant,
+                         // additions of constants are folded.
+    IR_PASS_DEAD_STORES, // Writes which are not read before the next write or the return.
+    IR_PASS_UNUSED_VARS, // Variables no instruction uses, the frame is laid out again.
+
+    IR_NUM_PASSES
+};
+
+#define IR_PASS_BIT(pass) (1u << (pass))
+
+#define IR_PASSES_O0 0u
+#define IR_PASSES_O1 (IR_PASS_BIT(IR_PASS_CONST_PROP) | IR_PASS_BIT(IR_PASS_DEAD_STORES))
+#define IR_PASSES_O2 ((1u << IR_NUM_PASSES) - 1)
+
+struct ir_pass_stats {
+    size_t funcs;    // Functions the pass ran on.
+    size_t operands; // Operands replaced.
+    size_t folded;   // Instructions turned into moves of a constant.
+    size_t removed;  // Instructions, or variables for IR_PASS_UNUSED_VARS
+};
+
+
+// 'passes' has IR_PASS_BIT() of each pass to run.
+void ir_optimize(struct ir_func* func, uint32_t passes);
+
+// Statistics for --opt-report, added up over all functions of all threads.
+void ir_get_pass_stats(enum ir_pass pass, struct ir_pass_stats* stats);
+void ir_reset_stats();
+void ir_print_report(uint32_t passes);
+
+
+
+#endif
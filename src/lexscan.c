@@ -0,0 +1,111 @@
+#include <stddef.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "lexscan.h"
+#include "common.h"
+
+
+// Token characters dont require space to be in between them.
+// For example: "600, i32" and "600,i32"  are bot valid.
+static const char TOKEN_CHAR[] = {
+    '{', '}', '(', ')', ':', ',', '.', '@'
+};
+
+
+bool is_token_char(char ch) {
+    for(size_t i = 0; i < ARRAY_LEN(TOKEN_CHAR); i++) {
+        if(ch == TOKEN_CHAR[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if !defined(__x86_64__)
+
+static void lex_scan_scalar(const char* data, struct lex_masks* masks) {
+    masks->newline = 0;
+    masks->space = 0;
+    masks->token_char = 0;
+
+    for(size_t i = 0; i < LEXSCAN_BLOCK_SIZE; i++) {
+        const uint64_t bit = (uint64_t)1 << i;
+        if(data[i] == '\n') {
+            masks->newline |= bit;
+        }
+        else
+        if(data[i] == ' ') {
+            masks->space |= bit;
+        }
+        else
+        if(is_token_char(data[i])) {
+            masks->token_char |= bit;
+        }
+    }
+}
+
+#else
+
+static void lex_scan_sse2(const char* data, struct lex_masks* masks) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i space = _mm_set1_epi8(' ');
+
+    masks->newline = 0;
+    masks->space = 0;
+    masks->token_char = 0;
+
+    for(size_t i = 0; i < LEXSCAN_BLOCK_SIZE; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+
+        __m128i tc = _mm_setzero_si128();
+        for(size_t j = 0; j < ARRAY_LEN(TOKEN_CHAR); j++) {
+            tc = _mm_or_si128(tc, _mm_cmpeq_epi8(v, _mm_set1_epi8(TOKEN_CHAR[j])));
+        }
+
+        masks->newline |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << i;
+        masks->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, space)) << i;
+        masks->token_char |= (uint64_t)(uint16_t)_mm_movemask_epi8(tc) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void lex_scan_avx2(const char* data, struct lex_masks* masks) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i space = _mm256_set1_epi8(' ');
+
+    masks->newline = 0;
+    masks->space = 0;
+    masks->token_char = 0;
+
+    for(size_t i = 0; i < LEXSCAN_BLOCK_SIZE; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+
+        __m256i tc = _mm256_setzero_si256();
+        for(size_t j = 0; j < ARRAY_LEN(TOKEN_CHAR); j++) {
+            tc = _mm256_or_si256(tc, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(TOKEN_CHAR[j])));
+        }
+
+        masks->newline |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)) << i;
+        masks->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, space)) << i;
+        masks->token_char |= (uint64_t)(uint32_t)_mm256_movemask_epi8(tc) << i;
+    }
+}
+
+#endif
+
+
+lex_scan_func get_lex_scan_func() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return lex_scan_avx2;
+    }
+    return lex_scan_sse2;
+#else
+    return lex_scan_scalar;
+#endif
+}
+
@@ -0,0 +1,29 @@
+#ifndef LEXSCAN_H
+#define LEXSCAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define LEXSCAN_BLOCK_SIZE 64
+
+
+// Bit N of the mask is set if byte N of the block is that class.
+// Everything else is part of a symbol.
+struct lex_masks {
+    uint64_t newline;
+    uint64_t space;
+    uint64_t token_char;
+};
+
+// Classifies LEXSCAN_BLOCK_SIZE bytes from 'data'.
+typedef void (*lex_scan_func)(const char* data, struct lex_masks* masks);
+
+// Picks the fastest implementation for this cpu.
+// SSE2 is the baseline on x86_64, AVX2 is used if available.
+lex_scan_func get_lex_scan_func();
+
+bool is_token_char(char ch);
+
+
+#endif
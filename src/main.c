@@ -1,47 +1,324 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "tokenizer.h"
 #include "parser.h"
+#include "binder.h"
 #include "asm_code_gen.h"
+#include "stream.h"
+#include "driver.h"
+#include "incremental.h"
+#include "server.h"
+#include "trace.h"
+#include "arena.h"
+#include "memprof.h"
 
 
 
 void print_help(char** argv) {
     printf(
-            "%s [input file] [output file]\n"
+            "%s [options] [input file] [output file]\n"
+            "%s [options] --batch [input files...]\n"
+            "%s [options] --manifest [file]\n"
+            "%s --server <socket>\n"
+            "%s --connect <socket> [arguments...]\n"
             "\n"
             "'-' as output file will write results to stdout.\n"
-            ,argv[0]);
+            "\n"
+            "Options:\n"
+            "  -f <format>   Output format:\n"
+            "                  asm  Nasm source (default)\n"
+            "                  obj  ELF64 relocatable object\n"
+            "                  exe  ELF64 static executable\n"
+            "  -j <threads>  Number of threads for tokenizing and generating code for\n"
+            "                large inputs, or compiling files with --batch and --manifest.\n"
+            "                0 uses all cpus. (default 1)\n"
+            "  --stream      Tokenize, parse and generate code one function at a time.\n"
+            "                Memory use depends on the largest function, not the input size.\n"
+            "                Tokens are not printed.\n"
+            "  --batch       Compile all input files. Outputs are named after the inputs\n"
+            "                with \".hi_asm\" replaced by \".s\", \".o\" or nothing for executables.\n"
+            "  --manifest <file>\n"
+            "                Compile the files listed in 'file', one \"<input> <output>\" per line.\n"
+            "                With --batch and --manifest tokens are not printed and\n"
+            "                diagnostics go to stderr in the order the files were given.\n"
+            "  --cache <dir> Keep the generated code of each function in 'dir' and only parse\n"
+            "                and generate functions which changed since the last compile.\n"
+            "                Tokens are not printed. Not used with --stream, --batch or --manifest.\n"
+            "  --cache-size <MiB>\n"
+            "                Least recently used entries are removed when the cache\n"
+            "                grows larger than this. (default 256)\n"
+            "  --cache-stats Print cache hits, misses and sizes to stderr.\n"
+            "  --time-report Print wall and cpu time of each phase, the slowest functions\n"
+            "                and counters (tokens, symbols, hashmap probes, bytes, syscalls,\n"
+            "                spilled variables) to stderr.\n"
+            "  --trace=<file>\n"
+            "                Write the same as Chrome trace events, open it in\n"
+            "                chrome://tracing or Perfetto.\n"
+            "  --mem-report  Print allocations, bytes, peak live bytes and bytes copied\n"
+            "                by reallocs of each subsystem to stderr.\n"
+            "  -O0, -O1, -O2 Optimization passes to run on the IR of each function:\n"
+            "                  -O0  none, and no peephole rules\n"
+            "                  -O1  constant propagation, dead store elimination (default)\n"
+            "                  -O2  -O1 and unused variable removal\n"
+            "  --opt-report  Print what each optimization pass and peephole rule\n"
+            "                changed to stderr.\n"
+            "  --no-peephole Emit the selected instructions without the peephole rules.\n"
+            "  --no-regalloc Keep all variables in the stack instead of registers.\n"
+            "  --dump-vars   Functions write the final values of their variables\n"
+            "                to stdout before returning, as 32-bit integers in\n"
+            "                the order of their stack slots. For testing codegen.\n"
+            "\n"
+            "  --server <socket>\n"
+            "                Stay running and compile requests from clients connecting\n"
+            "                to the Unix socket. Stops on SIGINT or SIGTERM.\n"
+            "  --connect <socket>\n"
+            "                Have the server on 'socket' compile with the rest of the\n"
+            "                arguments, with this process' working directory, stdin,\n"
+            "                stdout and stderr. Compiles here if no server is running.\n"
+            "                '-' as input file reads the source from stdin.\n"
+            ,argv[0], argv[0], argv[0], argv[0], argv[0]);
 }
 
-int main(int argc, char** argv) {
+bool parse_output_format(const char* str, enum output_format* format) {
+    if(strcmp(str, "asm") == 0) {
+        *format = OUTPUT_ASM;
+    }
+    else
+    if(strcmp(str, "obj") == 0) {
+        *format = OUTPUT_ELF_OBJ;
+    }
+    else
+    if(strcmp(str, "exe") == 0) {
+        *format = OUTPUT_ELF_EXEC;
+    }
+    else {
+        fprintf(stderr, "Unknown output format \"%s\"\n", str);
+        return false;
+    }
+    return true;
+}
+
+// Compiles with the options in 'argv'. Returns the exit code.
+static int compile_main(int argc, char** argv) {
     int exit_code = 0;
-    
-    if(argc != 3) {
+
+    enum output_format format = OUTPUT_ASM;
+    int num_threads = 1;
+    bool streaming = false;
+    bool batch = false;
+    const char* manifest_file = NULL;
+    const char* cache_dir = NULL;
+    size_t cache_max_size = CACHE_DEFAULT_MAX_SIZE;
+    bool cache_stats = false;
+    bool time_report = false;
+    const char* trace_file = NULL;
+    bool tracing = false;
+    bool mem_report = false;
+    bool opt_report = false;
+    bool peephole = true;
+    const char* input_file = NULL;
+    const char* output_file = NULL;
+
+    // Counts of this compile only, when running as a server.
+    mem_reset_stats();
+    ir_reset_stats();
+    peephole_reset_stats();
+    code_gen_options = CODE_GEN_DEFAULT_OPTIONS;
+
+    // Positional arguments.
+    const char** input_files = mem_calloc(MEM_OTHER, argc, sizeof *input_files);
+    size_t num_input_files = 0;
+    if(!input_files) {
+        exit_code = 1;
+        goto out;
+    }
+
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if(strcmp(arg, "-f") == 0) {
+            if((i+1 >= argc) || !parse_output_format(argv[++i], &format)) {
+                print_help(argv);
+                exit_code = 1;
+                goto out;
+            }
+        }
+        else
+        if(strcmp(arg, "--stream") == 0) {
+            streaming = true;
+        }
+        else
+        if(strcmp(arg, "--batch") == 0) {
+            batch = true;
+        }
+        else
+        if(strcmp(arg, "--manifest") == 0) {
+            if(i+1 >= argc) {
+                print_help(argv);
+                exit_code = 1;
+                goto out;
+            }
+            manifest_file = argv[++i];
+        }
+        else
+        if(strcmp(arg, "--cache") == 0) {
+            if(i+1 >= argc) {
+                print_help(argv);
+                exit_code = 1;
+                goto out;
+            }
+            cache_dir = argv[++i];
+        }
+        else
+        if(strcmp(arg, "--cache-size") == 0) {
+            if(i+1 >= argc) {
+                print_help(argv);
+                exit_code = 1;
+                goto out;
+            }
+            cache_max_size = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else
+        if(strcmp(arg, "--cache-stats") == 0) {
+            cache_stats = true;
+        }
+        else
+        if(strcmp(arg, "--time-report") == 0) {
+            time_report = true;
+        }
+        else
+        if(strncmp(arg, "--trace=", 8) == 0 && arg[8] != '\0') {
+            trace_file = arg + 8;
+        }
+        else
+        if(strcmp(arg, "--mem-report") == 0) {
+            mem_report = true;
+        }
+        else
+        if(strcmp(arg, "-O0") == 0) {
+            code_gen_options.passes = IR_PASSES_O0;
+        }
+        else
+        if(strcmp(arg, "-O1") == 0) {
+            code_gen_options.passes = IR_PASSES_O1;
+        }
+        else
+        if(strcmp(arg, "-O2") == 0) {
+            code_gen_options.passes = IR_PASSES_O2;
+        }
+        else
+        if(strcmp(arg, "--opt-report") == 0) {
+            opt_report = true;
+        }
+        else
+        if(strcmp(arg, "--no-peephole") == 0) {
+            peephole = false;
+        }
+        else
+        if(strcmp(arg, "--no-regalloc") == 0) {
+            code_gen_options.regalloc = false;
+        }
+        else
+        if(strcmp(arg, "--dump-vars") == 0) {
+            code_gen_options.dump_vars = true;
+        }
+        else
+        if(strcmp(arg, "-j") == 0) {
+            if(i+1 >= argc) {
+                print_help(argv);
+                exit_code = 1;
+                goto out;
+            }
+            num_threads = atoi(argv[++i]);
+            if(num_threads <= 0) {
+                num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        }
+        else {
+            input_files[num_input_files++] = arg;
+        }
+    }
+
+    // In any order with the -O options.
+    code_gen_options.peephole = peephole && (code_gen_options.passes != IR_PASSES_O0);
+
+    if(time_report || trace_file) {
+        tracing = trace_start();
+    }
+
+    if(manifest_file) {
+        if(!compile_manifest(manifest_file, format, num_threads)) {
+            exit_code = 1;
+        }
+        goto out;
+    }
+
+    if(batch) {
+        if(num_input_files == 0) {
+            print_help(argv);
+            exit_code = 1;
+            goto out;
+        }
+        if(!compile_files(input_files, num_input_files, format, num_threads)) {
+            exit_code = 1;
+        }
+        goto out;
+    }
+
+    if(num_input_files != 2) {
         print_help(argv);
         exit_code = 1;
         goto out;
     }
 
+    input_file = input_files[0];
+    output_file = input_files[1];
+
+    if(streaming) {
+        if(!compile_stream(input_file, output_file, format)) {
+            exit_code = 1;
+        }
+        goto out;
+    }
 
-    const char* input_file = argv[1];
-    const char* output_file = argv[2];
+    if(cache_dir) {
+        struct cache cache;
+        TRACE_BEGIN("cache open");
+        const bool cache_opened = open_cache(&cache, cache_dir, cache_max_size);
+        TRACE_END("cache open");
+        if(!cache_opened) {
+            exit_code = 1;
+            goto out;
+        }
+        if(!compile_cached(input_file, output_file, format, num_threads, &cache)) {
+            exit_code = 1;
+        }
+        TRACE_BEGIN("cache close");
+        close_cache(&cache);
+        TRACE_END("cache close");
+        if(cache_stats) {
+            cache_print_stats(&cache);
+        }
+        goto out;
+    }
 
     struct token_array tokens;
-    if(tokenize(input_file, &tokens)) {
+    if(!tokenize(input_file, &tokens, num_threads)) {
         exit_code = 1;
         goto out;
     }
    
-    if(!parse_tokens(&tokens)) {
+    if(!parse_tokens(&tokens) || !bind_tokens(&tokens)) {
         exit_code = 1;
         goto free_and_out;
     }
+    arena_reset(get_phase_arena(ARENA_PARSE));
  
-    // Some cleanup.
-    remove_empty_tokens(&tokens);
+    TRACE_BEGIN("print tokens");
 
-    
     for(size_t i = 0; i < tokens.token_count; i++) {
         struct token* tok = &tokens.array[i];
         
@@ -51,18 +328,57 @@ int main(int argc, char** argv) {
         }
 
         printf("%s", get_token_name(tok->type));
-        if(!tok->raw_data_empty) {
-            printf(" - \033[34m'%s'\033[0m", tok->raw_data);
+        if(tok->type == TOK_SYMBOL || tok->type == PTOK_LIT_I32) {
+            printf(" - \033[34m'%.*s'\033[0m", tok->len, TOKEN_TEXT(&tokens, tok));
         }
         printf("\n");
     }
 
     printf("\033[2;90m--- end of tokens --- \033[0m\n");
+    TRACE_END("print tokens");
     
-    asm_code_gen(&tokens, output_file);
+    if(!asm_code_gen(&tokens, output_file, format, num_threads)) {
+        exit_code = 1;
+    }
 
 free_and_out:
     free_token_array(&tokens);
 out:
+    if(tracing && !trace_stop(time_report, trace_file)) {
+        exit_code = 1;
+    }
+    if(opt_report) {
+        ir_print_report(code_gen_options.passes);
+        peephole_print_report(code_gen_options.peephole);
+    }
+    if(mem_report) {
+        mem_print_report();
+    }
+    mem_free(input_files);
+    return exit_code;
+}
+
+int main(int argc, char** argv) {
+    int exit_code = 0;
+
+    if(argc >= 3 && strcmp(argv[1], "--server") == 0) {
+        if(argc != 3) {
+            print_help(argv);
+            exit_code = 1;
+        }
+        else
+        if(!run_server(argv[2], argv[0], compile_main)) {
+            exit_code = 1;
+        }
+    }
+    else
+    if(argc >= 3 && strcmp(argv[1], "--connect") == 0) {
+        exit_code = run_client(argv[2], argv[0], argc-3, argv+3, compile_main);
+    }
+    else {
+        exit_code = compile_main(argc, argv);
+    }
+
+    free_phase_arenas();
     return exit_code;
 }
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "memprof.h"
+#include "error.h"
+
+
+// Placed before memory from 'mem_alloc()'.
+struct mem_header {
+    size_t       size;
+    enum mem_tag tag;
+};
+
+#define MEM_HEADER_SIZE 16 // Keeps malloc's alignment.
+
+_Static_assert(sizeof(struct mem_header) <= MEM_HEADER_SIZE, "mem_header is too large");
+
+
+static const char* tag_names[MEM_NUM_TAGS] = {
+    [MEM_SOURCE]       = "source",
+    [MEM_TOKENS]       = "tokens",
+    [MEM_HASHMAP]      = "hashmap slots",
+    [MEM_SYMTAB]       = "symtab",
+    [MEM_FRAMES]       = "frames",
+    [MEM_IR]           = "ir",
+    [MEM_CODE]         = "code",
+    [MEM_OUTPUT]       = "output",
+    [MEM_CACHE]        = "cache",
+    [MEM_JOBS]         = "jobs",
+    [MEM_OTHER]        = "other"
+};
+
+static struct mem_tag_stats tag_stats[MEM_NUM_TAGS];
+
+// All tags together, the sum of each tag's peak can be more than this.
+static size_t total_live = 0;
+static size_t total_peak = 0;
+
+
+#define ADD(var, n) __atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED)
+#define SUB(var, n) __atomic_sub_fetch(&(var), (n), __ATOMIC_RELAXED)
+#define LOAD(var)   __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+static void update_peak(size_t* peak, size_t live) {
+    size_t prev = LOAD(*peak);
+    while(live > prev
+    && !__atomic_compare_exchange_n(peak, &prev, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void add_live(enum mem_tag tag, size_t size) {
+    update_peak(&tag_stats[tag].peak_live, ADD(tag_stats[tag].live, size));
+    update_peak(&total_peak, ADD(total_live, size));
+}
+
+static void sub_live(enum mem_tag tag, size_t size) {
+    SUB(tag_stats[tag].live, size);
+    SUB(total_live, size);
+}
+
+
+void mem_track_alloc(enum mem_tag tag, size_t size) {
+    ADD(tag_stats[tag].allocs, 1);
+    ADD(tag_stats[tag].bytes, size);
+    add_live(tag, size);
+}
+
+void mem_track_free(enum mem_tag tag, size_t size) {
+    ADD(tag_stats[tag].frees, 1);
+    sub_live(tag, size);
+}
+
+void mem_track_realloc(enum mem_tag tag, size_t old_size, size_t new_size, size_t copied) {
+    ADD(tag_stats[tag].reallocs, 1);
+    ADD(tag_stats[tag].copied, copied);
+    if(new_size > old_size) {
+        ADD(tag_stats[tag].bytes, new_size - old_size);
+        add_live(tag, new_size - old_size);
+    }
+    else {
+        sub_live(tag, old_size - new_size);
+    }
+}
+
+void mem_track_copy(enum mem_tag tag, size_t size) {
+    ADD(tag_stats[tag].copied, size);
+}
+
+void mem_track_release(enum mem_tag tag, size_t size) {
+    sub_live(tag, size);
+}
+
+
+static inline struct mem_header* get_header(void* ptr) {
+    return (struct mem_header*)((char*)ptr - MEM_HEADER_SIZE);
+}
+
+void* mem_alloc(enum mem_tag tag, size_t size) {
+    struct mem_header* header = malloc(MEM_HEADER_SIZE + size);
+    if(!header) {
+        return NULL;
+    }
+    header->size = size;
+    header->tag = tag;
+    mem_track_alloc(tag, size);
+    return (char*)header + MEM_HEADER_SIZE;
+}
+
+void* mem_calloc(enum mem_tag tag, size_t num, size_t size) {
+    if(size && num > SIZE_MAX / size) {
+        return NULL;
+    }
+    void* ptr = mem_alloc(tag, num * size);
+    if(ptr) {
+        memset(ptr, 0, num * size);
+    }
+    return ptr;
+}
+
+void* mem_realloc(void* ptr, size_t size, enum mem_tag tag) {
+    if(!ptr) {
+        return mem_alloc(tag, size);
+    }
+
+    struct mem_header* header = get_header(ptr);
+    const size_t old_size = header->size;
+
+    struct mem_header* new_header = realloc(header, MEM_HEADER_SIZE + size);
+    if(!new_header) {
+        return NULL;
+    }
+
+    // If it moved everything that fit was copied.
+    const size_t copied = (new_header == header) ? 0 : ((old_size < size) ? old_size : size);
+    new_header->size = size;
+    mem_track_realloc(new_header->tag, old_size, size, copied);
+    return (char*)new_header + MEM_HEADER_SIZE;
+}
+
+char* mem_strdup(enum mem_tag tag, const char* str) {
+    const size_t len = strlen(str);
+    char* copy = mem_alloc(tag, len+1);
+    if(copy) {
+        memcpy(copy, str, len+1);
+    }
+    return copy;
+}
+
+void mem_free(void* ptr) {
+    if(!ptr) {
+        return;
+    }
+    struct mem_header* header = get_header(ptr);
+    mem_track_free(header->tag, header->size);
+    free(header);
+}
+
+
+void mem_get_stats(enum mem_tag tag, struct mem_tag_stats* stats) {
+    stats->allocs = LOAD(tag_stats[tag].allocs);
+    stats->reallocs = LOAD(tag_stats[tag].reallocs);
+    stats->frees = LOAD(tag_stats[tag].frees);
+    stats->bytes = LOAD(tag_stats[tag].bytes);
+    stats->live = LOAD(tag_stats[tag].live);
+    stats->peak_live = LOAD(tag_stats[tag].peak_live);
+    stats->copied = LOAD(tag_stats[tag].copied);
+}
+
+void mem_reset_stats() {
+    for(size_t i = 0; i < MEM_NUM_TAGS; i++) {
+        struct mem_tag_stats* stats = &tag_stats[i];
+        __atomic_store_n(&stats->allocs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->reallocs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->frees, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->copied, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->peak_live, LOAD(stats->live), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&total_peak, LOAD(total_live), __ATOMIC_RELAXED);
+}
+
+void mem_print_report() {
+    struct mem_tag_stats total = { 0 };
+
+    errprintf("%-16s %10s %10s %10s %14s %14s %14s\n",
+            "Memory report", "allocs", "reallocs", "frees", "bytes", "peak live", "copied");
+
+    for(size_t i = 0; i < MEM_NUM_TAGS; i++) {
+        struct mem_tag_stats stats;
+        mem_get_stats(i, &stats);
+
+        errprintf("  %-14s %10zu %10zu %10zu %14zu %14zu %14zu\n",
+                tag_names[i], stats.allocs, stats.reallocs, stats.frees,
+                stats.bytes, stats.peak_live, stats.copied);
+
+        total.allocs += stats.allocs;
+        total.reallocs += stats.reallocs;
+        total.frees += stats.frees;
+        total.bytes += stats.bytes;
+        total.copied += stats.copied;
+    }
+
+    errprintf("  %-14s %10zu %10zu %10zu %14zu %14zu %14zu\n",
+            "total", total.allocs, total.reallocs, total.frees,
+            total.bytes, LOAD(total_peak), total.copied);
+
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        errprintf("Peak RSS: %li KiB\n", usage.ru_maxrss);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+// Memory accounting for --mem-report.
+//
+// Every allocation of the compiler is tagged with the subsystem it's for.
+// Arena hooks ('arena_memalloc()' ...) take the tag, memory outside of arenas
+// comes from 'mem_alloc()' and friends. Mapped sources and large token arrays
+// are counted where they are mapped.
+//
+// Freed arena memory stops being "live" right away, it is rolled back or put on
+// the arena's free lists. Blocks too small for a free list, and anything not
+// freed, stay live until the arena is reset. Counters are global and updated atomically.
+
+
+enum mem_tag {
+    MEM_SOURCE,       // Mapped or read input files.
+    MEM_TOKENS,       // Token arrays.
+    MEM_HASHMAP,      // Hashmap slots and control bytes.
+    MEM_SYMTAB,       // Undo logs and scope stacks.
+    MEM_FRAMES,       // Frame and slot tables of 'bind_tokens()'
+    MEM_IR,           // Instructions, slots and pass memory of 'ir_func'
+    MEM_CODE,         // Emitter state, machine code, labels and ELF tables.
+    MEM_OUTPUT,       // Output buffers.
+    MEM_CACHE,        // Code cache index and entries.
+    MEM_JOBS,         // Job lists, queues and thread bookkeeping.
+    MEM_OTHER,
+
+    MEM_NUM_TAGS
+};
+
+struct mem_tag_stats {
+    size_t allocs;
+    size_t reallocs;
+    size_t frees;
+    size_t bytes;     // Requested, growth of reallocs included.
+    size_t live;
+    size_t peak_live;
+    size_t copied;    // Moved by reallocs and when hashmaps grow.
+};
+
+
+void mem_track_alloc(enum mem_tag tag, size_t size);
+void mem_track_free(enum mem_tag tag, size_t size);
+void mem_track_realloc(enum mem_tag tag, size_t old_size, size_t new_size, size_t copied);
+void mem_track_copy(enum mem_tag tag, size_t size);
+
+// Released without being freed one by one, for example by 'arena_reset()'.
+void mem_track_release(enum mem_tag tag, size_t size);
+
+
+// Tracked malloc, NULL if out of memory.
+// 'mem_realloc()' keeps the tag of 'ptr', 'tag' is used if it's NULL.
+void* mem_alloc(enum mem_tag tag, size_t size);
+void* mem_calloc(enum mem_tag tag, size_t num, size_t size);
+void* mem_realloc(void* ptr, size_t size, enum mem_tag tag);
+char* mem_strdup(enum mem_tag tag, const char* str);
+void  mem_free(void* ptr);
+
+
+void mem_get_stats(enum mem_tag tag, struct mem_tag_stats* stats);
+
+// Counts start from zero, peaks from what is live now.
+void mem_reset_stats();
+
+// Prints counts, bytes, peak live bytes and copy volume of each subsystem to stderr.
+void mem_print_report();
+
+
+#endif
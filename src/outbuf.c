@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+#include "error.h"
+#include "trace.h"
+#include "memprof.h"
+
+
+void create_outbuf(struct outbuf* ob, int fd) {
+    ob->fd = fd;
+    ob->curr_chunk = 0;
+    ob->failed = false;
+
+    for(size_t i = 0; i < OUTBUF_MAX_CHUNKS; i++) {
+        struct outbuf_chunk* chunk = &ob->chunks[i];
+        chunk->data = NULL;
+        chunk->len = 0;
+        chunk->cap = 0;
+    }
+}
+
+void free_outbuf(struct outbuf* ob) {
+    for(size_t i = 0; i < OUTBUF_MAX_CHUNKS; i++) {
+        struct outbuf_chunk* chunk = &ob->chunks[i];
+        if(chunk->data) {
+            mem_free(chunk->data);
+            chunk->data = NULL;
+        }
+        chunk->len = 0;
+        chunk->cap = 0;
+    }
+    ob->curr_chunk = 0;
+}
+
+bool outbuf_flush(struct outbuf* ob) {
+    bool result = false;
+
+    struct iovec iov[OUTBUF_MAX_CHUNKS];
+    int iov_count = 0;
+
+    for(size_t i = 0; i <= ob->curr_chunk; i++) {
+        struct outbuf_chunk* chunk = &ob->chunks[i];
+        if(chunk->len > 0) {
+            iov[iov_count].iov_base = chunk->data;
+            iov[iov_count].iov_len = chunk->len;
+            iov_count++;
+        }
+    }
+
+    struct iovec* iov_it = iov;
+    while(iov_count > 0) {
+        ssize_t written = writev(ob->fd, iov_it, iov_count);
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            errprintf("%s: writev() | %s\n", __func__, strerror(errno));
+            ob->failed = true;
+            goto out;
+        }
+        TRACE_COUNT(TRACE_BYTES_EMITTED, written);
+
+        // Skip what was written, the write may have been partial.
+        while(iov_count > 0 && (size_t)written >= iov_it->iov_len) {
+            written -= iov_it->iov_len;
+            iov_it++;
+            iov_count--;
+        }
+        if(iov_count > 0) {
+            iov_it->iov_base = (char*)iov_it->iov_base + written;
+            iov_it->iov_len -= written;
+        }
+    }
+
+    result = !ob->failed;
+
+out:
+    // Chunks are kept allocated for reuse.
+    outbuf_clear(ob);
+    return result;
+}
+
+
+// Returns pointer to at least 'size' bytes of free space at the end of current chunk.
+static char* outbuf_reserve(struct outbuf* ob, size_t size) {
+    struct outbuf_chunk* chunk = &ob->chunks[ob->curr_chunk];
+    if(chunk->data && (chunk->cap - chunk->len >= size)) {
+        return chunk->data + chunk->len;
+    }
+
+    if(chunk->len > 0) {
+        if(ob->curr_chunk+1 < OUTBUF_MAX_CHUNKS) {
+            ob->curr_chunk++;
+        }
+        else
+        if(ob->fd >= 0) {
+            if(!outbuf_flush(ob)) {
+                return NULL;
+            }
+        }
+        // Memory only buffer keeps growing the last chunk.
+        chunk = &ob->chunks[ob->curr_chunk];
+    }
+
+    const size_t needed = chunk->len + size;
+    if(chunk->cap < needed) {
+        size_t new_cap = (chunk->len > 0) ? chunk->cap * 2 : OUTBUF_CHUNK_SIZE;
+        if(new_cap < needed) {
+            new_cap = needed;
+        }
+        char* new_ptr = mem_realloc(chunk->data, new_cap, MEM_OUTPUT);
+        if(!new_ptr) {
+            PRINT_MEMERROR("mem_realloc");
+            ob->failed = true;
+            return NULL;
+        }
+        chunk->data = new_ptr;
+        chunk->cap = new_cap;
+    }
+
+    return chunk->data + chunk->len;
+}
+
+bool outbuf_write(struct outbuf* ob, const char* data, size_t size) {
+    char* dst = outbuf_reserve(ob, size);
+    if(!dst) {
+        return false;
+    }
+
+    memcpy(dst, data, size);
+    ob->chunks[ob->curr_chunk].len += size;
+    return true;
+}
+
+void outbuf_clear(struct outbuf* ob) {
+    for(size_t i = 0; i <= ob->curr_chunk; i++) {
+        ob->chunks[i].len = 0;
+    }
+    ob->curr_chunk = 0;
+}
+
+size_t outbuf_size(const struct outbuf* ob) {
+    size_t size = 0;
+    for(size_t i = 0; i <= ob->curr_chunk; i++) {
+        size += ob->chunks[i].len;
+    }
+    return size;
+}
+
+bool outbuf_append(struct outbuf* ob, struct outbuf* from) {
+    if(from->failed) {
+        ob->failed = true;
+        return false;
+    }
+
+    if(ob->fd < 0) {
+        for(size_t i = 0; i <= from->curr_chunk; i++) {
+            struct outbuf_chunk* chunk = &from->chunks[i];
+            if(chunk->len > 0 && !outbuf_write(ob, chunk->data, chunk->len)) {
+                return false;
+            }
+        }
+        outbuf_clear(from);
+        return true;
+    }
+
+    // Keep the order and write 'from' without copying it.
+    if(!outbuf_flush(ob)) {
+        return false;
+    }
+
+    const int from_fd = from->fd;
+    from->fd = ob->fd;
+    const bool result = outbuf_flush(from);
+    from->fd = from_fd;
+
+    if(!result) {
+        ob->failed = true;
+    }
+    return result;
+}
+
+bool outbuf_vprintf(struct outbuf* ob, const char* fmt, va_list args) {
+    bool result = false;
+    struct outbuf_chunk* chunk = &ob->chunks[ob->curr_chunk];
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+
+    // First try to format directly into the current chunk.
+    const size_t space = chunk->data ? (chunk->cap - chunk->len) : 0;
+    int len = vsnprintf(space ? chunk->data + chunk->len : NULL, space, fmt, args);
+    if(len < 0) {
+        errprintf("%s: vsnprintf() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+
+    // 'vsnprintf' needs room for the null terminator too.
+    if((size_t)len >= space) {
+        char* dst = outbuf_reserve(ob, len+1);
+        if(!dst) {
+            goto out;
+        }
+        vsnprintf(dst, len+1, fmt, args_copy);
+    }
+
+    ob->chunks[ob->curr_chunk].len += len;
+    result = true;
+
+out:
+    va_end(args_copy);
+    return result;
+}
+
+bool outbuf_printf(struct outbuf* ob, const char* fmt, ...) {
+    va_list args;
+    va_start(args);
+
+    const bool result = outbuf_vprintf(ob, fmt, args);
+
+    va_end(args);
+    return result;
+}
+
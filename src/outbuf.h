@@ -0,0 +1,64 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+
+#define OUTBUF_CHUNK_SIZE (64 * 1024)
+
+// When all chunks are filled the buffer is flushed with a single 'writev'.
+// So this is also the flush threshold: OUTBUF_MAX_CHUNKS * OUTBUF_CHUNK_SIZE
+#define OUTBUF_MAX_CHUNKS 16
+
+
+struct outbuf_chunk {
+    char*  data;
+    size_t len;
+    size_t cap;
+};
+
+struct outbuf {
+    int    fd;
+
+    struct outbuf_chunk chunks[OUTBUF_MAX_CHUNKS];
+    size_t              curr_chunk;
+
+    bool   failed; // Set if allocating or writing has failed.
+};
+
+
+// If 'fd' is -1 the buffer is memory only, it is never flushed
+// and grows as needed. Used to generate parts of the output separately.
+void create_outbuf(struct outbuf* ob, int fd);
+void free_outbuf(struct outbuf* ob);
+
+// Write all buffered data to 'ob->fd'.
+// Returns 'false' also if an earlier write to the buffer failed,
+// the output is then missing something.
+bool outbuf_flush(struct outbuf* ob);
+
+// Append 'size' bytes from 'data'.
+bool outbuf_write(struct outbuf* ob, const char* data, size_t size);
+
+// Drops everything buffered.
+void outbuf_clear(struct outbuf* ob);
+
+// Number of bytes buffered and not yet flushed.
+size_t outbuf_size(const struct outbuf* ob);
+
+// Append everything buffered in 'from' and empty it.
+bool outbuf_append(struct outbuf* ob, struct outbuf* from);
+
+// Format and append. The output is never truncated,
+// a bigger chunk is allocated if the result doesnt fit.
+bool outbuf_printf(struct outbuf* ob, const char* fmt, ...);
+bool outbuf_vprintf(struct outbuf* ob, const char* fmt, va_list args);
+
+// Fast path for string literals, the length is known at compile time.
+#define outbuf_puts(ob, str_lit)\
+    outbuf_write(ob, str_lit, sizeof(str_lit)-1)
+
+
+#endif
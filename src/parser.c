@@ -5,6 +5,24 @@
 #include "parser.h"
 #include "error.h"
 #include "common.h"
+#include "trace.h"
+#include "arena.h"
+#include "hashmap.h"
+
+
+// Names of the functions defined so far, keys point to the source.
+HASHMAP_DEFINE(func_name_map, struct hashmap_str_key, bool)
+
+// Per thread so files can be parsed in parallel.
+static _Thread_local struct {
+
+    // Scope depth, kept between 'parse_tokens_from()' calls.
+    size_t depth;
+
+    // Memory is from the lex arena, the parse arena is reset between stream chunks.
+    struct func_name_map funcs;
+}
+pst; // Parser state.
 
 
 bool is_correct_order
@@ -15,7 +33,16 @@ bool is_correct_order
     size_t size
 );
 
+static bool parse_tokens_range(struct token_array* tokens, size_t start);
+
 
+#define parser_errmsg(tokens, tok, fmt, ...)\
+    do {\
+        size_t err_line = 0;\
+        int err_column = 0;\
+        token_position(tokens, tok, &err_line, &err_column);\
+        errmsg((tokens)->file_path, err_line, err_column, fmt, ##__VA_ARGS__);\
+    } while(0)
 
 
 struct token* parse_var(struct token_array* tokens, struct token* curr_tok) {
@@ -41,22 +68,12 @@ struct token* parse_var(struct token_array* tokens, struct token* curr_tok) {
             break;
     }
 
-    memset(curr_tok->data.var.name, 
-            0, sizeof(curr_tok->data.var.name));
-
-    curr_tok->data.var.name_len = strlen(name_tok->raw_data);
-    memcpy(curr_tok->data.var.name,
-            name_tok->raw_data,
-            curr_tok->data.var.name_len);
-
-
-    for(size_t i = 1; i < ARRAY_LEN(order); i++) {
-        zero_token(curr_tok + i);
-    }
-
+    // Declarations are checked by 'bind_tokens()'
+    curr_tok->offset = name_tok->offset;
+    curr_tok->len = name_tok->len;
     curr_tok->type = PTOK_NEW_VAR;
 
-    return curr_tok;
+    return curr_tok + (ARRAY_LEN(order) - 1);
 }
 
 struct token* parse_atvar(struct token_array* tokens, struct token* curr_tok) {
@@ -70,24 +87,11 @@ struct token* parse_atvar(struct token_array* tokens, struct token* curr_tok) {
 
     struct token* name_tok = curr_tok + 1;
     
-
-
-    memset(curr_tok->data.var.name, 
-            0, sizeof(curr_tok->data.var.name));
-
-    curr_tok->data.var.name_len = strlen(name_tok->raw_data);
-    memcpy(curr_tok->data.var.name,
-            name_tok->raw_data,
-            curr_tok->data.var.name_len);
-
-    for(size_t i = 1; i < ARRAY_LEN(order); i++) {
-        zero_token(curr_tok + i);
-    }
-
-    
+    curr_tok->offset = name_tok->offset;
+    curr_tok->len = name_tok->len;
     curr_tok->type = PTOK_VAR;
 
-    return curr_tok;
+    return curr_tok + (ARRAY_LEN(order) - 1);
 }
 
 struct token* parse_func(struct token_array* tokens, struct token* curr_tok) {
@@ -106,6 +110,22 @@ struct token* parse_func(struct token_array* tokens, struct token* curr_tok) {
     struct token* type_tok = curr_tok + 2;
     struct token* label_tok = curr_tok + 4;
 
+    // Functions are global, the back ends cant tell two of the same name apart.
+    const struct hashmap_str_key name = { TOKEN_TEXT(tokens, label_tok), label_tok->len };
+    if(func_name_map_get(&pst.funcs, name)) {
+        parser_errmsg(tokens, label_tok,
+                "Function \"%.*s\" is defined more than once", (int)name.len, name.str);
+        return NULL;
+    }
+
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+    const bool added = func_name_map_add(&pst.funcs, name, true);
+    arena_use(prev_arena);
+    if(!added) {
+        PRINT_MEMERROR("func_name_map_add");
+        return NULL;
+    }
+
     curr_tok->type = PTOK_FUNC;
     
 
@@ -121,33 +141,29 @@ struct token* parse_func(struct token_array* tokens, struct token* curr_tok) {
     }
 
 
-    memset(curr_tok->data.func.label,
-            0, sizeof(curr_tok->data.func.label));
-    curr_tok->data.func.label_len = strlen(label_tok->raw_data);
-    memcpy(curr_tok->data.func.label,
-            label_tok->raw_data,
-            curr_tok->data.func.label_len);
-
-
-    for(size_t i = 1; i < ARRAY_LEN(order); i++) {
-        zero_token(curr_tok + i);
-    }
+    curr_tok->offset = label_tok->offset;
+    curr_tok->len = label_tok->len;
 
-    return curr_tok;
+    return curr_tok + (ARRAY_LEN(order) - 1);
 }
 
 struct token* parse_sym(struct token_array* tokens, struct token* curr_tok) {
 
-    if(curr_tok->raw_data_empty) {
-        errmsg(tokens->file_path, curr_tok->line, curr_tok->column,
+    if(curr_tok->len == 0) {
+        parser_errmsg(tokens, curr_tok,
                 "Symbol token doesnt have data.");
         return NULL;
     }
 
 
-    if(is_literal_int32(curr_tok->raw_data)) {
+    const char* text = TOKEN_TEXT(tokens, curr_tok);
+    if(is_literal_int32(text, curr_tok->len)) {
+        if(!parse_int32(text, curr_tok->len, &curr_tok->data.lit_i32.value)) {
+            parser_errmsg(tokens, curr_tok,
+                    "Literal \"%.*s\" is too large for i32", curr_tok->len, text);
+            return NULL;
+        }
         curr_tok->type = PTOK_LIT_I32;
-        curr_tok->data.lit_i32.value = atoi(curr_tok->raw_data);
     }
 
 
@@ -156,40 +172,110 @@ struct token* parse_sym(struct token_array* tokens, struct token* curr_tok) {
 }
 
 
+bool parser_begin() {
+    pst.depth = 0;
+
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+    pst.funcs = create_func_name_map(64); // <- Initial size.
+    arena_use(prev_arena);
+
+    if(!pst.funcs.table.ctrl) {
+        PRINT_MEMERROR("create_func_name_map");
+        return false;
+    }
+    return true;
+}
+
+void parser_end() {
+    pst.depth = 0;
+    free_func_name_map(&pst.funcs);
+}
+
 bool parse_tokens(struct token_array* tokens) {
+    if(!parser_begin()) {
+        return false;
+    }
 
+    const bool result = parse_tokens_from(tokens, 0);
+    parser_end();
+    return result;
+}
 
-    struct token* curr_tok = &tokens->array[0];
-    while(curr_tok != NULL && curr_tok->type != TOK_EOF) {
+bool parse_tokens_from(struct token_array* tokens, size_t start) {
+    TRACE_BEGIN("parse");
+    const bool result = parse_tokens_range(tokens, start);
+    TRACE_END("parse");
+    return result;
+}
+
+static bool parse_tokens_range(struct token_array* tokens, size_t start) {
+
+    // Parsed tokens are written back to the same array behind 'curr_tok'
+    // so tokens consumed by a construct dont leave holes.
+    struct token* out_tok = &tokens->array[start];
+
+    struct token* curr_tok = &tokens->array[start];
+    struct token* end_tok = &tokens->array[tokens->token_count];
+
+    while(curr_tok < end_tok) {
+
+        if(curr_tok->type == TOK_EOF) {
+            if(pst.depth != 0) {
+                parser_errmsg(tokens, curr_tok, "Expected \"}\" before the end of the file");
+                return false;
+            }
+            *out_tok++ = *curr_tok;
+            break;
+        }
+
+        // Each parse function leaves the result in 'curr_tok'
+        // and returns the last token it consumed.
+        struct token* last_tok = curr_tok;
 
         switch(curr_tok->type) {
        
 
             case TOK_AT:
-                curr_tok = parse_atvar(tokens, curr_tok);
+                last_tok = parse_atvar(tokens, curr_tok);
                 break;
 
             case TOK_VAR:
-                curr_tok = parse_var(tokens, curr_tok);
+                last_tok = parse_var(tokens, curr_tok);
                 break;
 
             case TOK_SYMBOL:
-                curr_tok = parse_sym(tokens, curr_tok);
+                last_tok = parse_sym(tokens, curr_tok);
                 break;
         
             case TOK_FUNC:
-                curr_tok = parse_func(tokens, curr_tok);
+                last_tok = parse_func(tokens, curr_tok);
+                break;
+
+            case TOK_OPEN_SCOPE:
+                pst.depth++;
+                break;
+
+            case TOK_CLOSE_SCOPE:
+                if(pst.depth == 0) {
+                    parser_errmsg(tokens, curr_tok, "Unexpected \"}\"");
+                    last_tok = NULL;
+                    break;
+                }
+                pst.depth--;
                 break;
         }
 
-        if(!curr_tok) {
-            break;
+        if(!last_tok) {
+            return false;
         }
-        curr_tok++;
+
+        *out_tok++ = *curr_tok;
+        curr_tok = last_tok + 1;
     }
 
+    tokens->token_count = out_tok - tokens->array;
 
-    return (curr_tok != NULL);
+    return true;
 }
 
 
@@ -200,37 +286,46 @@ bool is_correct_order
     enum token_type* token_types, 
     size_t size
 ){
+    struct token* end_tok = &tokens->array[tokens->token_count];
+
     size_t index = 0;
-    while(curr_tok != NULL && curr_tok->type != TOK_EOF) {
+    while(curr_tok < end_tok && curr_tok->type != TOK_EOF) {
         
         enum token_type expect = token_types[index];
 
         if(expect == TOK__ANY_TYPE__) {
             if(curr_tok->type != TOK_TYPE_VOID
             && curr_tok->type != TOK_TYPE_I32) {
-                errmsg(tokens->file_path, curr_tok->line, curr_tok->column,
-                        "Expected TYPE, but found \"%s\"", 
-                        curr_tok->raw_data);
+                parser_errmsg(tokens, curr_tok,
+                        "Expected TYPE, but found \"%.*s\"", 
+                        curr_tok->len, TOKEN_TEXT(tokens, curr_tok));
                 return false;
             }
         }
         else 
         if(curr_tok->type != expect) {
-            errmsg(tokens->file_path, curr_tok->line, curr_tok->column,
-                    "Expected %s, but found \"%s\"", 
+            parser_errmsg(tokens, curr_tok,
+                    "Expected %s, but found \"%.*s\"", 
                     get_token_name(token_types[index]),
-                    curr_tok->raw_data);
+                    curr_tok->len, TOKEN_TEXT(tokens, curr_tok));
             return false;
         }
 
         curr_tok++;
         index++;
         if(index >= size) {
-            break;
+            return true;
         }
     }
 
-    return true;
+    if(curr_tok >= end_tok) {
+        curr_tok = end_tok - 1;
+    }
+    parser_errmsg(tokens, curr_tok,
+            "Expected %s, but found end of file",
+            (token_types[index] == TOK__ANY_TYPE__)
+                ? "TYPE" : get_token_name(token_types[index]));
+    return false;
 }
 
 
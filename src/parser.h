@@ -7,8 +7,19 @@
 
 
 
+// Same as 'parser_begin()', 'parse_tokens_from(tokens, 0)' and 'parser_end()'
 bool parse_tokens(struct token_array* tokens);
 
+// Scope depth and the names of the functions are remembered from
+// 'parser_begin()' to 'parser_end()' so the input can be parsed in parts.
+// Returns 'false' on memory error.
+bool parser_begin();
+void parser_end();
+
+// Parses tokens from index 'start' to the end of the array.
+// Constructs cant continue past the last token.
+bool parse_tokens_from(struct token_array* tokens, size_t start);
+
 
 
 
@@ -0,0 +1,224 @@
+#include <string.h>
+
+#include "peephole.h"
+#include "arena.h"
+#include "error.h"
+
+
+void create_asm_func(struct asm_func* func) {
+    memset(func, 0, sizeof *func);
+    func->frame = true;
+}
+
+void free_asm_func(struct asm_func* func) {
+    arena_memfree(func->instrs);
+    create_asm_func(func);
+}
+
+void asm_func_reset(struct asm_func* func) {
+    func->instr_count = 0;
+    func->frame = true;
+}
+
+bool asm_func_add(struct asm_func* func, enum asm_op op, const struct operand* dst, const struct operand* src) {
+    if(func->instr_count >= func->instrs_num_alloc) {
+        const size_t num_alloc = func->instrs_num_alloc ? func->instrs_num_alloc * 2 : 64;
+
+        struct asm_instr* tmp_ptr = arena_memrealloc(func->instrs, num_alloc * sizeof *tmp_ptr, MEM_CODE);
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return false;
+        }
+        func->instrs = tmp_ptr;
+        func->instrs_num_alloc = num_alloc;
+    }
+
+    struct asm_instr* instr = &func->instrs[func->instr_count++];
+    instr->op = op;
+    instr->dst = *dst;
+    instr->src = *src;
+    return true;
+}
+
+
+static inline bool same_operand(const struct operand* a, const struct operand* b) {
+    return a->kind == b->kind && a->value == b->value;
+}
+
+static inline bool is_imm(const struct operand* op, int value) {
+    return op->kind == OPERAND_IMM && op->value == value;
+}
+
+// Writes 'dst' without reading it.
+static inline bool overwrites(const struct asm_instr* instr) {
+    switch(instr->op) {
+        case ASM_MOV:
+            return !same_operand(&instr->dst, &instr->src);
+
+        case ASM_XOR:
+            return same_operand(&instr->dst, &instr->src);
+    }
+    return false;
+}
+
+
+// Window rules get the first of their 'window' instructions,
+// they return how many instructions the window was replaced with.
+
+static bool match_zero_xor(struct asm_instr* w) {
+    return w[0].op == ASM_MOV && w[0].dst.kind == OPERAND_REG && is_imm(&w[0].src, 0);
+}
+
+// Flags are never read, so clearing them does no harm.
+static size_t rewrite_zero_xor(struct asm_instr* w) {
+    w[0].op = ASM_XOR;
+    w[0].src = w[0].dst;
+    return 1;
+}
+
+static bool match_add_zero(struct asm_instr* w) {
+    return w[0].op == ASM_ADD && is_imm(&w[0].src, 0);
+}
+
+static size_t rewrite_remove(struct asm_instr* w) {
+    (void)w;
+    return 0;
+}
+
+// Instructions only change 'dst', and the flags.
+static bool match_overwritten(struct asm_instr* w) {
+    return w[0].op != ASM_WRITE_FRAME && overwrites(&w[1]) && same_operand(&w[0].dst, &w[1].dst);
+}
+
+static size_t rewrite_overwritten(struct asm_instr* w) {
+    w[0] = w[1];
+    return 1;
+}
+
+
+// Whole function rules run once after the window rules.
+
+static bool match_frame(struct asm_func* func) {
+    for(size_t i = 0; i < func->instr_count; i++) {
+        const struct asm_instr* instr = &func->instrs[i];
+        if(instr->op == ASM_WRITE_FRAME
+                || instr->dst.kind == OPERAND_STACK || instr->src.kind == OPERAND_STACK) {
+            return false;
+        }
+    }
+    return func->frame;
+}
+
+static void rewrite_frame(struct asm_func* func) {
+    func->frame = false;
+}
+
+
+struct peephole_rule {
+    const char* name;
+    size_t      window; // Instructions in the pattern, 0 for whole function rules.
+
+    bool   (*match)(struct asm_instr* w);
+    size_t (*rewrite)(struct asm_instr* w);
+
+    bool (*match_func)(struct asm_func* func);
+    void (*rewrite_func)(struct asm_func* func);
+};
+
+static const struct peephole_rule RULES[PEEPHOLE_NUM_RULES] = {
+    [PEEPHOLE_ZERO_XOR]    = { "zero-xor",    1, match_zero_xor,    rewrite_zero_xor,    NULL, NULL },
+    [PEEPHOLE_ADD_ZERO]    = { "add-zero",    1, match_add_zero,    rewrite_remove,      NULL, NULL },
+    [PEEPHOLE_OVERWRITTEN] = { "overwritten", 2, match_overwritten, rewrite_overwritten, NULL, NULL },
+    [PEEPHOLE_FRAME]       = { "frame",       0, NULL, NULL, match_frame, rewrite_frame }
+};
+
+static size_t rule_counts[PEEPHOLE_NUM_RULES];
+
+static size_t instrs_before = 0;
+static size_t instrs_after = 0;
+
+
+#define ADD(var, n) __atomic_add_fetch(&(var), (n), __ATOMIC_RELAXED)
+#define LOAD(var)   __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+// Tries the window rules on the last instructions until none matches.
+// Returns the new number of instructions.
+static size_t apply_window_rules(struct asm_instr* instrs, size_t count, size_t* counts) {
+    bool changed = true;
+    while(changed && count > 0) {
+        changed = false;
+
+        for(size_t r = 0; r < PEEPHOLE_NUM_RULES; r++) {
+            const struct peephole_rule* rule = &RULES[r];
+            if(rule->window == 0 || rule->window > count) {
+                continue;
+            }
+
+            struct asm_instr* w = &instrs[count - rule->window];
+            if(rule->match(w)) {
+                count = count - rule->window + rule->rewrite(w);
+                counts[r]++;
+                changed = true;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Instructions are moved down over the removed ones as they are visited,
+// the rules see the instructions before the current one already rewritten.
+void peephole_func(struct asm_func* func) {
+    size_t counts[PEEPHOLE_NUM_RULES] = { 0 };
+    const size_t num_instrs = func->instr_count;
+
+    size_t count = 0;
+    for(size_t i = 0; i < num_instrs; i++) {
+        func->instrs[count++] = func->instrs[i];
+        count = apply_window_rules(func->instrs, count, counts);
+    }
+    func->instr_count = count;
+
+    for(size_t r = 0; r < PEEPHOLE_NUM_RULES; r++) {
+        const struct peephole_rule* rule = &RULES[r];
+        if(rule->window == 0 && rule->match_func(func)) {
+            rule->rewrite_func(func);
+            counts[r]++;
+        }
+    }
+
+    for(size_t r = 0; r < PEEPHOLE_NUM_RULES; r++) {
+        if(counts[r]) {
+            ADD(rule_counts[r], counts[r]);
+        }
+    }
+    ADD(instrs_before, num_instrs);
+    ADD(instrs_after, func->instr_count);
+}
+
+
+size_t peephole_get_count(enum peephole_rule_id rule) {
+    return LOAD(rule_counts[rule]);
+}
+
+void peephole_reset_stats() {
+    memset(rule_counts, 0, sizeof rule_counts);
+    instrs_before = 0;
+    instrs_after = 0;
+}
+
+void peephole_print_report(bool enabled) {
+    errprintf("%-16s %10s\n", "Peephole", "fired");
+
+    for(size_t r = 0; r < PEEPHOLE_NUM_RULES; r++) {
+        if(!enabled) {
+            errprintf("  %-14s %10s\n", RULES[r].name, "off");
+            continue;
+        }
+        errprintf("  %-14s %10zu\n", RULES[r].name, peephole_get_count(r));
+    }
+
+    if(enabled) {
+        errprintf("Instructions: %zu -> %zu\n", LOAD(instrs_before), LOAD(instrs_after));
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Operand of the emitted instructions.
+enum operand_kind {
+    OPERAND_IMM,
+    OPERAND_REG,  // enum x86_reg
+    OPERAND_STACK // DWORD PTR [rbp-value]
+};
+
+struct operand {
+    uint8_t kind; // enum operand_kind
+    int     value;
+};
+
+// x86-64 instructions of one function between its prologue and epilogue,
+// in the order they are emitted. Code generation collects them here
+// so the peephole rules can rewrite them before the emitter sees them.
+enum asm_op {
+    ASM_MOV,        // mov dst, src
+    ASM_ADD,        // add dst, src
+    ASM_XOR,        // xor dst, src
+    ASM_WRITE_FRAME // Writes 'src.value' bytes below rbp to stdout.
+};
+
+struct asm_instr {
+    uint8_t        op; // enum asm_op
+    struct operand dst;
+    struct operand src;
+};
+
+struct asm_func {
+    struct asm_instr* instrs;
+    size_t            instr_count;
+    size_t            instrs_num_alloc;
+
+    // Prologue sets up rbp and the epilogue restores it.
+    bool frame;
+};
+
+
+// Memory comes from the arena selected with 'arena_use()'
+// and is kept for the next function.
+void create_asm_func(struct asm_func* func);
+void free_asm_func(struct asm_func* func);
+
+// Starts the next function, with a frame.
+void asm_func_reset(struct asm_func* func);
+
+// Returns 'false' on memory error.
+bool asm_func_add(struct asm_func* func, enum asm_op op, const struct operand* dst, const struct operand* src);
+
+
+// Rules are tried in this order on the last instructions each time one is added,
+// so a rewrite can let an earlier rule match again.
+enum peephole_rule_id {
+    PEEPHOLE_ZERO_XOR,    // mov r, 0            ->  xor r, r
+    PEEPHOLE_ADD_ZERO,    // add x, 0            ->
+    PEEPHOLE_OVERWRITTEN, // op x, a; mov x, b   ->  mov x, b   (b is not x)
+    PEEPHOLE_FRAME,       // push rbp; mov rbp, rsp ... pop rbp  ->  nothing uses the stack
+
+    PEEPHOLE_NUM_RULES
+};
+
+// Rewrites the function in place.
+void peephole_func(struct asm_func* func);
+
+// Times each rule fired, added up over all functions of all threads, for --opt-report.
+size_t peephole_get_count(enum peephole_rule_id rule);
+void   peephole_reset_stats();
+void   peephole_print_report(bool enabled);
+
+
+
+#endif
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "regalloc.h"
+#include "arena.h"
+#include "error.h"
+
+
+// Caller saved first, they are free to use in a function which calls nothing.
+static const enum x86_reg ALLOC_ORDER[REGALLOC_NUM_REGS] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+#define CALLEE_SAVED_REGS\
+    ((1u << REG_RBX) | (1u << REG_R12) | (1u << REG_R13) | (1u << REG_R14) | (1u << REG_R15))
+
+// Interval which has a register, 'order' is its index in ALLOC_ORDER.
+struct active_interval {
+    size_t   end;
+    uint32_t slot;
+    uint8_t  order;
+};
+
+
+void create_reg_alloc(struct reg_alloc* ra) {
+    memset(ra, 0, sizeof *ra);
+}
+
+void free_reg_alloc(struct reg_alloc* ra) {
+    arena_memfree(ra->slot_interval);
+    arena_memfree(ra->intervals);
+    arena_memfree(ra->regs);
+    memset(ra, 0, sizeof *ra);
+}
+
+static bool reg_alloc_memcheck(struct reg_alloc* ra, size_t num_slots) {
+    if(num_slots <= ra->regs_num_alloc) {
+        return true;
+    }
+
+    int8_t* regs = arena_memrealloc(ra->regs, num_slots * sizeof *regs, MEM_CODE);
+    if(!regs) {
+        PRINT_MEMERROR("arena_memrealloc");
+        return false;
+    }
+    ra->regs = regs;
+
+    struct live_interval* intervals = arena_memrealloc(ra->intervals,
+            num_slots * sizeof *intervals, MEM_CODE);
+    if(!intervals) {
+        PRINT_MEMERROR("arena_memrealloc");
+        return false;
+    }
+    ra->intervals = intervals;
+
+    uint32_t* slot_interval = arena_memrealloc(ra->slot_interval,
+            num_slots * sizeof *slot_interval, MEM_CODE);
+    if(!slot_interval) {
+        PRINT_MEMERROR("arena_memrealloc");
+        return false;
+    }
+    ra->slot_interval = slot_interval;
+    ra->regs_num_alloc = num_slots;
+    return true;
+}
+
+static inline void mention(struct reg_alloc* ra, uint32_t slot, size_t pos, size_t* count) {
+    struct live_interval* intervals = ra->intervals;
+    if(ra->regs[slot] == SLOT_UNUSED) {
+        ra->regs[slot] = SLOT_IN_STACK;
+        ra->slot_interval[slot] = *count;
+        intervals[*count].start = pos;
+        intervals[*count].slot = slot;
+        (*count)++;
+    }
+    intervals[ra->slot_interval[slot]].end = pos;
+}
+
+// Intervals of the used variables in the order of their first use,
+// so they are already sorted by start. Returns their number.
+// Used slots are set to SLOT_IN_STACK in 'regs'.
+static size_t find_intervals(struct reg_alloc* ra, const struct ir_func* func) {
+    size_t count = 0;
+
+    for(size_t i = 0; i < func->instr_count; i++) {
+        const struct ir_instr* instr = &func->instrs[i];
+        if(instr->op == IR_NOP) {
+            continue;
+        }
+        if(instr->a.kind == IR_VAR) {
+            mention(ra, instr->a.slot, i, &count);
+        }
+        if(instr->op == IR_ADD && instr->b.kind == IR_VAR) {
+            mention(ra, instr->b.slot, i, &count);
+        }
+        mention(ra, instr->dst, i, &count);
+    }
+
+    if(func->live_out) {
+        for(size_t i = 0; i < count; i++) {
+            ra->intervals[i].end = func->instr_count;
+        }
+    }
+    return count;
+}
+
+static void insert_active(struct active_interval* active, size_t* num_active,
+        const struct active_interval* add) {
+    size_t i = *num_active;
+    while(i > 0 && active[i-1].end > add->end) {
+        active[i] = active[i-1];
+        i--;
+    }
+    active[i] = *add;
+    (*num_active)++;
+}
+
+static void linear_scan(struct reg_alloc* ra, size_t num_intervals) {
+    struct active_interval active[REGALLOC_NUM_REGS];
+    size_t num_active = 0;
+    uint32_t free_regs = (1u << REGALLOC_NUM_REGS) - 1; // Bit for each ALLOC_ORDER index.
+
+    for(size_t i = 0; i < num_intervals; i++) {
+        const struct live_interval* iv = &ra->intervals[i];
+
+        // Registers of intervals which ended are free again.
+        size_t num_expired = 0;
+        while(num_expired < num_active && active[num_expired].end < iv->start) {
+            free_regs |= 1u << active[num_expired].order;
+            num_expired++;
+        }
+        memmove(active, active + num_expired, (num_active - num_expired) * sizeof *active);
+        num_active -= num_expired;
+
+        struct active_interval add = { iv->end, iv->slot, 0 };
+
+        if(free_regs) {
+            add.order = __builtin_ctz(free_regs);
+            free_regs &= free_regs - 1;
+            ra->regs[iv->slot] = ALLOC_ORDER[add.order];
+            insert_active(active, &num_active, &add);
+            continue;
+        }
+
+        // Spill the one which is live the longest.
+        ra->num_spilled++;
+        struct active_interval* last = &active[num_active-1];
+        if(last->end > iv->end) {
+            add.order = last->order;
+            ra->regs[iv->slot] = ra->regs[last->slot];
+            ra->regs[last->slot] = SLOT_IN_STACK;
+            num_active--;
+            insert_active(active, &num_active, &add);
+        }
+        else {
+            ra->regs[iv->slot] = SLOT_IN_STACK;
+        }
+    }
+}
+
+bool regalloc_func(struct reg_alloc* ra, const struct ir_func* func) {
+    ra->saved_regs = 0;
+    ra->num_spilled = 0;
+
+    if(!reg_alloc_memcheck(ra, func->num_slots)) {
+        return false;
+    }
+    memset(ra->regs, SLOT_UNUSED, func->num_slots * sizeof *ra->regs);
+
+    const size_t num_intervals = find_intervals(ra, func);
+    linear_scan(ra, num_intervals);
+
+    for(size_t i = 0; i < num_intervals; i++) {
+        const int8_t reg = ra->regs[ra->intervals[i].slot];
+        if(reg >= 0 && ((1u << reg) & CALLEE_SAVED_REGS)) {
+            ra->saved_regs |= 1u << reg;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ir.h"
+#include "x86_encode.h"
+
+
+// Linear scan register allocation for the i32 variables of one function.
+//
+// A variable is live from the first to the last instruction which uses it.
+// Intervals are visited by their start, each one takes a free register.
+// When none is free, the active interval which ends last goes to its stack
+// slot from the frame layout ('slot.rbp_off'), or the new one if it ends later.
+// Caller saved registers are used first, callee saved ones only when
+// those run out, the function then has to save them.
+
+#define REGALLOC_NUM_REGS 13
+
+// Never allocated, code generation uses it when both operands are in the stack.
+#define REGALLOC_SCRATCH_REG REG_R11
+
+// Values of 'reg_alloc.regs' which are not registers.
+#define SLOT_IN_STACK -1 // Spilled.
+#define SLOT_UNUSED   -2 // Not used in the function.
+
+struct live_interval {
+    size_t   start; // Index of the instruction.
+    size_t   end;
+    uint32_t slot;
+};
+
+struct reg_alloc {
+    int8_t* regs; // For each slot of the function, enum x86_reg or SLOT_*
+    size_t  regs_num_alloc; // Of each array.
+
+    uint32_t saved_regs;  // Callee saved registers used, bit for each enum x86_reg.
+    size_t   num_spilled;
+
+    struct live_interval* intervals;     // Sorted by start.
+    uint32_t*             slot_interval; // Index in 'intervals' of each slot.
+};
+
+
+// Memory comes from the arena selected with 'arena_use()'
+void create_reg_alloc(struct reg_alloc* ra);
+void free_reg_alloc(struct reg_alloc* ra);
+
+// With 'func->live_out' the variables are live until the function returns.
+// Returns 'false' on memory error.
+bool regalloc_func(struct reg_alloc* ra, const struct ir_func* func);
+
+
+
+#endif
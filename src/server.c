@@ -0,0 +1,522 @@
+#define _GNU_SOURCE // accept4()
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "arena.h"
+#include "error.h"
+
+
+#define SERVER_MAGIC 0x48495356 // "HISV"
+#define SERVER_NUM_FDS 3        // stdin, stdout and stderr.
+#define SERVER_READ_TIMEOUT_SEC 10
+
+// Sent with the client's file descriptors and followed by 'size' bytes:
+// the working directory and 'num_args' arguments, each ending with a zero byte.
+// The server replies with the exit code as an 'int32_t'.
+struct server_request {
+    uint32_t magic;
+    uint32_t num_args;
+    uint32_t size;
+};
+
+// What the server restores after each request.
+struct server_state {
+    int std_fds[SERVER_NUM_FDS];
+    int cwd_fd;
+};
+
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+static bool read_all(int fd, void* buffer, size_t size) {
+    char* ptr = buffer;
+    while(size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* buffer, size_t size) {
+    const char* ptr = buffer;
+    while(size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool make_socket_addr(const char* socket_path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+
+    const size_t len = strlen(socket_path);
+    if(len >= sizeof(addr->sun_path)) {
+        errprintf("%s: Socket path \"%s\" is too long\n", __func__, socket_path);
+        return false;
+    }
+    memcpy(addr->sun_path, socket_path, len+1);
+    return true;
+}
+
+// Returns -1 and sets 'errno' if nothing is listening on the socket.
+static int connect_socket(const struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, (const struct sockaddr*)addr, sizeof *addr) < 0) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static int open_server_socket(const char* socket_path) {
+    struct sockaddr_un addr;
+    if(!make_socket_addr(socket_path, &addr)) {
+        return -1;
+    }
+
+    // A socket left by a server which didnt exit cleanly is removed,
+    // one which is still served is not taken over.
+    struct stat sb;
+    if(lstat(socket_path, &sb) == 0) {
+        if(!S_ISSOCK(sb.st_mode)) {
+            errprintf("%s: \"%s\" exists and is not a socket\n", __func__, socket_path);
+            return -1;
+        }
+        int other = connect_socket(&addr);
+        if(other >= 0) {
+            close(other);
+            errprintf("%s: A server is already listening on \"%s\"\n", __func__, socket_path);
+            return -1;
+        }
+        if(unlink(socket_path) < 0) {
+            errprintf("%s: unlink() | %s\n", __func__, strerror(errno));
+            return -1;
+        }
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        errprintf("%s: socket() | %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if(bind(fd, (const struct sockaddr*)&addr, sizeof addr) < 0) {
+        errprintf("%s: bind() | %s\n", __func__, strerror(errno));
+        goto error;
+    }
+
+    // Clients can make the server read and write files as it's user.
+    if(chmod(socket_path, 0600) < 0) {
+        errprintf("%s: chmod() | %s\n", __func__, strerror(errno));
+        unlink(socket_path);
+        goto error;
+    }
+
+    if(listen(fd, SERVER_BACKLOG) < 0) {
+        errprintf("%s: listen() | %s\n", __func__, strerror(errno));
+        unlink(socket_path);
+        goto error;
+    }
+    return fd;
+
+error:
+    close(fd);
+    return -1;
+}
+
+// Receives the request header and the client's file descriptors.
+static bool recv_request(int conn, struct server_request* request, int fds[SERVER_NUM_FDS]) {
+    union {
+        char           buf[CMSG_SPACE(SERVER_NUM_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = { .iov_base = request, .iov_len = sizeof *request };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0) {
+        errprintf("%s: recvmsg() | %s\n", __func__, strerror(errno));
+        return false;
+    }
+    if(n == 0) {
+        return false; // Only checked if the server is running.
+    }
+
+    bool got_fds = false;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        const size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if(num_fds == SERVER_NUM_FDS) {
+            memcpy(fds, CMSG_DATA(cmsg), SERVER_NUM_FDS * sizeof(int));
+            got_fds = true;
+        }
+        else {
+            // Close whatever was sent.
+            int* sent = (int*)CMSG_DATA(cmsg);
+            for(size_t i = 0; i < num_fds; i++) {
+                close(sent[i]);
+            }
+        }
+    }
+
+    if(!got_fds) {
+        errprintf("%s: Request without file descriptors\n", __func__);
+        return false;
+    }
+
+    // The header can arrive in pieces, the descriptors come with the first one.
+    if((size_t)n < sizeof *request
+    && !read_all(conn, (char*)request + n, sizeof *request - n)) {
+        errprintf("%s: Incomplete request\n", __func__);
+        goto error;
+    }
+
+    if(request->magic != SERVER_MAGIC || request->size > SERVER_MAX_REQUEST_SIZE) {
+        errprintf("%s: Invalid request\n", __func__);
+        goto error;
+    }
+    return true;
+
+error:
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        close(fds[i]);
+    }
+    return false;
+}
+
+// Builds 'argv' from the payload, the first string is the working directory.
+static char** parse_request_args(char* payload, const struct server_request* request,
+        char* argv0, const char** cwd) {
+    // Each argument takes at least it's zero byte.
+    if(request->size == 0 || payload[request->size-1] != '\0'
+    || request->num_args >= request->size) {
+        return NULL;
+    }
+
+    char** argv = calloc(request->num_args + 2, sizeof *argv);
+    if(!argv) {
+        PRINT_MEMERROR("calloc");
+        return NULL;
+    }
+    argv[0] = argv0;
+
+    char* ptr = payload;
+    char* end = payload + request->size;
+
+    *cwd = ptr;
+    ptr += strlen(ptr) + 1;
+
+    for(uint32_t i = 0; i < request->num_args; i++) {
+        if(ptr >= end) {
+            free(argv);
+            return NULL;
+        }
+        argv[i+1] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+    return argv;
+}
+
+// Runs 'func' with the client's standard streams and working directory.
+static int serve_request(int conn, char* argv0, server_request_func func,
+        const struct server_state* state) {
+    int exit_code = 1;
+
+    struct server_request request;
+    int fds[SERVER_NUM_FDS];
+    if(!recv_request(conn, &request, fds)) {
+        return -1;
+    }
+
+    char* payload = malloc(request.size ? request.size : 1);
+    char** argv = NULL;
+    const char* cwd = NULL;
+    if(!payload) {
+        PRINT_MEMERROR("malloc");
+        goto out;
+    }
+    if(!read_all(conn, payload, request.size)) {
+        errprintf("%s: Incomplete request\n", __func__);
+        goto out;
+    }
+
+    argv = parse_request_args(payload, &request, argv0, &cwd);
+    if(!argv) {
+        errprintf("%s: Invalid request arguments\n", __func__);
+        goto out;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        dup2(fds[i], i);
+    }
+
+    if(chdir(cwd) < 0) {
+        errprintf("%s: chdir(\"%s\") | %s\n", __func__, cwd, strerror(errno));
+    }
+    else {
+        exit_code = func(request.num_args + 1, argv);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);
+    clearerr(stderr);
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        dup2(state->std_fds[i], i);
+    }
+    if(fchdir(state->cwd_fd) < 0) {
+        errprintf("%s: fchdir() | %s\n", __func__, strerror(errno));
+    }
+
+out:
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        close(fds[i]);
+    }
+    free(argv);
+    free(payload);
+    return exit_code;
+}
+
+bool run_server(const char* socket_path, char* argv0, server_request_func func) {
+    bool result = false;
+    struct server_state state = { { -1, -1, -1 }, -1 };
+
+    // Closed clients should not kill the server and stop signals interrupt 'accept()'.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    sa.sa_handler = handle_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int server_fd = open_server_socket(socket_path);
+    if(server_fd < 0) {
+        return false;
+    }
+
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        state.std_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, SERVER_NUM_FDS);
+        if(state.std_fds[i] < 0) {
+            errprintf("%s: fcntl() | %s\n", __func__, strerror(errno));
+            goto out;
+        }
+    }
+    state.cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(state.cwd_fd < 0) {
+        errprintf("%s: open() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+
+    while(!server_stop) {
+        int conn = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(conn < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            errprintf("%s: accept() | %s\n", __func__, strerror(errno));
+            goto out;
+        }
+
+        // A client which connects and sends nothing doesnt block the others forever.
+        struct timeval timeout = { .tv_sec = SERVER_READ_TIMEOUT_SEC, .tv_usec = 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+        int32_t exit_code = serve_request(conn, argv0, func, &state);
+        if(exit_code >= 0) {
+            write_all(conn, &exit_code, sizeof exit_code);
+        }
+        close(conn);
+
+        // Memory stays allocated for the next request.
+        reset_phase_arenas();
+    }
+    result = true;
+
+out:
+    for(int i = 0; i < SERVER_NUM_FDS; i++) {
+        if(state.std_fds[i] >= 0) {
+            close(state.std_fds[i]);
+        }
+    }
+    if(state.cwd_fd >= 0) {
+        close(state.cwd_fd);
+    }
+    close(server_fd);
+    unlink(socket_path);
+    return result;
+}
+
+int run_client(const char* socket_path, char* argv0, int num_args, char** args,
+        server_request_func func) {
+    int exit_code = 1;
+    char* payload = NULL;
+
+    struct sockaddr_un addr;
+    if(!make_socket_addr(socket_path, &addr)) {
+        return 1;
+    }
+
+    int fd = connect_socket(&addr);
+    if(fd < 0) {
+        if(errno == ENOENT || errno == ECONNREFUSED) {
+            // No server, compile here.
+            char** argv = calloc(num_args + 2, sizeof *argv);
+            if(!argv) {
+                PRINT_MEMERROR("calloc");
+                return 1;
+            }
+            argv[0] = argv0;
+            memcpy(argv + 1, args, num_args * sizeof *args);
+            exit_code = func(num_args + 1, argv);
+            free(argv);
+            return exit_code;
+        }
+        errprintf("%s: connect() | %s\n", __func__, strerror(errno));
+        return 1;
+    }
+
+    // The server closing the connection is reported, not fatal.
+    signal(SIGPIPE, SIG_IGN);
+
+    char cwd[PATH_MAX];
+    if(!getcwd(cwd, sizeof cwd)) {
+        errprintf("%s: getcwd() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+
+    size_t size = strlen(cwd) + 1;
+    for(int i = 0; i < num_args; i++) {
+        size += strlen(args[i]) + 1;
+    }
+    if(size > SERVER_MAX_REQUEST_SIZE) {
+        errprintf("%s: Too many arguments\n", __func__);
+        goto out;
+    }
+
+    payload = malloc(size);
+    if(!payload) {
+        PRINT_MEMERROR("malloc");
+        goto out;
+    }
+
+    char* ptr = payload;
+    const size_t cwd_len = strlen(cwd) + 1;
+    memcpy(ptr, cwd, cwd_len);
+    ptr += cwd_len;
+    for(int i = 0; i < num_args; i++) {
+        const size_t len = strlen(args[i]) + 1;
+        memcpy(ptr, args[i], len);
+        ptr += len;
+    }
+
+    struct server_request request = {
+        .magic = SERVER_MAGIC,
+        .num_args = num_args,
+        .size = size
+    };
+
+    union {
+        char           buf[CMSG_SPACE(SERVER_NUM_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof control);
+
+    struct iovec iov = { .iov_base = &request, .iov_len = sizeof request };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(SERVER_NUM_FDS * sizeof(int));
+    const int fds[SERVER_NUM_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0) {
+        errprintf("%s: sendmsg() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+    if((size_t)n < sizeof request
+    && !write_all(fd, (char*)&request + n, sizeof request - n)) {
+        errprintf("%s: write() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+    if(!write_all(fd, payload, size)) {
+        errprintf("%s: write() | %s\n", __func__, strerror(errno));
+        goto out;
+    }
+
+    int32_t reply;
+    if(!read_all(fd, &reply, sizeof reply)) {
+        errprintf("%s: Server closed the connection\n", __func__);
+        goto out;
+    }
+    exit_code = reply;
+
+out:
+    free(payload);
+    close(fd);
+    return exit_code;
+}
@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+
+
+// Keeps one compiler process running so build scripts dont pay for
+// starting a process, and the phase arenas stay allocated between compiles.
+//
+// A client connects to the server's Unix socket and sends it's working directory,
+// arguments and it's stdin, stdout and stderr. The server compiles with
+// the client's files as it's own standard streams, so inputs, outputs and
+// diagnostics are the same as running the compiler directly,
+// and replies with the exit code. Requests are served one at a time.
+
+#define SERVER_BACKLOG 64
+#define SERVER_MAX_REQUEST_SIZE (1024 * 1024)
+
+
+// Handles one request like 'main()', 'argv[0]' is the server's.
+typedef int (*server_request_func)(int argc, char** argv);
+
+// Serves requests until SIGINT or SIGTERM. The socket is removed on exit.
+bool run_server(const char* socket_path, char* argv0, server_request_func func);
+
+// Sends 'args' to the server and returns the exit code of the compile.
+// If no server is listening on 'socket_path' compiles in this process instead.
+int run_client(const char* socket_path, char* argv0, int num_args, char** args,
+        server_request_func func);
+
+
+#endif
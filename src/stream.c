@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "stream.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "binder.h"
+#include "arena.h"
+#include "trace.h"
+
+
+bool compile_stream(const char* input_file, const char* output_file, enum output_format format) {
+    bool result = false;
+
+    struct token_array tokens;
+    if(!tokenize_open(input_file, &tokens)) {
+        goto out;
+    }
+
+    if(!parser_begin()) {
+        goto free_and_out;
+    }
+
+    struct code_gen cg;
+    if(!asm_code_gen_begin(&cg, output_file, format)) {
+        goto parser_end_and_out;
+    }
+
+    size_t pos = 0;
+    size_t num_parsed = 0; // Tokens before this index are already parsed.
+    int    scope_depth = 0;
+    bool   done = false;
+
+    while(!done) {
+        if(!tokenize_next(&tokens, &pos, STREAM_CHUNK_SIZE)) {
+            goto abort;
+        }
+        done = (pos >= tokens.source_size);
+
+        // Chunks end at line boundaries so no construct is split.
+        if(!parse_tokens_from(&tokens, num_parsed)) {
+            goto abort;
+        }
+
+        // Find where the last completed function ends.
+        size_t gen_end = 0;
+        for(size_t i = num_parsed; i < tokens.token_count; i++) {
+            switch(tokens.array[i].type) {
+                case TOK_OPEN_SCOPE:
+                    scope_depth++;
+                    break;
+
+                case TOK_CLOSE_SCOPE:
+                    scope_depth--;
+                    if(scope_depth <= 0) {
+                        scope_depth = 0;
+                        gen_end = i + 1;
+                    }
+                    break;
+            }
+        }
+
+        if(done) {
+            gen_end = tokens.token_count;
+        }
+
+        if(gen_end > 0) {
+            if(!bind_tokens_range(&tokens, 0, gen_end)) {
+                goto abort;
+            }
+            arena_reset(get_phase_arena(ARENA_PARSE));
+
+            TRACE_BEGIN("codegen");
+            asm_code_gen_tokens(&cg, &tokens, 0, gen_end);
+            TRACE_END("codegen");
+
+            // Move the unfinished function to the beginning of the window.
+            memmove(&tokens.array[0],
+                    &tokens.array[gen_end],
+                    (tokens.token_count - gen_end) * sizeof *tokens.array);
+            tokens.token_count -= gen_end;
+        }
+
+        num_parsed = tokens.token_count;
+    }
+
+    result = asm_code_gen_end(&cg);
+    goto parser_end_and_out;
+
+abort:
+    asm_code_gen_abort(&cg);
+
+parser_end_and_out:
+    parser_end();
+free_and_out:
+    free_token_array(&tokens);
+out:
+    return result;
+}
@@ -0,0 +1,21 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+
+#include "asm_code_gen.h"
+
+
+// Source is tokenized this many bytes at a time in streaming mode.
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+
+// Tokenize, parse and generate code in one pass.
+// The tokenizer fills a small token window a chunk at a time,
+// the parser works on the new tokens and every completed function
+// is given to code generation and removed from the window.
+// So memory use depends on the largest function, not the input size.
+bool compile_stream(const char* input_file, const char* output_file, enum output_format format);
+
+
+#endif
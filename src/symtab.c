@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "symtab.h"
+#include "error.h"
+#include "trace.h"
+
+
+bool create_symtab(struct symtab* st) {
+    st->map = create_symbol_map(64); // <- Initial size.
+    st->undo = NULL;
+    st->undo_count = 0;
+    st->undo_num_alloc = 0;
+    st->scope_start = NULL;
+    st->scope_num_alloc = 0;
+    st->depth = 0;
+
+    if(!st->map.table.ctrl) {
+        PRINT_MEMERROR("create_symbol_map");
+        return false;
+    }
+    return true;
+}
+
+void free_symtab(struct symtab* st) {
+    free_symbol_map(&st->map);
+    arena_memfree(st->undo);
+    arena_memfree(st->scope_start);
+    st->undo = NULL;
+    st->scope_start = NULL;
+    st->undo_count = 0;
+    st->undo_num_alloc = 0;
+    st->scope_num_alloc = 0;
+    st->depth = 0;
+}
+
+void symtab_reset(struct symtab* st) {
+    symbol_map_clear(&st->map);
+    st->undo_count = 0;
+    st->depth = 0;
+}
+
+bool symtab_push_scope(struct symtab* st) {
+    if(st->depth >= st->scope_num_alloc) {
+        const size_t num_alloc = st->scope_num_alloc ? st->scope_num_alloc * 2 : 16;
+        size_t* tmp_ptr = arena_memrealloc(st->scope_start, num_alloc * sizeof *tmp_ptr, MEM_SYMTAB);
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return false;
+        }
+        st->scope_start = tmp_ptr;
+        st->scope_num_alloc = num_alloc;
+    }
+
+    st->scope_start[st->depth] = st->undo_count;
+    st->depth++;
+    return true;
+}
+
+void symtab_pop_scope(struct symtab* st) {
+    if(st->depth == 0) {
+        return;
+    }
+    st->depth--;
+
+    const size_t start = st->scope_start[st->depth];
+
+    // Newest first, so a name declared twice in the scope
+    // ends up with the value it had before the scope.
+    while(st->undo_count > start) {
+        struct symtab_undo* undo = &st->undo[--st->undo_count];
+        if(undo->shadowed) {
+            symbol_map_put(&st->map, undo->name, undo->prev);
+        }
+        else {
+            symbol_map_del(&st->map, undo->name);
+        }
+    }
+}
+
+struct symbol* symtab_declare(struct symtab* st, const char* name, size_t len) {
+    const struct hashmap_str_key key = { name, len };
+
+    if(st->undo_count >= st->undo_num_alloc) {
+        const size_t num_alloc = st->undo_num_alloc ? st->undo_num_alloc * 2 : 64;
+        struct symtab_undo* tmp_ptr = arena_memrealloc(st->undo, num_alloc * sizeof *tmp_ptr, MEM_SYMTAB);
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return NULL;
+        }
+        st->undo = tmp_ptr;
+        st->undo_num_alloc = num_alloc;
+    }
+
+    struct symtab_undo* undo = &st->undo[st->undo_count];
+    undo->name = key;
+    undo->shadowed = false;
+
+    struct symbol* sym = symbol_map_get(&st->map, key);
+    if(sym) {
+        undo->shadowed = true;
+        undo->prev = *sym;
+    }
+    else {
+        const struct symbol empty = { 0 };
+        if(!symbol_map_add(&st->map, key, empty)) {
+            PRINT_MEMERROR("symbol_map_add");
+            return NULL;
+        }
+        sym = symbol_map_get(&st->map, key);
+    }
+
+    st->undo_count++;
+    TRACE_COUNT(TRACE_SYMBOLS, 1);
+
+    sym->depth = st->depth;
+    sym->type = 0;
+    sym->slot = 0;
+    return sym;
+}
+
+struct symbol* symtab_lookup(struct symtab* st, const char* name, size_t len) {
+    return symbol_map_get(&st->map, (struct hashmap_str_key){ name, len });
+}
+
+bool symtab_declared_in_scope(struct symtab* st, const char* name, size_t len) {
+    const struct symbol* sym = symtab_lookup(st, name, len);
+    return sym && sym->depth == st->depth;
+}
@@ -0,0 +1,71 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "hashmap.h"
+
+
+// Variables visible at the current point of the code.
+//
+// The map has only the innermost declaration of each name, so lookups
+// dont depend on the nesting depth. Declarations are also written to
+// an undo log, leaving a scope replays the log back to where the scope
+// started: shadowed declarations are restored and the rest are removed.
+
+
+struct symbol {
+    size_t   depth; // Scope where this was declared.
+    uint8_t  type;  // enum var_type
+    uint32_t slot;  // Set by 'bind_tokens()'
+};
+
+HASHMAP_DEFINE(symbol_map, struct hashmap_str_key, struct symbol)
+
+struct symtab_undo {
+    struct hashmap_str_key name;
+    bool                   shadowed; // 'prev' is restored when the scope ends.
+    struct symbol          prev;
+};
+
+struct symtab {
+    struct symbol_map map;
+
+    struct symtab_undo* undo;
+    size_t              undo_count;
+    size_t              undo_num_alloc;
+
+    // 'undo_count' when each scope was entered.
+    size_t* scope_start;
+    size_t  scope_num_alloc;
+    size_t  depth;           // 0 is outside of all scopes.
+};
+
+
+// Memory comes from the arena selected with 'arena_use()'
+bool create_symtab(struct symtab* st);
+void free_symtab(struct symtab* st);
+
+// Removes everything and goes back to depth 0.
+void symtab_reset(struct symtab* st);
+
+bool symtab_push_scope(struct symtab* st);
+
+// Costs the number of declarations in the scope.
+// Does nothing at depth 0.
+void symtab_pop_scope(struct symtab* st);
+
+// Name memory is not copied, it must outlive the scope.
+// Returns NULL on memory error.
+// If the name is already declared in the current scope
+// that declaration is replaced.
+struct symbol* symtab_declare(struct symtab* st, const char* name, size_t len);
+
+// Returns NULL if the name is not visible.
+struct symbol* symtab_lookup(struct symtab* st, const char* name, size_t len);
+
+bool symtab_declared_in_scope(struct symtab* st, const char* name, size_t len);
+
+
+#endif
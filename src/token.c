@@ -35,37 +35,35 @@ const char* get_token_name(enum token_type type) {
 }
 
 
-void set_token_rawdata(struct token* tok, char* buf, size_t len) {
-    if(len >= sizeof(tok->raw_data)) {
-        return;
-    }
-    memset(tok->raw_data, 0, sizeof(tok->raw_data));
-    memmove(tok->raw_data, buf, len);
-    tok->raw_data_empty = false;
-}
+void token_position(const struct token_array* tokens, const struct token* tok,
+        size_t* line, int* column) {
+    size_t line_num = 1;
+    size_t line_start = 0;
 
-void zero_token(struct token* tok) {
-    tok->type = 0;
-    if(!tok->raw_data_empty) {
-        memset(tok->raw_data, 0, sizeof(tok->raw_data));
-        tok->raw_data_empty = true;
+    const size_t end = (tok->offset < tokens->source_size) ? tok->offset : tokens->source_size;
+    for(size_t i = 0; i < end; i++) {
+        if(tokens->source[i] == '\n') {
+            line_num++;
+            line_start = i + 1;
+        }
     }
+
+    *line = line_num;
+    *column = (int)(tok->offset - line_start);
 }
 
 void remove_empty_tokens(struct token_array* tokens) {
-    for(int64_t i = 0; i < (int64_t)tokens->token_count; i++) {
-        struct token* tok = &tokens->array[i];
-        
-        if(tok->type != TOK_NONE) {
+    size_t write_idx = 0;
+
+    for(size_t read_idx = 0; read_idx < tokens->token_count; read_idx++) {
+        if(tokens->array[read_idx].type == TOK_NONE) {
             continue;
         }
-
-        memmove(&tokens->array[i],
-                &tokens->array[i + 1],
-                (tokens->token_count - (i + 1)) * sizeof *tokens->array );
-
-        tokens->token_count--;
-        i--;
+        if(write_idx != read_idx) {
+            tokens->array[write_idx] = tokens->array[read_idx];
+        }
+        write_idx++;
     }
-}
 
+    tokens->token_count = write_idx;
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 
 enum token_type {
@@ -50,53 +51,103 @@ enum var_type {
 };
 
 
+// Tokens dont copy their text, they point into the mapped source file.
+// Line and column are not stored either, 'offset' is enough to find them
+// when an error message needs them. See 'token_position()'
 struct token {
-    enum token_type type;
-
-    char            raw_data[64];
-    bool            raw_data_empty;
+    uint8_t  type;   // enum token_type
+    uint16_t len;    // Length of the text.
+    uint32_t offset; // Offset of the text in 'token_array.source'
 
     union {
         
         struct {
-            int value;
+            int32_t value;
         }
         lit_i32; // Literal 32bit int.
    
+        // Token text is the variable name.
+        // 'slot' is set by 'bind_tokens()'
         struct {
-            enum var_type type;
-            char          name[64];
-            uint32_t      name_len;
+            uint32_t type : 8;  // enum var_type
+            uint32_t slot : 24; // Index in the function's frame.
         }
         var;
 
+        // Token text is the function label.
         struct {
-            enum var_type ret_type;
-            char          label[64];
-            uint32_t      label_len;
+            uint8_t ret_type; // enum var_type
         }
         func;
 
+        // "{" of a function, set by 'bind_tokens()'
+        struct {
+            uint32_t frame; // Index in 'token_array.frames'
+        }
+        scope;
 
     }
     data;
+};
+
+#define TOKEN_MAX_LEN UINT16_MAX
+
+#define FRAME_MAX_SLOTS ((1 << 24) - 1)
+
+
+// Variable of a function.
+struct slot {
+    int32_t rbp_off; // At [rbp - rbp_off]
+    uint8_t type;    // enum var_type
+};
+
+// Variables of a function are slots 'first_slot' to 'first_slot + num_slots'
+// in 'frame_table.slots', in the order they are declared.
+struct frame {
+    size_t   first_slot;
+    uint32_t num_slots;
+    uint32_t size;      // Bytes below rbp.
+};
+
+struct frame_table {
+    struct frame* frames;
+    size_t        frame_count;
+    size_t        frames_num_alloc;
 
-    size_t line;
-    int    column;
+    struct slot*  slots;
+    size_t        slot_count;
+    size_t        slots_num_alloc;
 };
 
 struct token_array {
     struct token* array;
     size_t        array_num_alloc; // Number of tokens allocated.
     size_t        token_count;
+    bool          array_mapped;    // 'array' is mmapped instead of from the lex arena.
 
     char*         file_path;
+
+    // Mapped input file, tokens point here.
+    const char*   source;
+    size_t        source_size;
+
+    // Frames of the functions, from the lex arena.
+    struct frame_table frames;
 };
 
-void        zero_token(struct token* tok);
-void        set_token_data(struct token* tok, char* buf, size_t len);
+// Pointer to token's text, it is not null terminated. Use 'tok->len'
+#define TOKEN_TEXT(tokens, tok) ((tokens)->source + (tok)->offset)
+
+// Counts the line (starting from 1) and column (starting from 0)
+// of the token from the source.
+void        token_position(const struct token_array* tokens, const struct token* tok,
+                size_t* line, int* column);
+
 const char* get_token_name(enum token_type type);
 
+// Removes TOK_NONE tokens in one pass.
+// 'parse_tokens()' doesnt leave any so this is only needed
+// if tokens are removed some other way.
 void        remove_empty_tokens(struct token_array* tokens);
 
 
@@ -1,19 +1,20 @@
+#define _GNU_SOURCE // mremap()
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "tokenizer.h"
 #include "fileio.h"
 #include "common.h"
 #include "error.h"
-
-
-// Token characters dont require space to be in between them.
-// For example: "600, i32" and "600,i32"  are bot valid.
-static const char TOKEN_CHAR[] = {
-    '{', '}', '(', ')', ':', ',', '.', '@'
-};
+#include "lexscan.h"
+#include "arena.h"
+#include "trace.h"
+#include "memprof.h"
 
 
 struct token_map_elem {
@@ -22,8 +23,6 @@ struct token_map_elem {
 };
 
 static const struct token_map_elem TOKEN_MAP[] = {
-    { TOK_EOL, "__EOL__" },
-    { TOK_EOF, "__EOF__" },
     { TOK_COMMENT, "//" },
     { TOK_FUNC, "func" },
     { TOK_MOV, "mov" },
@@ -43,185 +42,564 @@ static const struct token_map_elem TOKEN_MAP[] = {
 };
 
 
-// Prepare to add new element to token array.
-// Allocate more memory if needed.
-static bool token_array_prep_add(struct token_array* tokens, int num_add) {
+// Keywords are found with a perfect hash built from TOKEN_MAP,
+// so every lexeme costs one hash and at most one compare.
+// The seed is searched once so that no two keywords share a slot.
+
+#define KEYWORD_TABLE_SIZE 64 // Power of 2, at least 2x number of keywords.
+
+struct keyword_slot {
+    const struct token_map_elem* elem; // NULL for empty slot.
+    uint8_t                      len;
+};
+
+static struct {
+    bool                ready;
+    uint32_t            seed;
+    struct keyword_slot slots[KEYWORD_TABLE_SIZE];
+}
+keyword_table;
+
+static inline uint32_t keyword_hash(uint32_t seed, const char* str, size_t len) {
+    uint32_t h = 2166136261u ^ seed; // FNV-1a
+    for(size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)str[i];
+        h *= 16777619u;
+    }
+    return (h ^ (h >> 15)) & (KEYWORD_TABLE_SIZE-1);
+}
+
+static bool init_keyword_table() {
+    _Static_assert(ARRAY_LEN(TOKEN_MAP) * 2 <= KEYWORD_TABLE_SIZE,
+            "KEYWORD_TABLE_SIZE is too small for TOKEN_MAP");
+
+    for(uint32_t seed = 0; seed < 0x10000; seed++) {
+        memset(keyword_table.slots, 0, sizeof(keyword_table.slots));
+
+        bool collision = false;
+        for(size_t i = 0; i < ARRAY_LEN(TOKEN_MAP); i++) {
+            const size_t len = strlen(TOKEN_MAP[i].type_str);
+            struct keyword_slot* slot
+                = &keyword_table.slots[keyword_hash(seed, TOKEN_MAP[i].type_str, len)];
+
+            if(slot->elem) {
+                collision = true;
+                break;
+            }
+            slot->elem = &TOKEN_MAP[i];
+            slot->len = len;
+        }
+
+        if(!collision) {
+            keyword_table.seed = seed;
+            keyword_table.ready = true;
+            return true;
+        }
+    }
+
+    errprintf("%s: No perfect hash found for TOKEN_MAP\n", __func__);
+    return false;
+}
+
+// Files can be tokenized from many threads at once.
+static pthread_once_t keyword_table_once = PTHREAD_ONCE_INIT;
+
+static void init_keyword_table_once() {
+    init_keyword_table();
+}
+
+// Returns TOK_SYMBOL if 'str' is not a keyword.
+static inline enum token_type find_keyword(const char* str, size_t len) {
+    const struct keyword_slot* slot
+        = &keyword_table.slots[keyword_hash(keyword_table.seed, str, len)];
+
+    if(slot->elem
+    && (slot->len == len)
+    && (memcmp(slot->elem->type_str, str, len) == 0)) {
+        return slot->elem->type;
+    }
+    return TOK_SYMBOL;
+}
+
+
+// Small arrays come from the lex arena.
+// Larger ones are mmapped so mremap() can grow them without copying.
+static bool token_array_resize(struct token_array* tokens, size_t num_alloc) {
+    const size_t old_memsize = tokens->array_num_alloc * sizeof *tokens->array;
+    size_t new_memsize = num_alloc * sizeof *tokens->array;
 
-    if(tokens->token_count + num_add < tokens->array_num_alloc) {
+    if(!tokens->array_mapped && new_memsize < TOKEN_ARRAY_MMAP_SIZE) {
+        struct token* tmp_ptr = arena_memrealloc(tokens->array, new_memsize, MEM_TOKENS);
+        if(!tmp_ptr) {
+            PRINT_MEMERROR("arena_memrealloc");
+            return false;
+        }
+        tokens->array = tmp_ptr;
+        tokens->array_num_alloc = num_alloc;
         return true;
     }
 
-    num_add += 100;
+    // Use the whole last page.
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    new_memsize = (new_memsize + page_size - 1) & ~(page_size - 1);
 
-    const size_t new_memsize = sizeof *tokens->array * (tokens->array_num_alloc + num_add);
-    struct token* tmp_ptr = realloc(tokens->array, new_memsize);
-    if(!tmp_ptr) {
-        PRINT_MEMERROR("realloc");
-        return false;
+    void* new_ptr = MAP_FAILED;
+    if(tokens->array_mapped) {
+        new_ptr = mremap(tokens->array, old_memsize, new_memsize, MREMAP_MAYMOVE);
+        if(new_ptr == MAP_FAILED) {
+            errprintf("%s: mremap() | %s\n", __func__, strerror(errno));
+            return false;
+        }
+        mem_track_realloc(MEM_TOKENS, old_memsize, new_memsize, 0);
+    }
+    else {
+        new_ptr = mmap(NULL, new_memsize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(new_ptr == MAP_FAILED) {
+            errprintf("%s: mmap() | %s\n", __func__, strerror(errno));
+            return false;
+        }
+        mem_track_alloc(MEM_TOKENS, new_memsize);
+        if(tokens->array) {
+            memcpy(new_ptr, tokens->array, tokens->token_count * sizeof *tokens->array);
+            mem_track_copy(MEM_TOKENS, tokens->token_count * sizeof *tokens->array);
+            arena_memfree(tokens->array);
+        }
+        tokens->array_mapped = true;
     }
 
-    tokens->array = tmp_ptr;
-    tokens->array_num_alloc += num_add;
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
+    tokens->array = new_ptr;
+    tokens->array_num_alloc = new_memsize / sizeof *tokens->array;
     return true;
 }
 
+static void free_token_array_memory(struct token_array* tokens) {
+    if(tokens->array_mapped) {
+        munmap(tokens->array, tokens->array_num_alloc * sizeof *tokens->array);
+        mem_track_free(MEM_TOKENS, tokens->array_num_alloc * sizeof *tokens->array);
+    }
+    else {
+        arena_memfree(tokens->array);
+    }
+    tokens->array = NULL;
+    tokens->array_num_alloc = 0;
+    tokens->array_mapped = false;
+
+    arena_memfree(tokens->frames.slots);
+    arena_memfree(tokens->frames.frames);
+    tokens->frames = (struct frame_table){ 0 };
+}
+
+// Prepare to add new elements to token array.
+// Capacity is doubled when it runs out.
+static bool token_array_prep_add(struct token_array* tokens, size_t num_add) {
+
+    if(tokens->token_count + num_add <= tokens->array_num_alloc) {
+        return true;
+    }
+
+    size_t num_alloc = tokens->array_num_alloc * 2;
+    if(num_alloc < tokens->token_count + num_add) {
+        num_alloc = tokens->token_count + num_add;
+    }
+    if(num_alloc < TOKEN_ARRAY_MIN_ALLOC) {
+        num_alloc = TOKEN_ARRAY_MIN_ALLOC;
+    }
+
+    return token_array_resize(tokens, num_alloc);
+}
+
+// Capacity guess for 'size' bytes of source.
+static inline size_t estimate_token_count(size_t size) {
+    return size / TOKEN_SOURCE_BYTES + TOKEN_ARRAY_MIN_ALLOC;
+}
+
 
 
-static bool add_token(struct token_array* tokens, size_t line, size_t column, char* str) {
+// 'type' TOK_SYMBOL is checked for keywords.
+static bool add_token(struct token_array* tokens, enum token_type type, size_t offset, size_t len) {
     if(!token_array_prep_add(tokens, 1)) {
         return false;
     }
     
     struct token* curr_tok = &tokens->array[tokens->token_count++];
 
-    curr_tok->type = TOK_SYMBOL;
-    curr_tok->raw_data_empty = true;
-    curr_tok->line = line;
-    curr_tok->column = column;
+    if(len > TOKEN_MAX_LEN) {
+        struct token tmp = { .offset = offset };
+        size_t line = 0;
+        int column = 0;
+        token_position(tokens, &tmp, &line, &column);
+        errmsg(tokens->file_path, line, column, "Too long token \"%.32s...\"", tokens->source + offset);
+        return false;
+    }
 
-    for(size_t i = 0; i < ARRAY_LEN(TOKEN_MAP); i++) {
-        const struct token_map_elem* elem = &TOKEN_MAP[i];
-        if(strcmp(str, elem->type_str) == 0) {
-            curr_tok->type = elem->type;
-            break;
+    if(type == TOK_SYMBOL) {
+        type = find_keyword(tokens->source + offset, len);
+    }
+
+    curr_tok->type = type;
+    curr_tok->offset = offset;
+    curr_tok->len = len;
+    curr_tok->data.lit_i32.value = 0;
+
+    return true;
+}
+
+
+// Tokenizes source bytes from 'start' to 'end' into 'tokens->array'.
+// 'start' must be at the beginning of a line, symbols cant continue past 'end'.
+static bool tokenize_range(struct token_array* tokens, size_t start, size_t end) {
+    const char* input_data = tokens->source;
+
+    // The input is classified 64 bytes at a time into bit masks,
+    // then token boundaries are found from the set bits.
+    // Symbols are everything between newlines, spaces and token characters.
+    const lex_scan_func lex_scan = get_lex_scan_func();
+
+    size_t sym_start = start; // Start of the symbol being read.
+
+    for(size_t block = start; block < end; block += LEXSCAN_BLOCK_SIZE) {
+        struct lex_masks masks;
+
+        const size_t remaining = end - block;
+        if(remaining >= LEXSCAN_BLOCK_SIZE) {
+            lex_scan(input_data + block, &masks);
+        }
+        else {
+            // Zeros are symbol characters, they never end a token.
+            char tail[LEXSCAN_BLOCK_SIZE] = { 0 };
+            memcpy(tail, input_data + block, remaining);
+            lex_scan(tail, &masks);
+        }
+
+        uint64_t delims = masks.newline | masks.space | masks.token_char;
+        while(delims) {
+            const int bit = __builtin_ctzll(delims);
+            const uint64_t bit_mask = (uint64_t)1 << bit;
+            const size_t i = block + bit;
+            delims &= delims - 1;
+
+            if(i > sym_start) {
+                if(!add_token(tokens, TOK_SYMBOL, sym_start, i - sym_start)) {
+                    return false;
+                }
+            }
+            sym_start = i + 1;
+
+            if(masks.newline & bit_mask) {
+                // Empty lines dont have TOK_EOL.
+                if((i > 0) && (input_data[i-1] != '\n')) {
+                    if(!add_token(tokens, TOK_EOL, i, 0)) {
+                        return false;
+                    }
+                }
+            }
+            else
+            if(masks.token_char & bit_mask) {
+                if(!add_token(tokens, TOK_SYMBOL, i, 1)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if(end > sym_start) {
+        if(!add_token(tokens, TOK_SYMBOL, sym_start, end - sym_start)) {
+            return false;
         }
     }
-   
-    size_t str_len = strlen(str);
-    if(str_len >= sizeof(curr_tok->raw_data)-1) {
-        errmsg(tokens->file_path, line, column, "Too long symbol \"%s\"", str);
+
+    return true;
+}
+
+
+struct tokenize_job {
+    pthread_t          thread;
+    struct token_array tokens; // Shares 'source' and 'file_path' with the result.
+    size_t             start;
+    size_t             end;
+    bool               result;
+};
+
+static void* tokenize_job_thread(void* arg) {
+    struct tokenize_job* job = arg;
+    TRACE_BEGIN("tokenize chunk");
+    job->result = token_array_prep_add(&job->tokens, estimate_token_count(job->end - job->start))
+        && tokenize_range(&job->tokens, job->start, job->end);
+    TRACE_END("tokenize chunk");
+    return NULL;
+}
+
+// Splits the source into 'num_jobs' chunks at line boundaries
+// and tokenizes them in parallel. Results are joined in order.
+// Token offsets are absolute so nothing needs to be adjusted.
+static bool tokenize_parallel(struct token_array* tokens, size_t num_jobs) {
+    bool result = false;
+
+    struct tokenize_job* jobs = mem_calloc(MEM_JOBS, num_jobs, sizeof *jobs);
+    if(!jobs) {
+        PRINT_MEMERROR("mem_calloc");
         return false;
     }
 
-    memset(curr_tok->raw_data, 0, sizeof(curr_tok->raw_data));
-    memcpy(curr_tok->raw_data, str, str_len);
+    const size_t chunk_size = tokens->source_size / num_jobs;
+    size_t chunk_start = 0;
+    size_t num_started = 0;
+
+    for(size_t i = 0; i < num_jobs; i++) {
+        struct tokenize_job* job = &jobs[i];
+
+        size_t chunk_end = tokens->source_size;
+        if(i+1 < num_jobs) {
+            chunk_end = chunk_start + chunk_size;
+            if(chunk_end > tokens->source_size) {
+                chunk_end = tokens->source_size;
+            }
+            const char* nl = memchr(tokens->source + chunk_end, '\n',
+                    tokens->source_size - chunk_end);
+            chunk_end = nl ? (size_t)(nl - tokens->source) + 1 : tokens->source_size;
+        }
+
+        job->tokens = *tokens;
+        job->tokens.array = NULL;
+        job->tokens.array_num_alloc = 0;
+        job->tokens.array_mapped = false;
+        job->tokens.token_count = 0;
+        job->start = chunk_start;
+        job->end = chunk_end;
+        job->result = false;
+
+        if(pthread_create(&job->thread, NULL, tokenize_job_thread, job) != 0) {
+            errprintf("%s: pthread_create() | %s\n", __func__, strerror(errno));
+            break;
+        }
+        num_started++;
 
-    if(curr_tok->type == TOK_SYMBOL) {
-        curr_tok->raw_data_empty = false;
+        chunk_start = chunk_end;
     }
 
-    return true;
+    size_t total_count = 0;
+    bool jobs_ok = (num_started == num_jobs);
+
+    for(size_t i = 0; i < num_started; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        jobs_ok = jobs_ok && jobs[i].result;
+        total_count += jobs[i].tokens.token_count;
+    }
+
+    if(!jobs_ok) {
+        goto out;
+    }
+
+    if(!token_array_prep_add(tokens, total_count + 1)) {
+        goto out;
+    }
+
+    for(size_t i = 0; i < num_jobs; i++) {
+        memcpy(tokens->array + tokens->token_count,
+                jobs[i].tokens.array,
+                jobs[i].tokens.token_count * sizeof *tokens->array);
+        tokens->token_count += jobs[i].tokens.token_count;
+    }
+
+    result = true;
+
+out:
+    for(size_t i = 0; i < num_jobs; i++) {
+        free_token_array_memory(&jobs[i].tokens);
+    }
+    mem_free(jobs);
+    return result;
 }
 
 
-bool tokenize(const char* input_file, struct token_array* tokens) {
+bool tokenize_open(const char* input_file, struct token_array* tokens) {
     bool result = false;
     char* input_data = NULL;
     size_t input_size = 0;
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
 
     tokens->array = NULL;
     tokens->array_num_alloc = 0;
     tokens->token_count = 0;
+    tokens->array_mapped = false;
+    tokens->file_path = NULL;
+    tokens->source = NULL;
+    tokens->source_size = 0;
+    tokens->frames = (struct frame_table){ 0 };
+
+    pthread_once(&keyword_table_once, init_keyword_table_once);
+    if(!keyword_table.ready) {
+        goto out;
+    }
 
+    // '-' reads the source from stdin.
+    if(strcmp(input_file, "-") == 0) {
+        if(!read_fd_mapped(STDIN_FILENO, &input_data, &input_size)) {
+            goto out;
+        }
+    }
+    else
     if(!map_file(input_file, PROT_READ, &input_data, &input_size)) {
         goto out;
     }
 
+    // Tokens keep 32 bit offsets into the source.
+    if(input_size > UINT32_MAX) {
+        errprintf("%s: \"%s\" is too large (%li bytes)\n", __func__, input_file, input_size);
+        munmap(input_data, input_size);
+        goto out;
+    }
+
+    tokens->source = input_data;
+    tokens->source_size = input_size;
+    mem_track_alloc(MEM_SOURCE, input_size);
+
 
     const size_t input_file_len = strlen(input_file);
-    tokens->file_path = calloc(input_file_len+1, sizeof *tokens->file_path);
+    tokens->file_path = arena_memalloc(input_file_len+1, MEM_OTHER);
+    if(!tokens->file_path) {
+        PRINT_MEMERROR("arena_memalloc");
+        munmap(input_data, input_size);
+        mem_track_free(MEM_SOURCE, input_size);
+        tokens->source = NULL;
+        goto out;
+    }
     memcpy(tokens->file_path,
             input_file,
-            input_file_len);
-
-    char* ch = &input_data[0];
-    size_t num_lines = 1;
-    size_t column    = 0;
+            input_file_len+1);
 
-    char buffer[64] = { 0 };
-    size_t buf_idx = 0;
+    result = true;
 
-    while(ch < input_data + input_size) {
-        char prev_ch = *ch;
-        if(ch > input_data) {
-            prev_ch = *(ch - 1);
-        }
+out:
+    arena_use(prev_arena);
+    return result;
+}
 
-        if(*ch == '\n') {
+bool tokenize_next(struct token_array* tokens, size_t* pos, size_t chunk_size) {
+    bool result = false;
+    const size_t start = *pos;
+    if(start >= tokens->source_size) {
+        return true;
+    }
 
-            if(prev_ch != '\n') {
-                if(buf_idx > 0) {
-                    if(!add_token(tokens, num_lines, column, buffer)) {
-                        goto error;
-                    }
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+    TRACE_BEGIN("tokenize");
+    const size_t start_count = tokens->token_count;
 
-                    memset(buffer, 0, sizeof(buffer));
-                    buf_idx = 0;
-                }
+    size_t end = tokens->source_size;
+    if(tokens->source_size - start > chunk_size) {
+        const char* nl = memchr(tokens->source + start + chunk_size, '\n',
+                tokens->source_size - (start + chunk_size));
+        if(nl) {
+            end = (size_t)(nl - tokens->source) + 1;
+        }
+    }
 
-                add_token(tokens, num_lines, column, "__EOL__");
-            }
+    if(!tokenize_range(tokens, start, end)) {
+        goto out;
+    }
 
-            memset(buffer, 0, sizeof(buffer));
-            num_lines++;
-            column = 0;
-            buf_idx = 0;
+    *pos = end;
+    if(end >= tokens->source_size) {
+        result = add_token(tokens, TOK_EOF, tokens->source_size, 0);
+        goto out;
+    }
+    result = true;
 
-            ch++;
-            continue;
-        }
-        
+out:
+    TRACE_COUNT(TRACE_TOKENS, tokens->token_count - start_count);
+    TRACE_END("tokenize");
+    arena_use(prev_arena);
+    return result;
+}
 
-        if(*ch == ' ') {
-            if(buf_idx == 0) {
-                goto skip;
-            }
-            if(!add_token(tokens, num_lines, column, buffer)) {
-                goto error;
-            }
+bool tokenize(const char* input_file, struct token_array* tokens, int num_threads) {
+    bool result = false;
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+    TRACE_BEGIN("tokenize");
 
-            memset(buffer, 0, sizeof(buffer));
-            buf_idx = 0;
-        
-        }
-        else {
+    if(!tokenize_open(input_file, tokens)) {
+        goto out;
+    }
 
-            // Test for token characters first.
-            for(size_t i = 0; i < ARRAY_LEN(TOKEN_CHAR); i++) {
-                if(*ch == TOKEN_CHAR[i]) {
-
-                    if(buf_idx > 0) {
-                        if(!add_token(tokens, num_lines, column, buffer)) {
-                            goto error;
-                        }
-                        memset(buffer, 0, sizeof(buffer));
-                        buf_idx = 0;
-                    }   
-
-                    char tmp[2] = { *ch, 0 };
-                    if(add_token(tokens, num_lines, column, tmp)) {
-                        goto skip;
-                    }
-                    else {
-                        goto error;
-                    }
-                }
-            }
+    const size_t input_size = tokens->source_size;
 
-            if(buf_idx >= sizeof(buffer)) {
-                errmsg(input_file, num_lines, column, "Too long token \"%s\"", buffer);
-                free_token_array(tokens);
-                goto error;
-            }
+    // Small inputs are not worth starting threads for.
+    size_t num_jobs = (num_threads > 1) ? (size_t)num_threads : 1;
+    if(num_jobs > input_size / TOKENIZE_MIN_CHUNK_SIZE) {
+        num_jobs = input_size / TOKENIZE_MIN_CHUNK_SIZE;
+    }
 
-            buffer[buf_idx++] = *ch;
+    if(num_jobs > 1) {
+        if(!tokenize_parallel(tokens, num_jobs)) {
+            goto error;
+        }
+    }
+    else {
+        if(!token_array_prep_add(tokens, estimate_token_count(input_size))) {
+            goto error;
+        }
+        if(!tokenize_range(tokens, 0, input_size)) {
+            goto error;
         }
-skip:
-        column++;
-        ch++;
     }
-
      
-    add_token(tokens, num_lines, 0, "__EOF__");
+    if(!add_token(tokens, TOK_EOF, input_size, 0)) {
+        goto error;
+    }
+
+    TRACE_COUNT(TRACE_TOKENS, tokens->token_count);
+    result = true;
 
 error:
-    munmap(input_data, input_size);
+    if(!result) {
+        free_token_array(tokens);
+    }
 out:
+    TRACE_END("tokenize");
+    arena_use(prev_arena);
     return result;
 }
 
-void free_token_array(struct token_array* tokens) {
-    freeif(tokens->array);
-    freeif(tokens->file_path);
+void create_token_subarray(struct token_array* sub, const struct token_array* tokens) {
+    *sub = *tokens;
+    sub->array = NULL;
+    sub->array_num_alloc = 0;
+    sub->array_mapped = false;
+    sub->token_count = 0;
+    sub->frames = (struct frame_table){ 0 };
 }
 
+bool token_array_append(struct token_array* tokens, const struct token* src, size_t count) {
+    struct arena* prev_arena = arena_use_phase(ARENA_LEX);
+    const bool result = token_array_prep_add(tokens, count);
+    arena_use(prev_arena);
+
+    if(!result) {
+        return false;
+    }
+    memcpy(tokens->array + tokens->token_count, src, count * sizeof *src);
+    tokens->token_count += count;
+    return true;
+}
+
+void free_token_subarray(struct token_array* sub) {
+    free_token_array_memory(sub);
+    sub->token_count = 0;
+}
+
+void free_token_array(struct token_array* tokens) {
+    free_token_array_memory(tokens);
+    arena_memfree(tokens->file_path);
+    tokens->array = NULL;
+    tokens->file_path = NULL;
+
+    if(tokens->source) {
+        munmap((void*)tokens->source, tokens->source_size);
+        mem_track_free(MEM_SOURCE, tokens->source_size);
+        tokens->source = NULL;
+        tokens->source_size = 0;
+    }
+}
@@ -6,7 +6,39 @@
 #include "token.h"
 
 
-bool tokenize(const char* input_file, struct token_array* tokens);
+// Each thread gets at least this many bytes of the input.
+#define TOKENIZE_MIN_CHUNK_SIZE (1024 * 1024)
+
+// Token array capacity is first guessed from the input size with this.
+// Measured 2.8 - 3.3 bytes per token on dense code, 7.6 with long comments.
+// Overestimating is cheap because large arrays are mmapped
+// and untouched pages are never used.
+#define TOKEN_SOURCE_BYTES 3
+
+#define TOKEN_ARRAY_MIN_ALLOC 256
+
+// Arrays from this size are mmapped instead of allocated from the arena.
+#define TOKEN_ARRAY_MMAP_SIZE (1024 * 1024)
+
+// If 'num_threads' is more than 1 large inputs are
+// split at line boundaries and tokenized in parallel.
+bool tokenize(const char* input_file, struct token_array* tokens, int num_threads);
+
+// Streaming: 'tokenize_open()' maps the file without tokenizing it.
+// Then each 'tokenize_next()' call appends tokens of at least 'chunk_size' bytes
+// from '*pos', always ending at a line boundary, and advances '*pos'.
+// TOK_EOF is added after the last chunk.
+bool tokenize_open(const char* input_file, struct token_array* tokens);
+bool tokenize_next(struct token_array* tokens, size_t* pos, size_t chunk_size);
+
+// Sub arrays share the source and file path of 'tokens' but have their own tokens.
+// Used to parse and generate only some parts of the input.
+void create_token_subarray(struct token_array* sub, const struct token_array* tokens);
+bool token_array_append(struct token_array* tokens, const struct token* src, size_t count);
+void free_token_subarray(struct token_array* sub);
+
+// Token memory is allocated from the ARENA_LEX arena,
+// this only unmaps the source if that arena is reset anyway.
 void free_token_array(struct token_array* tokens);
 
 
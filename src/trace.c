@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "error.h"
+
+
+#ifndef HI_ASM_NO_TRACE
+
+struct trace_event {
+    const char* name;
+    uint64_t    start_ns; // Since 'trace_start()'.
+    uint64_t    wall_ns;
+    uint64_t    cpu_ns;
+    uint32_t    detail_len;
+    char        detail[TRACE_DETAIL_LEN];
+};
+
+struct trace_open_span {
+    const char* name;
+    uint64_t    start_ns;
+    uint64_t    start_cpu_ns;
+};
+
+// Events and counters of one thread. Kept after the thread exits,
+// until 'trace_stop()'.
+struct trace_thread {
+    struct trace_thread* next;
+    uint32_t             id;
+
+    struct trace_event* events;
+    size_t              num_events;
+    size_t              events_num_alloc;
+
+    struct trace_open_span stack[TRACE_MAX_DEPTH];
+    size_t                 depth;
+
+    size_t counters[TRACE_NUM_COUNTERS];
+};
+
+static const char* counter_names[TRACE_NUM_COUNTERS] = {
+    [TRACE_TOKENS]         = "tokens",
+    [TRACE_SYMBOLS]        = "symbols declared",
+    [TRACE_HASHMAP_PROBES] = "hashmap probes",
+    [TRACE_BYTES_EMITTED]  = "bytes emitted",
+    [TRACE_SYSCALLS]       = "syscalls",
+    [TRACE_SPILLS]         = "spilled variables"
+};
+
+bool trace_enabled = false;
+
+static struct {
+    pthread_mutex_t      lock;
+    struct trace_thread* threads;
+    uint32_t             next_id;
+    uint64_t             start_ns;
+    uint64_t             generation; // Thread buffers of earlier traces are gone.
+}
+trace = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0 };
+
+static _Thread_local struct trace_thread* self = NULL;
+static _Thread_local uint64_t             self_generation = 0;
+
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns NULL on memory error, then the thread's probes do nothing.
+static struct trace_thread* get_self() {
+    if(self && self_generation == trace.generation) {
+        return self;
+    }
+
+    struct trace_thread* thread = calloc(1, sizeof *thread);
+    if(!thread) {
+        PRINT_MEMERROR("calloc");
+        self = NULL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+    thread->id = trace.next_id++;
+    thread->next = trace.threads;
+    trace.threads = thread;
+    self_generation = trace.generation;
+    pthread_mutex_unlock(&trace.lock);
+
+    self = thread;
+    return thread;
+}
+
+void trace_span_begin(const char* name) {
+    struct trace_thread* thread = get_self();
+    if(!thread || thread->depth >= TRACE_MAX_DEPTH) {
+        return;
+    }
+
+    struct trace_open_span* span = &thread->stack[thread->depth++];
+    span->name = name;
+    span->start_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    span->start_ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+void trace_span_end(const char* name, const char* detail, size_t detail_len) {
+    const uint64_t end_ns = clock_ns(CLOCK_MONOTONIC);
+    const uint64_t end_cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    struct trace_thread* thread = get_self();
+    if(!thread) {
+        return;
+    }
+
+    // Spans opened inside this one and left open are dropped.
+    size_t index = thread->depth;
+    while(index > 0 && thread->stack[index-1].name != name
+                    && strcmp(thread->stack[index-1].name, name) != 0) {
+        index--;
+    }
+    if(index == 0) {
+        return;
+    }
+    thread->depth = index - 1;
+    const struct trace_open_span* span = &thread->stack[index-1];
+
+    if(thread->num_events >= thread->events_num_alloc) {
+        const size_t new_num_alloc = thread->events_num_alloc ? thread->events_num_alloc * 2 : 1024;
+        struct trace_event* new_ptr = realloc(thread->events, new_num_alloc * sizeof *new_ptr);
+        if(!new_ptr) {
+            PRINT_MEMERROR("realloc");
+            return;
+        }
+        thread->events = new_ptr;
+        thread->events_num_alloc = new_num_alloc;
+    }
+
+    struct trace_event* event = &thread->events[thread->num_events++];
+    event->name = name;
+    event->start_ns = span->start_ns - trace.start_ns;
+    event->wall_ns = end_ns - span->start_ns;
+    event->cpu_ns = end_cpu_ns - span->start_cpu_ns;
+
+    if(detail_len > TRACE_DETAIL_LEN) {
+        detail_len = TRACE_DETAIL_LEN;
+    }
+    event->detail_len = detail_len;
+    if(detail_len > 0) {
+        memcpy(event->detail, detail, detail_len);
+    }
+}
+
+void trace_count(enum trace_counter counter, size_t n) {
+    struct trace_thread* thread = get_self();
+    if(thread) {
+        thread->counters[counter] += n;
+    }
+}
+
+bool trace_start() {
+    pthread_mutex_lock(&trace.lock);
+    trace.generation++;
+    trace.threads = NULL;
+    trace.next_id = 0;
+    trace.start_ns = clock_ns(CLOCK_MONOTONIC);
+    pthread_mutex_unlock(&trace.lock);
+
+    trace_enabled = true;
+    get_self(); // Calling thread is the first one.
+    return true;
+}
+
+
+// --- Time report ---
+
+struct span_total {
+    const char* name;
+    size_t      count;
+    uint64_t    first_start_ns;
+    uint64_t    wall_ns;
+    uint64_t    cpu_ns;
+};
+
+static int compare_totals(const void* a, const void* b) {
+    const uint64_t sa = ((const struct span_total*)a)->first_start_ns;
+    const uint64_t sb = ((const struct span_total*)b)->first_start_ns;
+    return (sa > sb) - (sa < sb);
+}
+
+static bool add_to_totals(struct span_total** totals, size_t* num_totals,
+        size_t* num_alloc, const struct trace_event* event) {
+    for(size_t i = 0; i < *num_totals; i++) {
+        struct span_total* total = &(*totals)[i];
+        if(total->name == event->name || strcmp(total->name, event->name) == 0) {
+            total->count++;
+            total->wall_ns += event->wall_ns;
+            total->cpu_ns += event->cpu_ns;
+            if(event->start_ns < total->first_start_ns) {
+                total->first_start_ns = event->start_ns;
+            }
+            return true;
+        }
+    }
+
+    if(*num_totals >= *num_alloc) {
+        const size_t new_num_alloc = *num_alloc ? *num_alloc * 2 : 32;
+        struct span_total* new_ptr = realloc(*totals, new_num_alloc * sizeof *new_ptr);
+        if(!new_ptr) {
+            PRINT_MEMERROR("realloc");
+            return false;
+        }
+        *totals = new_ptr;
+        *num_alloc = new_num_alloc;
+    }
+
+    (*totals)[(*num_totals)++] = (struct span_total){
+        event->name, 1, event->start_ns, event->wall_ns, event->cpu_ns
+    };
+    return true;
+}
+
+// Keeps the 'TRACE_NUM_SLOWEST' longest "function" spans, longest first.
+static void add_to_slowest(const struct trace_event** slowest, size_t* num_slowest,
+        const struct trace_event* event) {
+    if(strcmp(event->name, "function") != 0) {
+        return;
+    }
+
+    size_t index = *num_slowest;
+    if(index == TRACE_NUM_SLOWEST) {
+        if(slowest[index-1]->wall_ns >= event->wall_ns) {
+            return;
+        }
+        index--;
+    }
+    else {
+        (*num_slowest)++;
+    }
+
+    while(index > 0 && slowest[index-1]->wall_ns < event->wall_ns) {
+        slowest[index] = slowest[index-1];
+        index--;
+    }
+    slowest[index] = event;
+}
+
+static void print_time_report() {
+    struct span_total* totals = NULL;
+    size_t num_totals = 0;
+    size_t totals_num_alloc = 0;
+
+    const struct trace_event* slowest[TRACE_NUM_SLOWEST];
+    size_t num_slowest = 0;
+
+    size_t counters[TRACE_NUM_COUNTERS] = { 0 };
+
+    for(struct trace_thread* thread = trace.threads; thread; thread = thread->next) {
+        for(size_t i = 0; i < thread->num_events; i++) {
+            if(!add_to_totals(&totals, &num_totals, &totals_num_alloc, &thread->events[i])) {
+                goto out;
+            }
+            add_to_slowest(slowest, &num_slowest, &thread->events[i]);
+        }
+        for(size_t i = 0; i < TRACE_NUM_COUNTERS; i++) {
+            counters[i] += thread->counters[i];
+        }
+    }
+
+    qsort(totals, num_totals, sizeof *totals, compare_totals);
+
+    errprintf("%-24s %10s %12s %12s\n", "Time report", "count", "wall ms", "cpu ms");
+    for(size_t i = 0; i < num_totals; i++) {
+        errprintf("  %-22s %10zu %12.3f %12.3f\n",
+                totals[i].name, totals[i].count,
+                totals[i].wall_ns / 1e6, totals[i].cpu_ns / 1e6);
+    }
+
+    if(num_slowest > 0) {
+        errprintf("%-24s %10s %12s %12s\n", "Slowest functions", "", "wall ms", "cpu ms");
+        for(size_t i = 0; i < num_slowest; i++) {
+            errprintf("  %-33.*s %12.3f %12.3f\n",
+                    (int)slowest[i]->detail_len, slowest[i]->detail,
+                    slowest[i]->wall_ns / 1e6, slowest[i]->cpu_ns / 1e6);
+        }
+    }
+
+    errprintf("Counters\n");
+    for(size_t i = 0; i < TRACE_NUM_COUNTERS; i++) {
+        errprintf("  %-22s %10zu\n", counter_names[i], counters[i]);
+    }
+
+out:
+    free(totals);
+}
+
+
+// --- Chrome trace ---
+
+static void write_json_string(FILE* f, const char* str, size_t len) {
+    fputc('"', f);
+    for(size_t i = 0; i < len; i++) {
+        const unsigned char c = str[i];
+        if(c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        }
+        else
+        if(c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        }
+        else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Trace Event Format, opens in chrome://tracing and Perfetto.
+// Times are in microseconds.
+static bool write_trace_file(const char* trace_file) {
+    FILE* f = fopen(trace_file, "w");
+    if(!f) {
+        errprintf("%s: fopen(\"%s\") | %s\n", __func__, trace_file, strerror(errno));
+        return false;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+
+    size_t counters[TRACE_NUM_COUNTERS] = { 0 };
+    uint64_t end_ns = 0;
+
+    for(struct trace_thread* thread = trace.threads; thread; thread = thread->next) {
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"name\":\"%s %u\"}},\n",
+                thread->id, (thread->id == 0) ? "main" : "thread", thread->id);
+
+        for(size_t i = 0; i < thread->num_events; i++) {
+            const struct trace_event* event = &thread->events[i];
+            fputs("{\"name\":", f);
+            write_json_string(f, event->name, strlen(event->name));
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"cpu_us\":%.3f",
+                    thread->id, event->start_ns / 1e3, event->wall_ns / 1e3, event->cpu_ns / 1e3);
+            if(event->detail_len > 0) {
+                fputs(",\"detail\":", f);
+                write_json_string(f, event->detail, event->detail_len);
+            }
+            fputs("}},\n", f);
+
+            if(event->start_ns + event->wall_ns > end_ns) {
+                end_ns = event->start_ns + event->wall_ns;
+            }
+        }
+
+        for(size_t i = 0; i < TRACE_NUM_COUNTERS; i++) {
+            counters[i] += thread->counters[i];
+        }
+    }
+
+    // Totals of the counters at the end of the trace.
+    fprintf(f, "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{",
+            end_ns / 1e3);
+    for(size_t i = 0; i < TRACE_NUM_COUNTERS; i++) {
+        fprintf(f, "%s\"%s\":%zu", (i > 0) ? "," : "", counter_names[i], counters[i]);
+    }
+    fputs("}}\n]}\n", f);
+
+    if(fclose(f) != 0) {
+        errprintf("%s: fclose() | %s\n", __func__, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool trace_stop(bool time_report, const char* trace_file) {
+    trace_enabled = false;
+
+    bool result = true;
+    if(time_report) {
+        print_time_report();
+    }
+    if(trace_file && !write_trace_file(trace_file)) {
+        result = false;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+    struct trace_thread* thread = trace.threads;
+    while(thread) {
+        struct trace_thread* next = thread->next;
+        free(thread->events);
+        free(thread);
+        thread = next;
+    }
+    trace.threads = NULL;
+    trace.generation++;
+    pthread_mutex_unlock(&trace.lock);
+
+    self = NULL;
+    return result;
+}
+
+#else
+
+bool trace_start() {
+    errprintf("Built without tracing, --time-report and --trace do nothing. (TRACE=0)\n");
+    return false;
+}
+
+bool trace_stop(bool time_report, const char* trace_file) {
+    (void)time_report;
+    (void)trace_file;
+    return true;
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Instrumentation for --time-report and --trace.
+//
+// Spans time work on the calling thread, wall and thread cpu time.
+// They nest and are kept on a small per thread stack, 'TRACE_END()'
+// closes the innermost open span with the same name (and any opened
+// inside it), so error paths jumping over an end dont break later spans.
+//
+// Counters are summed over all threads.
+//
+// The probes only check a flag until 'trace_start()' is called.
+// Built with HI_ASM_NO_TRACE (make TRACE=0) they compile to nothing
+// and their arguments are not evaluated (only 'sizeof' sees them,
+// so variables used only by probes dont cause warnings).
+
+#define TRACE_MAX_DEPTH  16
+#define TRACE_DETAIL_LEN 48 // Longer details are cut.
+#define TRACE_NUM_SLOWEST 10
+
+
+enum trace_counter {
+    TRACE_TOKENS,
+    TRACE_SYMBOLS,         // Declarations seen by the binder.
+    TRACE_HASHMAP_PROBES,  // Groups of control bytes looked at.
+    TRACE_BYTES_EMITTED,   // Written to output and cache files.
+    TRACE_SYSCALLS,        // File and memory mapping calls.
+    TRACE_SPILLS,          // Variables the register allocator left in the stack.
+
+    TRACE_NUM_COUNTERS
+};
+
+
+#ifndef HI_ASM_NO_TRACE
+
+extern bool trace_enabled;
+
+void trace_span_begin(const char* name);
+
+// 'detail' is shown with the span, for example the function name.
+void trace_span_end(const char* name, const char* detail, size_t detail_len);
+
+void trace_count(enum trace_counter counter, size_t n);
+
+#define TRACE_BEGIN(name)\
+    do { if(trace_enabled) trace_span_begin(name); } while(0)
+
+#define TRACE_END(name)\
+    do { if(trace_enabled) trace_span_end(name, NULL, 0); } while(0)
+
+#define TRACE_END_DETAIL(name, detail, len)\
+    do { if(trace_enabled) trace_span_end(name, detail, len); } while(0)
+
+#define TRACE_COUNT(counter, n)\
+    do { if(trace_enabled) trace_count(counter, n); } while(0)
+
+#else
+
+#define TRACE_BEGIN(name)                   ((void)sizeof(name))
+#define TRACE_END(name)                     ((void)sizeof(name))
+#define TRACE_END_DETAIL(name, detail, len) ((void)sizeof(detail), (void)sizeof(len))
+#define TRACE_COUNT(counter, n)             ((void)sizeof(n))
+
+#endif
+
+
+// Starts collecting. Returns 'false' if built without tracing.
+bool trace_start();
+
+// Stops collecting, prints the time report to stderr if 'time_report' is set
+// and writes Chrome trace events to 'trace_file' if it's not NULL.
+// Everything collected is freed.
+bool trace_stop(bool time_report, const char* trace_file);
+
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "x86_encode.h"
+#include "error.h"
+#include "arena.h"
+
+
+#define REX_W 0x48
+#define REX_R 0x44
+#define REX_B 0x41
+
+
+void create_x86_code(struct x86_code* code) {
+    code->data = NULL;
+    code->size = 0;
+    code->mem_size = 0;
+    code->failed = false;
+}
+
+void free_x86_code(struct x86_code* code) {
+    if(code->data) {
+        arena_memfree(code->data);
+        code->data = NULL;
+    }
+    code->size = 0;
+    code->mem_size = 0;
+}
+
+static bool x86_code_memcheck(struct x86_code* code, size_t num_add) {
+    if(code->size + num_add <= code->mem_size) {
+        return true;
+    }
+
+    size_t new_mem_size = code->mem_size ? code->mem_size * 2 : 4096;
+    while(new_mem_size < code->size + num_add) {
+        new_mem_size *= 2;
+    }
+
+    uint8_t* new_ptr = arena_memrealloc(code->data, new_mem_size, MEM_CODE);
+    if(!new_ptr) {
+        PRINT_MEMERROR("arena_memrealloc");
+        code->failed = true;
+        return false;
+    }
+
+    code->data = new_ptr;
+    code->mem_size = new_mem_size;
+    return true;
+}
+
+static void emit_bytes(struct x86_code* code, const uint8_t* bytes, size_t size) {
+    if(!x86_code_memcheck(code, size)) {
+        return;
+    }
+    memcpy(code->data + code->size, bytes, size);
+    code->size += size;
+}
+
+static void emit_u32(struct x86_code* code, uint32_t u) {
+    uint8_t bytes[4] = {
+        u & 0xFF, (u >> 8) & 0xFF, (u >> 16) & 0xFF, (u >> 24) & 0xFF
+    };
+    emit_bytes(code, bytes, sizeof(bytes));
+}
+
+void x86_append_code(struct x86_code* code, const struct x86_code* from) {
+    if(from->failed) {
+        code->failed = true;
+        return;
+    }
+    emit_bytes(code, from->data, from->size);
+}
+
+void x86_append_bytes(struct x86_code* code, const uint8_t* bytes, size_t size) {
+    emit_bytes(code, bytes, size);
+}
+
+static inline uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+    return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+}
+
+
+void x86_push_r64(struct x86_code* code, enum x86_reg reg) {
+    if(reg >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_B }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x50 + (reg & 7) }, 1);
+}
+
+void x86_pop_r64(struct x86_code* code, enum x86_reg reg) {
+    if(reg >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_B }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x58 + (reg & 7) }, 1);
+}
+
+void x86_mov_r64_r64(struct x86_code* code, enum x86_reg dst, enum x86_reg src) {
+    uint8_t rex = REX_W;
+    if(src >= REG_R8) { rex |= REX_R; }
+    if(dst >= REG_R8) { rex |= REX_B; }
+
+    emit_bytes(code, (uint8_t[]){ rex, 0x89, modrm(3, src, dst) }, 3);
+}
+
+void x86_mov_r64_imm(struct x86_code* code, enum x86_reg dst, int64_t imm) {
+    if((imm >= 0) && (imm <= UINT32_MAX)) {
+        // Writing to 32 bit register zero extends.
+        if(dst >= REG_R8) {
+            emit_bytes(code, (uint8_t[]){ REX_B }, 1);
+        }
+        emit_bytes(code, (uint8_t[]){ 0xB8 + (dst & 7) }, 1);
+        emit_u32(code, (uint32_t)imm);
+    }
+    else
+    if((imm >= INT32_MIN) && (imm <= INT32_MAX)) {
+        // Sign extended imm32.
+        uint8_t rex = REX_W | ((dst >= REG_R8) ? REX_B : 0);
+        emit_bytes(code, (uint8_t[]){ rex, 0xC7, modrm(3, 0, dst) }, 3);
+        emit_u32(code, (uint32_t)imm);
+    }
+    else {
+        uint8_t rex = REX_W | ((dst >= REG_R8) ? REX_B : 0);
+        emit_bytes(code, (uint8_t[]){ rex, 0xB8 + (dst & 7) }, 2);
+        emit_u32(code, (uint32_t)imm);
+        emit_u32(code, (uint32_t)(imm >> 32));
+    }
+}
+
+// ModRM and displacement of [rbp-'rbp_off'], disp8 when it fits.
+static void emit_rbp_operand(struct x86_code* code, uint8_t reg, int rbp_off) {
+    const int32_t disp = -rbp_off;
+
+    if((disp >= INT8_MIN) && (disp <= INT8_MAX)) {
+        emit_bytes(code, (uint8_t[]){ modrm(1, reg, REG_RBP), (uint8_t)disp }, 2);
+    }
+    else {
+        emit_bytes(code, (uint8_t[]){ modrm(2, reg, REG_RBP) }, 1);
+        emit_u32(code, (uint32_t)disp);
+    }
+}
+
+void x86_mov_r32_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm) {
+    if(dst >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_B }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0xB8 + (dst & 7) }, 1);
+    emit_u32(code, (uint32_t)imm);
+}
+
+void x86_mov_m32_rbp_imm32(struct x86_code* code, int rbp_off, int32_t imm) {
+    emit_bytes(code, (uint8_t[]){ 0xC7 }, 1);
+    emit_rbp_operand(code, 0, rbp_off);
+    emit_u32(code, (uint32_t)imm);
+}
+
+void x86_mov_m32_rbp_r32(struct x86_code* code, int rbp_off, enum x86_reg src) {
+    if(src >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_R }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x89 }, 1);
+    emit_rbp_operand(code, src, rbp_off);
+}
+
+void x86_mov_r32_m32_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off) {
+    if(dst >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_R }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x8B }, 1);
+    emit_rbp_operand(code, dst, rbp_off);
+}
+
+// REX prefix of a 32 bit register to register instruction, if one is needed.
+static void emit_rex_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src) {
+    if(src >= REG_R8 || dst >= REG_R8) {
+        uint8_t rex = 0x40;
+        if(src >= REG_R8) { rex |= REX_R; }
+        if(dst >= REG_R8) { rex |= REX_B; }
+        emit_bytes(code, (uint8_t[]){ rex }, 1);
+    }
+}
+
+void x86_mov_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src) {
+    emit_rex_r32_r32(code, dst, src);
+    emit_bytes(code, (uint8_t[]){ 0x89, modrm(3, src, dst) }, 2);
+}
+
+static inline bool fits_imm8(int32_t imm) {
+    return (imm >= INT8_MIN) && (imm <= INT8_MAX);
+}
+
+void x86_add_r32_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm) {
+    if(dst >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_B }, 1);
+    }
+    if(fits_imm8(imm)) {
+        emit_bytes(code, (uint8_t[]){ 0x83, modrm(3, 0, dst), (uint8_t)imm }, 3);
+    }
+    else
+    if(dst == REG_RAX) {
+        emit_bytes(code, (uint8_t[]){ 0x05 }, 1);
+        emit_u32(code, (uint32_t)imm);
+    }
+    else {
+        emit_bytes(code, (uint8_t[]){ 0x81, modrm(3, 0, dst) }, 2);
+        emit_u32(code, (uint32_t)imm);
+    }
+}
+
+void x86_add_m32_rbp_imm32(struct x86_code* code, int rbp_off, int32_t imm) {
+    if(fits_imm8(imm)) {
+        emit_bytes(code, (uint8_t[]){ 0x83 }, 1);
+        emit_rbp_operand(code, 0, rbp_off);
+        emit_bytes(code, (uint8_t[]){ (uint8_t)imm }, 1);
+    }
+    else {
+        emit_bytes(code, (uint8_t[]){ 0x81 }, 1);
+        emit_rbp_operand(code, 0, rbp_off);
+        emit_u32(code, (uint32_t)imm);
+    }
+}
+
+void x86_add_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src) {
+    emit_rex_r32_r32(code, dst, src);
+    emit_bytes(code, (uint8_t[]){ 0x01, modrm(3, src, dst) }, 2);
+}
+
+void x86_add_r32_m32_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off) {
+    if(dst >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_R }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x03 }, 1);
+    emit_rbp_operand(code, dst, rbp_off);
+}
+
+void x86_add_m32_rbp_r32(struct x86_code* code, int rbp_off, enum x86_reg src) {
+    if(src >= REG_R8) {
+        emit_bytes(code, (uint8_t[]){ REX_R }, 1);
+    }
+    emit_bytes(code, (uint8_t[]){ 0x01 }, 1);
+    emit_rbp_operand(code, src, rbp_off);
+}
+
+void x86_xor_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src) {
+    emit_rex_r32_r32(code, dst, src);
+    emit_bytes(code, (uint8_t[]){ 0x31, modrm(3, src, dst) }, 2);
+}
+
+void x86_sub_r64_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm) {
+    const uint8_t rex = REX_W | ((dst >= REG_R8) ? REX_B : 0);
+    if(fits_imm8(imm)) {
+        emit_bytes(code, (uint8_t[]){ rex, 0x83, modrm(3, 5, dst), (uint8_t)imm }, 4);
+    }
+    else {
+        emit_bytes(code, (uint8_t[]){ rex, 0x81, modrm(3, 5, dst) }, 3);
+        emit_u32(code, (uint32_t)imm);
+    }
+}
+
+void x86_lea_r64_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off) {
+    const uint8_t rex = REX_W | ((dst >= REG_R8) ? REX_R : 0);
+    emit_bytes(code, (uint8_t[]){ rex, 0x8D }, 2);
+    emit_rbp_operand(code, dst, rbp_off);
+}
+
+void x86_ret(struct x86_code* code) {
+    emit_bytes(code, (uint8_t[]){ 0xC3 }, 1);
+}
+
+void x86_syscall(struct x86_code* code) {
+    emit_bytes(code, (uint8_t[]){ 0x0F, 0x05 }, 2);
+}
+
+size_t x86_call_rel32(struct x86_code* code) {
+    emit_bytes(code, (uint8_t[]){ 0xE8 }, 1);
+    const size_t at = code->size;
+    emit_u32(code, 0);
+    return at;
+}
+
+void x86_patch_rel32(struct x86_code* code, size_t at, size_t target) {
+    if(code->failed || (at + 4 > code->size)) {
+        return;
+    }
+
+    // Relative to the end of the instruction.
+    const uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(at + 4));
+    code->data[at+0] = rel & 0xFF;
+    code->data[at+1] = (rel >> 8) & 0xFF;
+    code->data[at+2] = (rel >> 16) & 0xFF;
+    code->data[at+3] = (rel >> 24) & 0xFF;
+}
+
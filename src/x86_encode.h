@@ -0,0 +1,81 @@
+#ifndef X86_ENCODE_H
+#define X86_ENCODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+enum x86_reg {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX,
+    REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10, REG_R11,
+    REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+
+// Machine code is encoded into this growing buffer.
+struct x86_code {
+    uint8_t* data;
+    size_t   size;
+    size_t   mem_size;
+
+    bool     failed; // Set if memory allocation failed.
+};
+
+void create_x86_code(struct x86_code* code);
+void free_x86_code(struct x86_code* code);
+
+// Appends already encoded machine code.
+void x86_append_code(struct x86_code* code, const struct x86_code* from);
+void x86_append_bytes(struct x86_code* code, const uint8_t* bytes, size_t size);
+
+
+void x86_push_r64(struct x86_code* code, enum x86_reg reg);
+void x86_pop_r64(struct x86_code* code, enum x86_reg reg);
+void x86_mov_r64_r64(struct x86_code* code, enum x86_reg dst, enum x86_reg src);
+
+// Picks the shortest encoding like nasm does.
+// For example "mov rax, 60" is encoded as "mov eax, 60".
+void x86_mov_r64_imm(struct x86_code* code, enum x86_reg dst, int64_t imm);
+
+// mov r32, imm32 (always the 5 or 6 byte form)
+void x86_mov_r32_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm);
+
+// mov DWORD PTR [rbp-'rbp_off'], 'imm'
+void x86_mov_m32_rbp_imm32(struct x86_code* code, int rbp_off, int32_t imm);
+
+// mov DWORD PTR [rbp-'rbp_off'], r32
+void x86_mov_m32_rbp_r32(struct x86_code* code, int rbp_off, enum x86_reg src);
+
+// mov r32, DWORD PTR [rbp-'rbp_off']
+void x86_mov_r32_m32_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off);
+
+void x86_mov_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src);
+
+// Immediates which fit in a byte use the sign extended imm8 form.
+void x86_add_r32_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm);
+void x86_add_m32_rbp_imm32(struct x86_code* code, int rbp_off, int32_t imm);
+
+void x86_add_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src);
+void x86_add_r32_m32_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off);
+void x86_add_m32_rbp_r32(struct x86_code* code, int rbp_off, enum x86_reg src);
+
+void x86_xor_r32_r32(struct x86_code* code, enum x86_reg dst, enum x86_reg src);
+
+// sub r64, imm (imm8 form when it fits)
+void x86_sub_r64_imm32(struct x86_code* code, enum x86_reg dst, int32_t imm);
+
+// lea r64, [rbp-'rbp_off']
+void x86_lea_r64_rbp(struct x86_code* code, enum x86_reg dst, int rbp_off);
+
+void x86_ret(struct x86_code* code);
+void x86_syscall(struct x86_code* code);
+
+// Returns offset of the rel32 field which needs to be patched
+// with 'x86_patch_rel32()' when the target is known.
+size_t x86_call_rel32(struct x86_code* code);
+void   x86_patch_rel32(struct x86_code* code, size_t at, size_t target);
+
+
+#endif